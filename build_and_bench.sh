@@ -0,0 +1,7 @@
+#!/usr/bin/bash
+
+set -euox pipefail
+
+c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_cpp_bench.cc -std=c++17 -O2 \
+  -DNDEBUG -lsqlite3 -lbenchmark -pthread -o sqlite_cpp_bench
+./sqlite_cpp_bench "$@"
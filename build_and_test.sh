@@ -2,5 +2,30 @@
 
 set -euox pipefail
 
-c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_cpp_test.cc -std=c++17 -lsqlite3
+c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_cpp_test.cc -std=c++17 -lsqlite3 -pthread
 ./a.out
+# The core is C++17, but also builds as C++20, where its rows are ranges; this
+# build checks the header-only hot paths too.
+c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_cpp_test.cc -std=c++20 \
+  -DSQLITE_CPP_HEADER_ONLY -lsqlite3 -pthread -o sqlite_cpp_test20
+./sqlite_cpp_test20
+c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_pool.cc sqlite_pool_test.cc \
+  -std=c++17 -lsqlite3 -pthread -o sqlite_pool_test
+./sqlite_pool_test
+c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_blob.cc sqlite_blob_test.cc \
+  -std=c++17 -lsqlite3 -pthread -o sqlite_blob_test
+./sqlite_blob_test
+# The coroutine layer needs C++20.
+c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_async.cc sqlite_async_test.cc \
+  -std=c++20 -lsqlite3 -pthread -o sqlite_async_test
+./sqlite_async_test
+c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_profile.cc sqlite_profile_test.cc \
+  -std=c++17 -lsqlite3 -pthread -o sqlite_profile_test
+./sqlite_profile_test
+c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_write_queue.cc \
+  sqlite_write_queue_test.cc -std=c++17 -lsqlite3 -pthread \
+  -o sqlite_write_queue_test
+./sqlite_write_queue_test
+c++ sqlite_blocking.cc sqlite_cpp.cc sqlite_backup.cc sqlite_backup_test.cc \
+  -std=c++17 -lsqlite3 -pthread -o sqlite_backup_test
+./sqlite_backup_test
@@ -0,0 +1,138 @@
+#include "sqlite_async.h"
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+namespace sqlite {
+
+namespace {
+
+// The executor whose worker is the current thread, if any.
+thread_local const Executor* current_executor = nullptr;
+
+// Steps stmt on executor, waiting for shared-cache locks the way
+// sqlite3_blocking_step() does but without blocking a thread. If reset, the
+// statement is reset first, on the executor too.
+Task<int> StepOn(Executor& executor, sqlite3_stmt* stmt, bool reset) {
+  co_await executor.Schedule();
+  if (reset) sqlite3_reset(stmt);
+  // Retrying means resetting the statement, which is only safe if it hasn't
+  // returned any rows yet.
+  bool fresh = !sqlite3_stmt_busy(stmt);
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_LOCKED && fresh) {
+    rc = co_await UnlockAwaiter(&executor, sqlite3_db_handle(stmt));
+    if (rc != SQLITE_OK) break;
+    sqlite3_reset(stmt);
+  }
+  co_return rc;
+}
+
+}  // namespace
+
+Executor::Executor(int num_threads) {
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this] { Work(); });
+  }
+}
+
+Executor::~Executor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  posted_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+void Executor::Post(std::coroutine_handle<> handle) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(handle);
+  }
+  posted_.notify_one();
+}
+
+bool Executor::IsCurrent() const { return current_executor == this; }
+
+void Executor::Work() {
+  current_executor = this;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    posted_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+    if (queue_.empty()) return;
+    std::coroutine_handle<> handle = queue_.front();
+    queue_.pop_front();
+    lock.unlock();
+    handle.resume();
+    lock.lock();
+  }
+}
+
+bool UnlockAwaiter::await_suspend(std::coroutine_handle<> handle) {
+  handle_ = handle;
+  // Notify() may run before this returns, even on this thread, and resume the
+  // coroutine elsewhere; nothing here may touch this awaiter afterwards.
+  int rc = sqlite3_unlock_notify(db_, &UnlockAwaiter::Notify, this);
+  if (rc != SQLITE_OK) {
+    // Waiting would deadlock; carry on without suspending.
+    rc_ = rc;
+    return false;
+  }
+  return true;
+}
+
+void UnlockAwaiter::Notify(void** args, int num_args) {
+  for (int i = 0; i < num_args; ++i) {
+    auto* awaiter = static_cast<UnlockAwaiter*>(args[i]);
+    awaiter->executor_->Post(awaiter->handle_);
+  }
+}
+
+Task<int> AsyncStatement::Step() { return DoStep(/*reset=*/false); }
+
+Task<bool> AsyncStatement::Run() {
+  co_return co_await DoStep(/*reset=*/true) == SQLITE_DONE;
+}
+
+Task<int> AsyncStatement::DoStep(bool reset) {
+  co_return stmt_->rc_ = co_await StepOn(*executor_, stmt_->stmt_, reset);
+}
+
+Task<int> AsyncExecRC(Executor& executor, sqlite3* db, string_view script) {
+  co_await executor.Schedule();
+  // As in ExecRC(), the script is compiled a statement at a time so that it
+  // need not be nul-terminated.
+  const char* current = script.data();
+  const char* end = script.data() + script.size();
+  int rc = SQLITE_OK;
+  while (current < end) {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = current;
+    while ((rc = sqlite3_prepare_v2(db, current,
+                                    static_cast<int>(end - current), &stmt,
+                                    &tail)) == SQLITE_LOCKED) {
+      rc = co_await UnlockAwaiter(&executor, db);
+      if (rc != SQLITE_OK) break;
+    }
+    current = tail;
+    if (rc == SQLITE_OK) {
+      if (!stmt) continue;  // No statement was compiled, skip.
+      while ((rc = co_await StepOn(executor, stmt, /*reset=*/false)) ==
+             SQLITE_ROW) {
+        // Ignore rows.
+      }
+    }
+    sqlite3_finalize(stmt);  // Always finalize stmts before returning.
+    if (rc != SQLITE_OK && rc != SQLITE_DONE) co_return rc;
+  }
+  co_return SQLITE_OK;
+}
+
+}  // namespace sqlite
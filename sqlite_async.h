@@ -0,0 +1,353 @@
+#ifndef THIRD_PARTY_SQLITE_SQLITE_ASYNC_H_
+#define THIRD_PARTY_SQLITE_SQLITE_ASYNC_H_
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#if !defined(__cpp_impl_coroutine) || __cplusplus < 202002L
+#error "sqlite_async.h requires C++20 coroutines"
+#endif
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace sqlite {
+
+// A small pool of threads that sqlite work is resumed on. Coroutines awaiting
+// Schedule() continue on one of its threads; lock waits do not occupy a
+// thread, since the waiting coroutine is only rescheduled once the lock is
+// released.
+class Executor {
+ public:
+  explicit Executor(int num_threads = 1);
+  Executor(const Executor&) = delete;
+  Executor& operator=(const Executor&) = delete;
+  // Runs everything already scheduled and joins the threads. Coroutines still
+  // waiting for locks must have finished first.
+  ~Executor();
+
+  // Awaitable that continues the awaiting coroutine on a worker thread,
+  // without suspending if it is already running on one.
+  struct ScheduleAwaiter {
+    Executor* executor;
+
+    bool await_ready() const noexcept { return executor->IsCurrent(); }
+    void await_suspend(std::coroutine_handle<> handle) const {
+      executor->Post(handle);
+    }
+    void await_resume() const noexcept {}
+  };
+  inline ScheduleAwaiter Schedule() { return ScheduleAwaiter{this}; }
+
+  // Resumes handle on a worker thread.
+  void Post(std::coroutine_handle<> handle);
+
+  // Whether the calling thread is one of this executor's workers.
+  bool IsCurrent() const;
+
+ private:
+  void Work();
+
+  std::mutex mutex_;
+  std::condition_variable posted_;
+  // Guarded by mutex_.
+  std::deque<std::coroutine_handle<>> queue_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+template <typename T>
+class TaskPromiseBase {
+ public:
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+
+  // Transfers control to whoever awaited the task.
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> handle) const noexcept {
+      return handle.promise().continuation();
+    }
+    void await_resume() const noexcept {}
+  };
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+
+  void unhandled_exception() { exception_ = std::current_exception(); }
+
+  inline std::coroutine_handle<> continuation() const { return continuation_; }
+  inline void set_continuation(std::coroutine_handle<> continuation) {
+    continuation_ = continuation;
+  }
+
+ protected:
+  void Rethrow() const {
+    if (exception_) std::rethrow_exception(exception_);
+  }
+
+ private:
+  std::coroutine_handle<> continuation_ = std::noop_coroutine();
+  std::exception_ptr exception_;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase<T> {
+ public:
+  Task<T> get_return_object();
+  template <typename Value>
+  void return_value(Value&& value) {
+    value_.emplace(std::forward<Value>(value));
+  }
+  T Result() {
+    this->Rethrow();
+    return std::move(*value_);
+  }
+
+ private:
+  std::optional<T> value_;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase<void> {
+ public:
+  Task<void> get_return_object();
+  void return_void() const noexcept {}
+  void Result() const { Rethrow(); }
+};
+
+}  // namespace detail
+
+// A lazily started coroutine producing a T. It starts when it is awaited, and
+// the awaiting coroutine continues wherever the task finishes.
+template <typename T>
+class Task {
+ public:
+  using promise_type = detail::TaskPromise<T>;
+
+  Task(Task&& move_from) noexcept
+      : handle_(std::exchange(move_from.handle_, nullptr)) {}
+  Task& operator=(Task&& move_from) noexcept {
+    if (this != &move_from) {
+      if (handle_) handle_.destroy();
+      handle_ = std::exchange(move_from.handle_, nullptr);
+    }
+    return *this;
+  }
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+    handle_.promise().set_continuation(awaiting);
+    return handle_;
+  }
+  T await_resume() { return handle_.promise().Result(); }
+
+ private:
+  friend promise_type;
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+  return Task<void>(
+      std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// An eagerly started coroutine that destroys itself when it finishes.
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+}  // namespace detail
+
+// Starts task without waiting for it. Exceptions escaping it terminate.
+inline void Spawn(Task<void> task) {
+  [](Task<void> task) -> detail::DetachedTask { co_await std::move(task); }(
+      std::move(task));
+}
+
+// Blocks the calling thread until task finishes and returns its result. For
+// tests and for the edges of a program; coroutines should co_await instead.
+template <typename T>
+T SyncWait(Task<T> task) {
+  std::mutex mutex;
+  std::condition_variable finished;
+  bool done = false;
+  std::exception_ptr exception;
+  std::optional<std::conditional_t<std::is_void_v<T>, char, T>> result;
+  auto wait = [&]() -> detail::DetachedTask {
+    try {
+      if constexpr (std::is_void_v<T>) {
+        co_await std::move(task);
+      } else {
+        result.emplace(co_await std::move(task));
+      }
+    } catch (...) {
+      exception = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    // Notified under the lock, since the waiter destroys finished once it
+    // sees done.
+    finished.notify_one();
+  };
+  wait();
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [&] { return done; });
+  if (exception) std::rethrow_exception(exception);
+  if constexpr (!std::is_void_v<T>) return std::move(*result);
+}
+
+// Awaitable that suspends until sqlite reports that the connection blocking db
+// has released its shared-cache lock, then continues on executor. Resumes
+// immediately with SQLITE_LOCKED if waiting would deadlock, and otherwise with
+// SQLITE_OK. This is the coroutine form of sqlite3_blocking_wait_for_unlock().
+class UnlockAwaiter {
+ public:
+  UnlockAwaiter(Executor* executor, sqlite3* db)
+      : executor_(executor), db_(db) {}
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> handle);
+  int await_resume() const noexcept { return rc_; }
+
+ private:
+  static void Notify(void** args, int num_args);
+
+  Executor* executor_;
+  sqlite3* db_;
+  std::coroutine_handle<> handle_;
+  int rc_ = SQLITE_OK;
+};
+
+// Coroutine counterparts of the blocking calls on a Statement. Each call
+// first moves the awaiting coroutine onto executor, so an event loop thread
+// never runs sqlite itself, and the coroutine continues on the executor's
+// thread: await the event loop's own scheduler afterwards to return to it.
+// When a shared-cache lock has to be waited for, the coroutine is suspended
+// until the lock is released instead of parking a thread. Busy database locks
+// are still retried by the connection's busy handler, on the executor thread.
+//
+// The Statement must outlive the AsyncStatement and must not be used by
+// anything else while an operation is in flight.
+//
+// Example:
+//
+// Task<int64> CountUsers(Executor& executor, Statement& stmt) {
+//   AsyncStatement async(executor, stmt);
+//   int64 count = 0;
+//   auto rows = async.Rows<string>();
+//   while (auto row = co_await rows.Next()) ++count;
+//   if (!stmt.done()) co_return -1;
+//   co_return count;
+// }
+class AsyncStatement {
+ public:
+  AsyncStatement(Executor& executor, Statement& stmt)
+      : executor_(&executor), stmt_(&stmt) {}
+
+  // Advances the statement, returning its new rc (also recorded in the
+  // Statement). Like sqlite3_blocking_step(), a statement that hits a
+  // shared-cache lock before returning any rows waits and starts over, and
+  // one that hits it partway through stops with SQLITE_LOCKED.
+  Task<int> Step();
+
+  // Advances the statement to read a row if present. If there are no more rows
+  // or there is an error, returns nullopt.
+  template <typename... Cols>
+  Task<std::optional<detail::RowOf<Cols...>>> GetRow() {
+    return DoGetRow<Cols...>(/*reset=*/false);
+  }
+
+  // Resets and runs a statement expecting no returned rows. Returns false if an
+  // error occurs or a row was returned.
+  Task<bool> Run();
+
+  // Rows of the statement read one at a time by awaiting Next(), which yields
+  // nullopt once there are no more rows or an error occurred; the first Next()
+  // resets the statement, on the executor.
+  template <typename... Cols>
+  class AsyncRowset {
+   public:
+    explicit AsyncRowset(AsyncStatement* s) : s_(s) {}
+
+    Task<std::optional<detail::RowOf<Cols...>>> Next() {
+      return s_->DoGetRow<Cols...>(/*reset=*/std::exchange(reset_, false));
+    }
+
+   private:
+    AsyncStatement* s_;
+    bool reset_ = true;
+  };
+
+  // The coroutine alternative to Statement::Rows().
+  template <typename... Cols>
+  AsyncRowset<Cols...> Rows() {
+    return AsyncRowset<Cols...>(this);
+  }
+
+  inline Statement& statement() { return *stmt_; }
+
+ private:
+  // Step() and GetRow(), resetting the statement on the executor first if
+  // reset.
+  Task<int> DoStep(bool reset);
+
+  template <typename... Cols>
+  Task<std::optional<detail::RowOf<Cols...>>> DoGetRow(bool reset) {
+    // Awaited outside the condition, which gcc 12 miscompiles.
+    int rc = co_await DoStep(reset);
+    if (rc != SQLITE_ROW) co_return std::nullopt;
+    co_return detail::ReadRow<Cols...>(stmt_->stmt_);
+  }
+
+  Executor* executor_;
+  Statement* stmt_;
+};
+
+// Runs a script that may contain multiple statements on executor, ignoring any
+// result rows, and returns the sqlite return code. The coroutine counterpart
+// of ExecRC().
+Task<int> AsyncExecRC(Executor& executor, sqlite3* db, string_view script);
+
+}  // namespace sqlite
+
+#endif  // THIRD_PARTY_SQLITE_SQLITE_ASYNC_H_
@@ -0,0 +1,126 @@
+#include "sqlite_async.h"
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#undef NDEBUG  // always keep asserts
+
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace {
+
+sqlite::Task<sqlite::int64> CountRows(sqlite::Executor& executor,
+                                      sqlite::Statement& stmt) {
+  sqlite::AsyncStatement async(executor, stmt);
+  sqlite::int64 count = 0;
+  auto rows = async.Rows<sqlite::int64>();
+  while (auto row = co_await rows.Next()) count += std::get<0>(*row);
+  if (!stmt.done()) co_return -1;
+  co_return count;
+}
+
+sqlite::Task<void> Deliver(sqlite::Task<sqlite::int64> task,
+                           std::promise<sqlite::int64>* result) {
+  result->set_value(co_await std::move(task));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  sqlite::Executor executor(1);
+  {
+    // Basic statements run on the executor.
+    sqlite3* db;
+    assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+    assert(sqlite::SyncWait(sqlite::AsyncExecRC(executor, db, R"sql(
+      CREATE TABLE t (k INTEGER PRIMARY KEY, v TEXT);
+      INSERT INTO t(k, v) VALUES (1, 'one'), (2, 'two'), (3, 'three');
+    )sql")) == SQLITE_OK);
+    assert(sqlite::SyncWait(sqlite::AsyncExecRC(executor, db, "nonsense;")) ==
+           SQLITE_ERROR);
+    {
+      sqlite::Statement insert(db, "INSERT INTO t(k, v) VALUES (?, ?);");
+      sqlite::AsyncStatement async(executor, insert);
+      assert(insert.Bind(4, sqlite::TextView("four")));
+      assert(sqlite::SyncWait(async.Run()));
+      assert(insert.done());
+      sqlite::Statement select(db, "SELECT v FROM t WHERE k = ?;");
+      sqlite::AsyncStatement async_select(executor, select);
+      assert(select.Bind(4));
+      auto row = sqlite::SyncWait(async_select.GetRow<std::string>());
+      assert(row && std::get<0>(*row) == "four");
+      assert(!sqlite::SyncWait(async_select.GetRow<std::string>()));
+      assert(select.done());
+      sqlite::Statement sum(db, "SELECT k FROM t;");
+      assert(sqlite::SyncWait(CountRows(executor, sum)) == 10);
+      // The first Next() resets the statement, on the executor, so the rows
+      // start over.
+      {
+        sqlite::AsyncStatement async_sum(executor, sum);
+        assert(sqlite::SyncWait(async_sum.GetRow<sqlite::int64>()));
+        auto rows = async_sum.Rows<sqlite::int64>();
+        auto first = sqlite::SyncWait(rows.Next());
+        assert(first && std::get<0>(*first) == 1);
+      }
+      assert(sqlite::SyncWait(CountRows(executor, sum)) == 10);
+    }
+    assert(sqlite3_close(db) == SQLITE_OK);
+  }
+
+  {
+    // A coroutine waiting for a shared-cache lock doesn't hold up the
+    // executor's only thread.
+    const char kUri[] = "file:sqlite_async_test?mode=memory&cache=shared";
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                SQLITE_OPEN_URI | SQLITE_OPEN_SHAREDCACHE;
+    sqlite3* holder;
+    sqlite3* waiter;
+    sqlite3* other;
+    assert(sqlite3_open_v2(kUri, &holder, flags, nullptr) == SQLITE_OK);
+    assert(sqlite3_open_v2(kUri, &waiter, flags, nullptr) == SQLITE_OK);
+    assert(sqlite3_open(":memory:", &other) == SQLITE_OK);
+    assert(sqlite::Exec(holder, R"sql(
+      CREATE TABLE t (k INTEGER PRIMARY KEY);
+      INSERT INTO t(k) VALUES (1), (2), (3);
+    )sql"));
+    {
+      sqlite::Statement count(waiter, "SELECT k FROM t;");
+      assert(count.ok());
+      assert(sqlite::Exec(holder, "BEGIN; INSERT INTO t(k) VALUES (4);"));
+      std::promise<sqlite::int64> counted;
+      auto result = counted.get_future();
+      sqlite::Spawn(Deliver(CountRows(executor, count), &counted));
+      // The worker runs the count until it waits for the lock, then this.
+      assert(sqlite::SyncWait(sqlite::AsyncExecRC(
+                 executor, other, "CREATE TABLE u (x); INSERT INTO u VALUES (1);")) ==
+             SQLITE_OK);
+      assert(result.wait_for(std::chrono::milliseconds(50)) ==
+             std::future_status::timeout);
+      assert(sqlite::Exec(holder, "COMMIT;"));
+      assert(result.get() == 10);
+      assert(count.done());
+    }
+    assert(sqlite3_close(holder) == SQLITE_OK);
+    assert(sqlite3_close(waiter) == SQLITE_OK);
+    assert(sqlite3_close(other) == SQLITE_OK);
+  }
+
+  std::cout << "Ok!" << std::endl;
+  return 0;
+}
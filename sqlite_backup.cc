@@ -0,0 +1,162 @@
+#include "sqlite_backup.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "sqlite_blocking.h"
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+namespace sqlite {
+
+Backup::Backup(sqlite3* dest, sqlite3* source, const char* dest_schema,
+               const char* source_schema)
+    : backup_(sqlite3_backup_init(dest, dest_schema, source, source_schema)),
+      source_(source) {
+  // A failed init leaves its error on the destination connection.
+  if (backup_ == nullptr) rc_ = sqlite3_errcode(dest);
+}
+
+Backup::Backup(Backup&& move_from) noexcept
+    : backup_(move_from.backup_),
+      source_(move_from.source_),
+      done_(move_from.done_),
+      rc_(move_from.rc_) {
+  move_from.backup_ = nullptr;
+}
+
+Backup& Backup::operator=(Backup&& move_from) noexcept {
+  if (this != &move_from) {
+    sqlite3_backup_finish(backup_);
+    backup_ = move_from.backup_;
+    source_ = move_from.source_;
+    done_ = move_from.done_;
+    rc_ = move_from.rc_;
+    move_from.backup_ = nullptr;
+  }
+  return *this;
+}
+
+Backup::~Backup() { sqlite3_backup_finish(backup_); }
+
+bool Backup::Step(int pages) {
+  if (done_) return true;
+  if (backup_ == nullptr) {
+    if (rc_ == SQLITE_OK) rc_ = SQLITE_MISUSE;
+    return false;
+  }
+  rc_ = sqlite3_backup_step(backup_, pages);
+  if (rc_ == SQLITE_DONE) {
+    done_ = true;
+    rc_ = SQLITE_OK;
+  }
+  return ok();
+}
+
+bool Backup::Run(const BackupOptions& options,
+                 const std::function<void(const BackupProgress&)>& progress) {
+  while (!done_) {
+    if (Step(options.pages_per_step)) {
+      if (progress) progress(this->progress());
+      if (done_) break;
+    } else if (rc_ == SQLITE_LOCKED) {
+      // Locked by a connection sharing the source's cache, or by a write in
+      // progress on the source connection itself, in which case the wait ends
+      // at once and the pause paces the retries.
+      int rc = sqlite3_blocking_wait_for_unlock_until(
+          source_, detail::DeadlineMicros(options.deadline));
+      if (rc != SQLITE_OK) {
+        rc_ = rc;
+        return false;
+      }
+    } else if (rc_ != SQLITE_BUSY) {
+      return false;
+    }
+    auto now = Clock::now();
+    if (!ok() && now >= options.deadline) {
+      rc_ = SQLITE_BUSY;
+      return false;
+    }
+    // Retries always pause a little, so they never spin.
+    auto pause = ok() ? options.pause
+                      : std::max<Clock::duration>(options.pause,
+                                                  std::chrono::milliseconds(1));
+    if (pause > Clock::duration::zero()) {
+      std::this_thread::sleep_for(std::min(pause, options.deadline - now));
+    }
+  }
+  return true;
+}
+
+bool Backup::Finish() {
+  if (backup_ == nullptr) {
+    if (rc_ == SQLITE_OK && !done_) rc_ = SQLITE_MISUSE;
+    return ok();
+  }
+  int rc = sqlite3_backup_finish(backup_);
+  backup_ = nullptr;
+  if (rc_ == SQLITE_OK) rc_ = rc;
+  return ok();
+}
+
+BackupProgress Backup::progress() const {
+  if (backup_ == nullptr) return BackupProgress{/*remaining=*/0,
+                                                /*pagecount=*/0};
+  return BackupProgress{/*remaining=*/sqlite3_backup_remaining(backup_),
+                        /*pagecount=*/sqlite3_backup_pagecount(backup_)};
+}
+
+SerializedDatabase::SerializedDatabase(size_t size)
+    : data_(static_cast<unsigned char*>(sqlite3_malloc64(size))),
+      size_(data_ == nullptr ? 0 : size) {}
+
+int Serialize(sqlite3* db, SerializedDatabase* out, const char* schema) {
+  sqlite3_int64 size = 0;
+  unsigned char* data = sqlite3_serialize(db, schema, &size, 0);
+  if (data == nullptr) {
+    // An empty database serializes to nothing.
+    if (size == 0 && sqlite3_errcode(db) == SQLITE_OK) {
+      *out = SerializedDatabase();
+      return SQLITE_OK;
+    }
+    return sqlite3_errcode(db) == SQLITE_OK ? SQLITE_NOMEM
+                                            : sqlite3_errcode(db);
+  }
+  out->data_.reset(data);
+  out->size_ = static_cast<size_t>(size);
+  return SQLITE_OK;
+}
+
+string_view SerializedView(sqlite3* db, const char* schema) {
+  sqlite3_int64 size = 0;
+  unsigned char* data =
+      sqlite3_serialize(db, schema, &size, SQLITE_SERIALIZE_NOCOPY);
+  if (data == nullptr) return string_view();
+  return string_view(reinterpret_cast<const char*>(data),
+                     static_cast<size_t>(size));
+}
+
+int Deserialize(sqlite3* db, SerializedDatabase data, bool read_only,
+                const char* schema) {
+  // In-memory databases can't use WAL, and fail to open if their header
+  // says they do, so serialized WAL databases revert to rollback journaling.
+  if (data.size() >= 20 && data.data()[18] == 2 && data.data()[19] == 2) {
+    data.data()[18] = 1;
+    data.data()[19] = 1;
+  }
+  auto size = static_cast<sqlite3_int64>(data.size());
+  unsigned int flags = SQLITE_DESERIALIZE_FREEONCLOSE |
+                       (read_only ? SQLITE_DESERIALIZE_READONLY
+                                  : SQLITE_DESERIALIZE_RESIZEABLE);
+  // sqlite frees the memory even if this fails.
+  return sqlite3_deserialize(db, schema, data.release(), size, size, flags);
+}
+
+}  // namespace sqlite
@@ -0,0 +1,171 @@
+#ifndef THIRD_PARTY_SQLITE_SQLITE_BACKUP_H_
+#define THIRD_PARTY_SQLITE_SQLITE_BACKUP_H_
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace sqlite {
+
+// How far a Backup has got, passed to its progress callback after each step.
+struct BackupProgress {
+  // Pages still to be copied, and the size of the source database in pages,
+  // as of the last step.
+  int remaining;
+  int pagecount;
+};
+
+// How Backup::Run() paces the copy.
+struct BackupOptions {
+  // Pages copied by each step. The source is only locked during a step, so
+  // smaller steps let writers in more often. -1 copies everything at once.
+  int pages_per_step = 256;
+  // Time to sleep between steps, and before retrying a step that found the
+  // source busy or locked.
+  Clock::duration pause = std::chrono::milliseconds(1);
+  // Give up retrying busy or locked steps at this time.
+  Clock::time_point deadline = Clock::time_point::max();
+};
+
+// RAII online backup of a database to another connection with the
+// sqlite3_backup_* functions. The copy is made a few pages at a time, holding
+// a read lock on the source only during each step, so that writers are not
+// stalled for the whole backup. Writes through the source connection between
+// steps are copied as well; writes through any other connection restart the
+// copy from the beginning, so a steady stream of them can keep a backup from
+// finishing. Read from a WAL database through a connection of its own, rather
+// than the writer's, to never block writes.
+//
+// The destination connection must not be used until the backup is finished,
+// which the destructor does if Finish() has not been called.
+//
+// Example:
+//
+// sqlite3* file;
+// sqlite3_open("backup.db", &file);
+// Backup backup(file, db);
+// BackupOptions options;
+// options.pause = std::chrono::milliseconds(10);
+// if (!backup.Run(options, [](const BackupProgress& progress) {
+//       cout << progress.remaining << " pages to go" << endl;
+//     }) || !backup.Finish()) {
+//   cerr << "oh no! " << backup.errstr() << endl;
+// }
+class Backup {
+ public:
+  Backup(sqlite3* dest, sqlite3* source, const char* dest_schema = "main",
+         const char* source_schema = "main");
+  Backup(const Backup&) = delete;
+  Backup& operator=(const Backup&) = delete;
+  Backup(Backup&& move_from) noexcept;
+  Backup& operator=(Backup&& move_from) noexcept;
+  ~Backup();
+
+  // Copies up to pages pages, or all that remain if pages is negative.
+  // Returns false if an error occurs. SQLITE_BUSY and SQLITE_LOCKED mean the
+  // source could not be locked and the step may be retried; other errors end
+  // the backup.
+  bool Step(int pages = BackupOptions().pages_per_step);
+
+  // Steps until the copy is done, pausing between steps. Steps that find the
+  // source locked by another connection sharing its cache wait for it to be
+  // unlocked (with sqlite_blocking), and steps that find it busy are retried
+  // after a pause, until the deadline, when rc() is SQLITE_BUSY. Calls
+  // progress, if given, after each step that copies pages. Returns whether the
+  // copy is done.
+  bool Run(const BackupOptions& options = BackupOptions(),
+           const std::function<void(const BackupProgress&)>& progress =
+               nullptr);
+
+  // Releases the backup, abandoning the copy if it is not done, and returns
+  // whether it (and every step) succeeded. The destination connection can
+  // then be used again.
+  bool Finish();
+
+  // Whether every page has been copied.
+  inline bool done() const { return done_; }
+  BackupProgress progress() const;
+
+  inline bool ok() const { return rc_ == SQLITE_OK; }
+  inline int rc() const { return rc_; }
+  inline string_view errstr() const { return sqlite3_errstr(rc_); }
+
+ private:
+  sqlite3_backup* backup_ = nullptr;
+  sqlite3* source_ = nullptr;
+  bool done_ = false;
+  int rc_ = SQLITE_OK;
+};
+
+// A serialized database: the bytes of its file, in memory allocated by
+// sqlite, for shipping a database to another process or node. Any database
+// can be serialized into one, and Deserialize() hands its memory to a
+// connection without copying it.
+class SerializedDatabase {
+ public:
+  SerializedDatabase() = default;
+  // Allocates size bytes for the caller to fill, for example from the network.
+  // On failure to allocate, data() is null.
+  explicit SerializedDatabase(size_t size);
+
+  inline unsigned char* data() { return data_.get(); }
+  inline const unsigned char* data() const { return data_.get(); }
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+  inline string_view bytes() const {
+    return string_view(reinterpret_cast<const char*>(data_.get()), size_);
+  }
+
+  // Gives up ownership of the memory, which must be freed with sqlite3_free().
+  inline unsigned char* release() {
+    size_ = 0;
+    return data_.release();
+  }
+
+ private:
+  friend int Serialize(sqlite3* db, SerializedDatabase* out,
+                       const char* schema);
+
+  struct Free {
+    inline void operator()(unsigned char* p) const { sqlite3_free(p); }
+  };
+
+  std::unique_ptr<unsigned char, Free> data_;
+  size_t size_ = 0;
+};
+
+// Copies the database of db named by schema into out. Returns the sqlite
+// return code (rc).
+int Serialize(sqlite3* db, SerializedDatabase* out,
+              const char* schema = "main");
+
+// The bytes of a database that is already held contiguously in memory, such
+// as one that was deserialized, without copying them. They are only valid
+// until the database is next changed or closed. Returns an empty view if the
+// database is not held that way, in which case use Serialize().
+string_view SerializedView(sqlite3* db, const char* schema = "main");
+
+// Replaces the database of db named by schema with data, which db takes
+// ownership of without copying it. Unless read_only, the database can then be
+// written and grow like any in-memory database. A database serialized in WAL
+// mode is switched to a rollback journal, since in-memory databases can't use
+// WAL. Returns the sqlite return code (rc); data is freed on failure too.
+int Deserialize(sqlite3* db, SerializedDatabase data, bool read_only = false,
+                const char* schema = "main");
+
+}  // namespace sqlite
+
+#endif  // THIRD_PARTY_SQLITE_SQLITE_BACKUP_H_
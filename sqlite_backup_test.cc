@@ -0,0 +1,218 @@
+#include "sqlite_backup.h"
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#undef NDEBUG  // always keep asserts
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace {
+
+const char kSourcePath[] = "sqlite_backup_test.db";
+const char kDestPath[] = "sqlite_backup_test_copy.db";
+
+void RemoveDatabases() {
+  for (const char* path : {kSourcePath, kDestPath}) {
+    std::remove(path);
+    std::remove((std::string(path) + "-wal").c_str());
+    std::remove((std::string(path) + "-shm").c_str());
+  }
+}
+
+sqlite::int64 Count(sqlite3* db, const char* sql) {
+  sqlite::Statement count(db, sql);
+  return std::get<0>(*count.GetRow<sqlite::int64>());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  RemoveDatabases();
+  sqlite3* source;
+  assert(sqlite3_open(kSourcePath, &source) == SQLITE_OK);
+  assert(sqlite::Exec(source, R"sql(
+    PRAGMA journal_mode=WAL;
+    PRAGMA page_size=4096;
+    CREATE TABLE t (k INTEGER PRIMARY KEY, v TEXT NOT NULL);
+  )sql"));
+  {
+    sqlite::Statement insert(source, "INSERT INTO t(k, v) VALUES (?, ?);");
+    auto batch = insert.BatchSink(500);
+    for (int i = 0; i < 5000; ++i) {
+      batch.Write(std::make_tuple(i, std::string(200, 'a' + i % 26)));
+    }
+    assert(batch.Finish());
+  }
+  {
+    // The copy is made a few pages at a time, reporting progress.
+    sqlite3* dest;
+    assert(sqlite3_open(kDestPath, &dest) == SQLITE_OK);
+    sqlite::Backup backup(dest, source);
+    assert(backup.ok());
+    std::vector<sqlite::BackupProgress> progress;
+    sqlite::BackupOptions options;
+    options.pages_per_step = 16;
+    options.pause = std::chrono::microseconds(100);
+    assert(backup.Run(options, [&](const sqlite::BackupProgress& p) {
+      progress.push_back(p);
+    }));
+    assert(backup.done());
+    assert(progress.size() > 10);
+    assert(progress.back().remaining == 0);
+    for (size_t i = 1; i < progress.size(); ++i) {
+      assert(progress[i].remaining < progress[i - 1].remaining);
+    }
+    assert(backup.Finish());
+    assert(Count(dest, "SELECT count(*) FROM t;") == 5000);
+    assert(sqlite3_close(dest) == SQLITE_OK);
+  }
+  {
+    // Writers carry on between steps.
+    sqlite3* reader;
+    sqlite3* dest;
+    assert(sqlite3_open(kSourcePath, &reader) == SQLITE_OK);
+    assert(sqlite3_open(":memory:", &dest) == SQLITE_OK);
+    sqlite::Backup backup(dest, reader);
+    std::atomic<bool> copying{true};
+    std::atomic<int> writes{0};
+    std::thread writer([&] {
+      sqlite::Statement insert(source, "INSERT INTO t(k, v) VALUES (?, 'w');");
+      while (copying) {
+        insert.Bind(10000 + writes);
+        assert(insert.Run());
+        ++writes;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+    sqlite::BackupOptions options;
+    options.pages_per_step = 64;
+    options.pause = std::chrono::milliseconds(1);
+    // Writes from another connection restart the copy, so it may not finish
+    // while they go on.
+    bool done = backup.Run(options, [&](const sqlite::BackupProgress& p) {
+      if (writes >= 20) copying = false;
+    });
+    copying = false;
+    writer.join();
+    assert(done || backup.Run(options));
+    assert(writes >= 20);
+    assert(backup.Finish());
+    assert(Count(dest, "SELECT count(*) FROM t WHERE k < 10000;") == 5000);
+    assert(sqlite3_close(dest) == SQLITE_OK);
+    assert(sqlite3_close(reader) == SQLITE_OK);
+  }
+  {
+    // Locked sources are retried until the deadline.
+    const char* uri = "file:sqlite_backup_test_shared?mode=memory&cache=shared";
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI;
+    sqlite3* writer;
+    sqlite3* reader;
+    sqlite3* dest;
+    assert(sqlite3_open_v2(uri, &writer, flags, nullptr) == SQLITE_OK);
+    assert(sqlite3_open_v2(uri, &reader, flags, nullptr) == SQLITE_OK);
+    assert(sqlite3_open(":memory:", &dest) == SQLITE_OK);
+    assert(sqlite::Exec(writer, R"sql(
+      CREATE TABLE t (k INTEGER PRIMARY KEY);
+      INSERT INTO t VALUES (1);
+      BEGIN EXCLUSIVE;
+      INSERT INTO t VALUES (2);
+    )sql"));
+    {
+      sqlite::Backup backup(dest, reader);
+      sqlite::BackupOptions options;
+      options.deadline = sqlite::Clock::now() + std::chrono::milliseconds(20);
+      auto start = sqlite::Clock::now();
+      assert(!backup.Run(options));
+      assert(backup.rc() == SQLITE_BUSY);
+      assert(sqlite::Clock::now() - start >= std::chrono::milliseconds(20));
+      // The wait ends when the lock is released.
+      std::thread commit([writer] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        assert(sqlite::Exec(writer, "COMMIT;"));
+      });
+      options.deadline = sqlite::Clock::now() + std::chrono::seconds(10);
+      assert(backup.Run(options));
+      commit.join();
+      assert(backup.Finish());
+    }
+    assert(Count(dest, "SELECT count(*) FROM t;") == 2);
+    assert(sqlite3_close(dest) == SQLITE_OK);
+    assert(sqlite3_close(reader) == SQLITE_OK);
+    assert(sqlite3_close(writer) == SQLITE_OK);
+  }
+  {
+    // A failed init is reported.
+    sqlite3* dest;
+    assert(sqlite3_open(":memory:", &dest) == SQLITE_OK);
+    sqlite::Backup backup(dest, source, "main", "nowhere");
+    assert(!backup.ok());
+    assert(!backup.Run());
+    assert(!backup.Finish());
+    assert(sqlite3_close(dest) == SQLITE_OK);
+  }
+  {
+    // Databases ship between connections as their serialized bytes.
+    sqlite::SerializedDatabase bytes;
+    assert(sqlite::Serialize(source, &bytes) == SQLITE_OK);
+    assert(bytes.size() % 4096 == 0 && bytes.size() > 5000 * 200);
+    assert(std::memcmp(bytes.data(), "SQLite format 3", 16) == 0);
+    // A file database is not held in memory.
+    assert(sqlite::SerializedView(source).empty());
+
+    // As if received from the network.
+    sqlite::SerializedDatabase received(bytes.size());
+    std::memcpy(received.data(), bytes.data(), bytes.size());
+    const unsigned char* memory = received.data();
+    sqlite3* copy;
+    assert(sqlite3_open(":memory:", &copy) == SQLITE_OK);
+    assert(sqlite::Deserialize(copy, std::move(received)) == SQLITE_OK);
+    assert(received.data() == nullptr);
+    assert(Count(copy, "SELECT count(*) FROM t WHERE k < 10000;") == 5000);
+    // The connection uses the memory it was given.
+    sqlite::string_view view = sqlite::SerializedView(copy);
+    assert(reinterpret_cast<const unsigned char*>(view.data()) == memory);
+    assert(view.size() == bytes.size());
+    // It can be written and grow.
+    assert(sqlite::Exec(copy, "INSERT INTO t SELECT k + 100000, v FROM t;"));
+    sqlite::SerializedDatabase grown;
+    assert(sqlite::Serialize(copy, &grown) == SQLITE_OK);
+    assert(grown.size() > bytes.size());
+    assert(sqlite3_close(copy) == SQLITE_OK);
+
+    // Read-only databases can't be written.
+    assert(sqlite3_open(":memory:", &copy) == SQLITE_OK);
+    assert(sqlite::Deserialize(copy, std::move(grown), true) == SQLITE_OK);
+    assert(sqlite::ExecRC(copy, "DELETE FROM t;") == SQLITE_READONLY);
+    assert(sqlite3_close(copy) == SQLITE_OK);
+
+    // Unknown schemas fail, freeing the memory.
+    assert(sqlite3_open(":memory:", &copy) == SQLITE_OK);
+    assert(sqlite::Deserialize(copy, std::move(bytes), false, "nowhere") ==
+           SQLITE_ERROR);
+    assert(sqlite3_close(copy) == SQLITE_OK);
+  }
+  assert(sqlite3_close(source) == SQLITE_OK);
+  RemoveDatabases();
+
+  std::cout << "Ok!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include "sqlite_blob.h"
+
+#include <algorithm>
+#include <climits>
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+namespace sqlite {
+
+Blob::Blob(sqlite3* db, const char* table, const char* column, int64 rowid,
+           bool writable, const char* schema) {
+  rc_ = sqlite3_blob_open(db, schema, table, column, rowid, writable ? 1 : 0,
+                          &blob_);
+  if (rc_ != SQLITE_OK) {
+    // A handle is not necessarily null after a failed open.
+    sqlite3_blob_close(blob_);
+    blob_ = nullptr;
+  }
+}
+
+Blob::Blob(Blob&& move_from) noexcept
+    : blob_(move_from.blob_), rc_(move_from.rc_) {
+  move_from.blob_ = nullptr;
+}
+
+Blob& Blob::operator=(Blob&& move_from) noexcept {
+  if (this != &move_from) {
+    sqlite3_blob_close(blob_);
+    blob_ = move_from.blob_;
+    rc_ = move_from.rc_;
+    move_from.blob_ = nullptr;
+  }
+  return *this;
+}
+
+Blob::~Blob() { sqlite3_blob_close(blob_); }
+
+bool Blob::Reopen(int64 rowid) {
+  if (blob_ == nullptr) {
+    rc_ = SQLITE_MISUSE;
+    return false;
+  }
+  return (rc_ = sqlite3_blob_reopen(blob_, rowid)) == SQLITE_OK;
+}
+
+bool Blob::Read(char* data, size_t size, int64 offset) {
+  if (blob_ == nullptr) {
+    rc_ = SQLITE_MISUSE;
+  } else if (size > INT_MAX || offset > INT_MAX) {
+    // sqlite3_blob_read() takes ints.
+    rc_ = SQLITE_TOOBIG;
+  } else {
+    rc_ = sqlite3_blob_read(blob_, data, static_cast<int>(size),
+                            static_cast<int>(offset));
+  }
+  return ok();
+}
+
+bool Blob::Write(string_view data, int64 offset) {
+  if (blob_ == nullptr) {
+    rc_ = SQLITE_MISUSE;
+  } else if (data.size() > INT_MAX || offset > INT_MAX) {
+    rc_ = SQLITE_TOOBIG;
+  } else {
+    rc_ = sqlite3_blob_write(blob_, data.data(), static_cast<int>(data.size()),
+                             static_cast<int>(offset));
+  }
+  return ok();
+}
+
+BlobStreamBuf::BlobStreamBuf(Blob* blob, size_t buffer_size)
+    : blob_(blob),
+      buffer_(new char[buffer_size]),
+      buffer_size_(buffer_size) {}
+
+BlobStreamBuf::~BlobStreamBuf() { FlushPut(); }
+
+void BlobStreamBuf::Restart() {
+  setg(nullptr, nullptr, nullptr);
+  setp(nullptr, nullptr);
+  offset_ = 0;
+}
+
+BlobStreamBuf::int_type BlobStreamBuf::underflow() {
+  if (!FlushPut()) return traits_type::eof();
+  LeaveGet();
+  int64 remaining = blob_->size() - offset_;
+  if (remaining <= 0) return traits_type::eof();
+  size_t size = static_cast<size_t>(
+      std::min<int64>(remaining, static_cast<int64>(buffer_size_)));
+  if (!blob_->Read(buffer_.get(), size, offset_)) return traits_type::eof();
+  setg(buffer_.get(), buffer_.get(), buffer_.get() + size);
+  return traits_type::to_int_type(*gptr());
+}
+
+BlobStreamBuf::int_type BlobStreamBuf::overflow(int_type c) {
+  LeaveGet();
+  if (!FlushPut()) return traits_type::eof();
+  int64 remaining = blob_->size() - offset_;
+  if (remaining <= 0) return traits_type::eof();
+  size_t size = static_cast<size_t>(
+      std::min<int64>(remaining, static_cast<int64>(buffer_size_)));
+  setp(buffer_.get(), buffer_.get() + size);
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int BlobStreamBuf::sync() { return FlushPut() ? 0 : -1; }
+
+BlobStreamBuf::pos_type BlobStreamBuf::seekoff(off_type off,
+                                               std::ios_base::seekdir dir,
+                                               std::ios_base::openmode which) {
+  // Reads and writes share one position, so seeking either moves both, but a
+  // seek must name at least one of them.
+  if ((which & (std::ios_base::in | std::ios_base::out)) == 0) {
+    return pos_type(off_type(-1));
+  }
+  int64 target = off;
+  if (dir == std::ios_base::cur) {
+    target += position();
+  } else if (dir == std::ios_base::end) {
+    target += blob_->size();
+  }
+  if (target < 0 || target > blob_->size()) return pos_type(off_type(-1));
+  LeaveGet();
+  if (!FlushPut()) return pos_type(off_type(-1));
+  offset_ = target;
+  return pos_type(target);
+}
+
+BlobStreamBuf::pos_type BlobStreamBuf::seekpos(pos_type pos,
+                                               std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+void BlobStreamBuf::LeaveGet() {
+  if (eback() == nullptr) return;
+  offset_ += gptr() - eback();
+  setg(nullptr, nullptr, nullptr);
+}
+
+bool BlobStreamBuf::FlushPut() {
+  if (pbase() == nullptr) return true;
+  string_view pending(pbase(), pptr() - pbase());
+  setp(nullptr, nullptr);
+  if (!blob_->Write(pending, offset_)) return false;
+  offset_ += pending.size();
+  return true;
+}
+
+int64 BlobStreamBuf::position() const {
+  if (eback() != nullptr) return offset_ + (gptr() - eback());
+  if (pbase() != nullptr) return offset_ + (pptr() - pbase());
+  return offset_;
+}
+
+BlobStream::BlobStream(sqlite3* db, const char* table, const char* column,
+                       int64 rowid, bool writable, const char* schema,
+                       size_t buffer_size)
+    : std::iostream(nullptr),
+      blob_(db, table, column, rowid, writable, schema),
+      buf_(&blob_, buffer_size) {
+  rdbuf(&buf_);
+  if (!blob_.ok()) setstate(std::ios_base::badbit);
+}
+
+BlobStream::~BlobStream() { buf_.pubsync(); }
+
+bool BlobStream::Reopen(int64 rowid) {
+  bool flushed = buf_.pubsync() == 0;
+  buf_.Restart();
+  clear();
+  if (!blob_.Reopen(rowid) || !flushed) {
+    setstate(std::ios_base::badbit);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace sqlite
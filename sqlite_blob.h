@@ -0,0 +1,148 @@
+#ifndef THIRD_PARTY_SQLITE_SQLITE_BLOB_H_
+#define THIRD_PARTY_SQLITE_SQLITE_BLOB_H_
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <streambuf>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace sqlite {
+
+// RAII handle for incremental I/O on one blob value, so that large values can
+// be read and written in chunks instead of all at once. A blob's size is fixed
+// once it is written to the row; reserve space for a new one by binding a
+// ZeroBlob. Reopen() moves the handle to another row of the same column
+// without closing it.
+//
+// The handle is invalidated (and every call fails with SQLITE_ABORT) if its
+// row is changed by anything other than this handle.
+//
+// Example:
+//
+// Statement insert(db, "INSERT INTO files(name, data) VALUES (?, ?);");
+// insert.Bind(name, ZeroBlob{size});
+// insert.Run();
+// Blob blob(db, "files", "data", sqlite3_last_insert_rowid(db), true);
+// for (int64 offset = 0; offset < size; offset += chunk.size()) {
+//   ReadChunk(&chunk);
+//   if (!blob.Write(chunk, offset)) cerr << "oh no! " << blob.errstr() << endl;
+// }
+class Blob {
+ public:
+  Blob(sqlite3* db, const char* table, const char* column, int64 rowid,
+       bool writable, const char* schema = "main");
+  Blob(const Blob&) = delete;
+  Blob& operator=(const Blob&) = delete;
+  Blob(Blob&& move_from) noexcept;
+  Blob& operator=(Blob&& move_from) noexcept;
+  ~Blob();
+
+  // Moves the handle to the same column of another row. Returns false if an
+  // error occurs, after which the handle cannot be used until a successful
+  // Reopen().
+  bool Reopen(int64 rowid);
+
+  // Reads size bytes at offset into data. Returns false if an error
+  // occurs, including reading past the end of the blob.
+  bool Read(char* data, size_t size, int64 offset);
+  // Writes data at offset. Returns false if an error occurs, including writing
+  // past the end of the blob, which cannot grow.
+  bool Write(string_view data, int64 offset);
+
+  // The size of the blob in bytes.
+  inline int64 size() const {
+    return blob_ == nullptr ? 0 : sqlite3_blob_bytes(blob_);
+  }
+
+  inline bool ok() const { return rc_ == SQLITE_OK; }
+  inline int rc() const { return rc_; }
+  inline string_view errstr() const { return sqlite3_errstr(rc_); }
+
+ private:
+  sqlite3_blob* blob_ = nullptr;
+  int rc_ = SQLITE_OK;
+};
+
+// Buffered std::streambuf reading and writing a Blob, with seeking. Output
+// cannot go past the end of the blob.
+class BlobStreamBuf : public std::streambuf {
+ public:
+  static constexpr size_t kDefaultBufferSize = 64 << 10;
+
+  explicit BlobStreamBuf(Blob* blob, size_t buffer_size = kDefaultBufferSize);
+  ~BlobStreamBuf() override;
+
+  // Drops the buffered data and starts again at offset zero, for use after the
+  // blob has been reopened. The buffer is kept. Output must already have been
+  // flushed.
+  void Restart();
+
+ protected:
+  int_type underflow() override;
+  int_type overflow(int_type c) override;
+  int sync() override;
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override;
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+ private:
+  // Forgets the get area, moving offset_ to the position of the next read.
+  void LeaveGet();
+  // Writes the put area to the blob, moving offset_ past it. Returns false if
+  // the write fails.
+  bool FlushPut();
+  int64 position() const;
+
+  Blob* blob_;
+  std::unique_ptr<char[]> buffer_;
+  size_t buffer_size_;
+  // Offset in the blob of the start of the buffer.
+  int64 offset_ = 0;
+};
+
+// An iostream over a blob, so that artifacts can be streamed to and from the
+// database without holding them in memory.
+//
+// Example:
+//
+// BlobStream stream(db, "files", "data", rowid, false);
+// out << stream.rdbuf();
+// while (NextFile(&rowid)) {
+//   stream.Reopen(rowid);
+//   out << stream.rdbuf();
+// }
+class BlobStream : public std::iostream {
+ public:
+  BlobStream(sqlite3* db, const char* table, const char* column, int64 rowid,
+             bool writable, const char* schema = "main",
+             size_t buffer_size = BlobStreamBuf::kDefaultBufferSize);
+  // Flushes output.
+  ~BlobStream() override;
+
+  // Flushes output and moves to the start of the blob in another row, reusing
+  // the handle and buffer. Clears the stream state. Returns false if an error
+  // occurs, in which case the stream's badbit is set.
+  bool Reopen(int64 rowid);
+
+  inline Blob& blob() { return blob_; }
+
+ private:
+  Blob blob_;
+  BlobStreamBuf buf_;
+};
+
+}  // namespace sqlite
+
+#endif  // THIRD_PARTY_SQLITE_SQLITE_BLOB_H_
@@ -0,0 +1,123 @@
+#include "sqlite_blob.h"
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#undef NDEBUG  // always keep asserts
+
+#include <cassert>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <tuple>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+int main(int argc, char* argv[]) {
+  sqlite3* db;
+  assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+  assert(sqlite::Exec(db, "CREATE TABLE f (id INTEGER PRIMARY KEY, data BLOB);"));
+  {
+    sqlite::Statement insert(db, "INSERT INTO f(id, data) VALUES (?, ?);");
+    assert(insert.Bind(1, sqlite::ZeroBlob{10}));
+    assert(insert.Run());
+    assert(insert.Bind(2, std::string_view("second row")));
+    assert(insert.Run());
+  }
+
+  {
+    // Chunks are written into reserved space and read back.
+    sqlite::Blob blob(db, "f", "data", 1, true);
+    assert(blob.ok());
+    assert(blob.size() == 10);
+    assert(blob.Write("01234", 0));
+    assert(blob.Write("56789", 5));
+    assert(!blob.Write("x", 10));
+    assert(blob.rc() == SQLITE_ERROR);
+    char chunk[4];
+    assert(blob.Read(chunk, 4, 3));
+    assert(std::string(chunk, 4) == "3456");
+    assert(!blob.Read(chunk, 4, 8));
+    // Reopening moves to another row.
+    assert(blob.Reopen(2));
+    assert(blob.size() == 10);
+    assert(blob.Read(chunk, 4, 0));
+    assert(std::string(chunk, 4) == "seco");
+    assert(!blob.Reopen(3));
+    assert(!blob.Read(chunk, 1, 0));
+    // Missing rows and read-only writes fail.
+    sqlite::Blob missing(db, "f", "data", 99, false);
+    assert(!missing.ok());
+    sqlite::Blob read_only(db, "f", "data", 1, false);
+    assert(read_only.ok());
+    assert(!read_only.Write("x", 0));
+    assert(read_only.rc() == SQLITE_READONLY);
+  }
+
+  {
+    // Streams read and write through a buffer smaller than the blob.
+    std::string artifact;
+    for (int i = 0; i < 1000; ++i) artifact += std::to_string(i) + ",";
+    sqlite::Statement insert(db, "INSERT INTO f(id, data) VALUES (?, ?);");
+    assert(insert.Bind(3, sqlite::ZeroBlob{static_cast<sqlite::int64>(
+                              artifact.size())}));
+    assert(insert.Run());
+    {
+      sqlite::BlobStream out(db, "f", "data", 3, true, "main", 64);
+      assert(out.good());
+      out << artifact;
+      assert(out.good());
+      // The blob cannot grow.
+      out << "!";
+      out.flush();
+      assert(!out.good());
+    }
+    sqlite::BlobStream in(db, "f", "data", 3, false, "main", 64);
+    std::string read((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+    assert(read == artifact);
+    // Seeking.
+    in.clear();
+    in.seekg(8);
+    std::string token;
+    std::getline(in, token, ',');
+    assert(token == "4");
+    in.seekg(-4, std::ios_base::end);
+    std::getline(in, token, ',');
+    assert(token == "999");
+    // Reads and writes share one position, and a seek must name either.
+    auto* buf = in.rdbuf();
+    assert(buf->pubseekpos(8, std::ios_base::in | std::ios_base::out) == 8);
+    assert(buf->pubseekoff(0, std::ios_base::cur, std::ios_base::out) == 8);
+    assert(buf->pubseekpos(8, std::ios_base::openmode()) == -1);
+    // Reading another row reuses the stream.
+    assert(in.Reopen(2));
+    std::ostringstream second;
+    second << in.rdbuf();
+    assert(second.str() == "second row");
+    // Writes in the middle keep the rest of the blob.
+    sqlite::BlobStream edit(db, "f", "data", 2, true);
+    edit.seekp(0);
+    edit << "SECOND";
+    assert(edit.Reopen(1));
+    edit << "ab";
+  }
+  {
+    sqlite::Statement select(db, "SELECT data FROM f WHERE id < 3 ORDER BY id;");
+    std::string values;
+    for (const auto& [data] : select.Rows<std::string>()) values += data + ";";
+    assert(values == "ab23456789;SECOND row;");
+  }
+
+  assert(sqlite3_close(db) == SQLITE_OK);
+  std::cout << "Ok!" << std::endl;
+  return 0;
+}
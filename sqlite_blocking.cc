@@ -1,8 +1,25 @@
 #include "sqlite_blocking.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <ctime>
+#endif
 
 /*
 ** The author disclaims copyright to this source code.  In place of
@@ -17,25 +34,251 @@
 
 namespace {
 
+using Clock = std::chrono::steady_clock;
+
+/* Deadline used by the functions that wait indefinitely. */
+constexpr sqlite3_int64 kNoDeadline = INT64_MAX;
+
+/*
+** Deadline of the innermost _until call running on this thread, which the
+** busy handler respects too.
+*/
+thread_local sqlite3_int64 tls_deadline = kNoDeadline;
+
 /*
-** A pointer to an instance of this structure is passed as the user-context
-** pointer when registering for an unlock-notify callback.
+** Sets tls_deadline for the lifetime of the object.
 */
-struct UnlockNotification {
-  std::mutex mutex;             /* Mutex to protect structure */
-  std::condition_variable cond; /* Condition variable to wait on */
-  bool fired = false;           /* True after unlock event has occurred */
+class DeadlineScope {
+ public:
+  explicit DeadlineScope(sqlite3_int64 deadline) : saved_(tls_deadline) {
+    tls_deadline = std::min(deadline, saved_);
+  }
+  ~DeadlineScope() { tls_deadline = saved_; }
+
+ private:
+  sqlite3_int64 saved_;
 };
 
+/* Time this thread has spent waiting, for sqlite3_blocking_thread_wait_us(). */
+thread_local sqlite3_int64 tls_wait_us = 0;
+
+/* Counters reported by sqlite3_blocking_get_busy_stats(). */
+std::atomic<sqlite3_int64> busy_count{0};
+std::atomic<sqlite3_int64> busy_retry_count{0};
+std::atomic<sqlite3_int64> busy_timeout_count{0};
+std::atomic<sqlite3_int64> busy_wait_us{0};
+
 /*
-** This function is an unlock-notify callback registered with SQLite.
+** This function is a busy handler registered with SQLite. nPrior is the
+** number of times it has already been called for the same lock, so when it is
+** zero a new wait begins. Returns nonzero to have SQLite retry.
+*/
+int busy_backoff_cb(void *pArg, int nPrior) {
+  thread_local sqlite3_int64 busy_since = 0;
+  thread_local std::minstd_rand jitter(static_cast<unsigned>(
+      std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+      static_cast<size_t>(Clock::now().time_since_epoch().count())));
+
+  auto *p = static_cast<const sqlite3_blocking_backoff *>(pArg);
+  sqlite3_int64 now = sqlite3_blocking_now();
+  if (nPrior == 0) {
+    busy_since = now;
+    busy_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  sqlite3_int64 remaining = p->maxWaitUs - (now - busy_since);
+  if (tls_deadline != kNoDeadline) {
+    remaining = std::min(remaining, tls_deadline - now);
+  }
+  if (remaining <= 0) {
+    busy_timeout_count.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+
+  /* Double the nominal sleep each time, then sleep for a random duration
+  ** between half of it and all of it so that contending connections spread
+  ** out their retries.
+  */
+  int shift = std::min(nPrior, 30);
+  sqlite3_int64 nominal = p->initialUs > (p->maxSleepUs >> shift)
+                              ? p->maxSleepUs
+                              : p->initialUs << shift;
+  nominal = std::max<sqlite3_int64>(nominal, 1);
+  sqlite3_int64 sleep =
+      nominal / 2 + static_cast<sqlite3_int64>(jitter() % (nominal / 2 + 1));
+  sleep = std::min(sleep, remaining);
+  std::this_thread::sleep_for(std::chrono::microseconds(sleep));
+
+  busy_retry_count.fetch_add(1, std::memory_order_relaxed);
+  busy_wait_us.fetch_add(sleep, std::memory_order_relaxed);
+  tls_wait_us += sleep;
+  return 1;
+}
+
+/* Counters reported by sqlite3_blocking_get_unlock_stats(). */
+std::atomic<sqlite3_int64> unlock_wait_count{0};
+std::atomic<sqlite3_int64> unlock_deadlock_count{0};
+std::atomic<sqlite3_int64> unlock_timeout_count{0};
+std::atomic<sqlite3_int64> unlock_wait_us{0};
+
+/* Counters reported by sqlite3_blocking_get_thread_unlock_stats(). */
+thread_local sqlite3_blocking_unlock_stats tls_unlock_stats = {0, 0, 0, 0};
+
+/* Buckets reported by sqlite3_blocking_get_unlock_histogram(). */
+std::atomic<sqlite3_int64> unlock_histogram[SQLITE_BLOCKING_HISTOGRAM_BUCKETS];
+
+/*
+** The hook set by sqlite3_blocking_set_wait_hook(). Calls to it hold a shared
+** lock, so that replacing it waits for them to finish.
+*/
+std::shared_mutex wait_hook_mutex;
+sqlite3_blocking_wait_hook wait_hook = nullptr;
+void *wait_hook_arg = nullptr;
+
+/* Whether wait_hook is set, to skip the lock when it isn't. */
+std::atomic<bool> wait_hook_set{false};
+
+/*
+** Records the outcome of a wait in the counters and reports it to the hook.
+*/
+void record_unlock_wait(sqlite3 *db, const char *zSql, int nSql, int rc,
+                        sqlite3_int64 waited) {
+  if (rc == SQLITE_LOCKED) {
+    unlock_deadlock_count.fetch_add(1, std::memory_order_relaxed);
+    tls_unlock_stats.nDeadlock++;
+  } else {
+    unlock_wait_count.fetch_add(1, std::memory_order_relaxed);
+    unlock_wait_us.fetch_add(waited, std::memory_order_relaxed);
+    tls_unlock_stats.nWait++;
+    tls_unlock_stats.waitUs += waited;
+    tls_wait_us += waited;
+    if (rc == SQLITE_BUSY) {
+      unlock_timeout_count.fetch_add(1, std::memory_order_relaxed);
+      tls_unlock_stats.nTimeout++;
+    }
+    int bucket = 0;
+    for (sqlite3_int64 v = waited; v > 0; v >>= 1) bucket++;
+    bucket = std::min(bucket, SQLITE_BLOCKING_HISTOGRAM_BUCKETS - 1);
+    unlock_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+  if (!wait_hook_set.load(std::memory_order_acquire)) return;
+  auto lock = std::shared_lock(wait_hook_mutex);
+  if (wait_hook == nullptr) return;
+  sqlite3_blocking_wait_info info = {/*db=*/db, /*zSql=*/zSql, /*nSql=*/nSql,
+                                     /*rc=*/rc, /*waitUs=*/waited};
+  wait_hook(wait_hook_arg, &info);
+}
+
+/*
+** A pointer to the waiting thread's instance of this structure is passed as
+** the user-context pointer when registering for an unlock-notify callback.
+** Each thread has one, reused for all of its waits, so waiting allocates
+** nothing. On Linux the thread sleeps on a futex on its state; elsewhere it
+** uses a condition variable.
+*/
+class UnlockWaiter {
+ public:
+  /* Returns the calling thread's waiter, ready for a new wait. */
+  static UnlockWaiter &ForThisThread() {
+    thread_local UnlockWaiter waiter;
+    waiter.state_.store(kWaiting, std::memory_order_relaxed);
+    return waiter;
+  }
+
+  /*
+  ** Blocks until Fire() has been called or the deadline passes. Returns
+  ** whether it was fired.
+  */
+  bool Wait(sqlite3_int64 deadline) {
+    uint32_t expected = kWaiting;
+    /* Only a sleeping waiter needs waking, so say that we are about to. */
+    if (!state_.compare_exchange_strong(expected, kSleeping,
+                                        std::memory_order_acquire)) {
+      return true;
+    }
+#if defined(__linux__)
+    struct timespec until;
+    until.tv_sec = static_cast<time_t>(deadline / 1000000);
+    until.tv_nsec = static_cast<long>(deadline % 1000000) * 1000;
+    while (state_.load(std::memory_order_acquire) != kFired) {
+      /* steady_clock is CLOCK_MONOTONIC, which FUTEX_WAIT_BITSET measures
+      ** absolute timeouts against.
+      */
+      long rc = syscall(SYS_futex, &state_, FUTEX_WAIT_BITSET_PRIVATE,
+                        kSleeping, deadline == kNoDeadline ? nullptr : &until,
+                        nullptr, FUTEX_BITSET_MATCH_ANY);
+      if (rc != 0 && errno == ETIMEDOUT) break;
+    }
+#else
+    auto lock = std::unique_lock(mutex_);
+    if (deadline == kNoDeadline) {
+      while (state_.load(std::memory_order_acquire) != kFired) {
+        cond_.wait(lock);
+      }
+      return true;
+    }
+    /* Only a finite deadline fits in the clock's nanoseconds. */
+    auto until = Clock::time_point(std::chrono::microseconds(deadline));
+    while (state_.load(std::memory_order_acquire) != kFired) {
+      if (cond_.wait_until(lock, until) == std::cv_status::timeout) break;
+    }
+#endif
+    return fired();
+  }
+
+  inline bool fired() const {
+    return state_.load(std::memory_order_acquire) == kFired;
+  }
+
+  /*
+  ** Marks the waiter as fired, returning whether its thread is asleep and so
+  ** must be woken.
+  */
+  inline bool Fire() {
+    return state_.exchange(kFired, std::memory_order_acq_rel) == kSleeping;
+  }
+
+  /* Wakes the waiter's thread, after Fire() returned true. */
+  void Wake() {
+#if defined(__linux__)
+    syscall(SYS_futex, &state_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+    /* Taking the mutex orders this after the waiter has started waiting. */
+    { auto _lock = std::lock_guard(mutex_); }
+    cond_.notify_one();
+#endif
+  }
+
+ private:
+  static constexpr uint32_t kWaiting = 0;
+  static constexpr uint32_t kSleeping = 1;
+  static constexpr uint32_t kFired = 2;
+
+  UnlockWaiter() = default;
+
+  std::atomic<uint32_t> state_{kWaiting};
+#if !defined(__linux__)
+  std::mutex mutex_;
+  std::condition_variable cond_;
+#endif
+};
+
+/*
+** This function is an unlock-notify callback registered with SQLite. It
+** marks every waiter as fired before waking any of them, so no woken thread
+** has to wait for the callback to get around to the others, and only makes
+** a wake-up call for waiters that have actually gone to sleep.
 */
 void unlock_notify_cb(void **apArg, int nArg) {
-  for (int i = 0; i < nArg; i++) {
-    auto *p = reinterpret_cast<UnlockNotification *>(apArg[i]);
-    auto _lock = std::lock_guard(p->mutex);
-    p->fired = true;
-    p->cond.notify_all();
+  constexpr int kBatch = 64;
+  for (int first = 0; first < nArg; first += kBatch) {
+    UnlockWaiter *sleeping[kBatch];
+    int nSleeping = 0;
+    int last = std::min(nArg, first + kBatch);
+    for (int i = first; i < last; i++) {
+      auto *p = static_cast<UnlockWaiter *>(apArg[i]);
+      if (p->Fire()) sleeping[nSleeping++] = p;
+    }
+    for (int i = 0; i < nSleeping; i++) sleeping[i]->Wake();
   }
 }
 
@@ -52,13 +295,20 @@ void unlock_notify_cb(void **apArg, int nArg) {
 ** the system, then this function returns SQLITE_LOCKED immediately. In
 ** this case the caller should not retry the operation and should roll
 ** back the current transaction (if any).
+**
+** If the deadline passes before the callback is delivered, the callback is
+** cancelled and this function returns SQLITE_BUSY. The caller should treat
+** this like SQLITE_LOCKED.
+**
+** zSql and nSql describe the SQL that was blocked, for the wait hook.
 */
-int wait_for_unlock_notify(sqlite3 *db) {
-  UnlockNotification un;
+int wait_for_unlock_notify(sqlite3 *db, const char *zSql, int nSql,
+                           sqlite3_int64 deadline) {
+  UnlockWaiter &waiter = UnlockWaiter::ForThisThread();
 
   /* Register for an unlock-notify callback. */
   int rc = sqlite3_unlock_notify(db, unlock_notify_cb,
-                                 reinterpret_cast<void *>(&un));
+                                 static_cast<void *>(&waiter));
   assert(rc == SQLITE_LOCKED || rc == SQLITE_OK);
 
   /* The call to sqlite3_unlock_notify() always returns either SQLITE_LOCKED
@@ -69,51 +319,149 @@ int wait_for_unlock_notify(sqlite3 *db) {
   ** that the current transaction can be rolled back. Otherwise, block
   ** until the unlock-notify callback is invoked, then return SQLITE_OK.
   */
-  if (rc == SQLITE_OK) {
-    auto _lock = std::unique_lock(un.mutex);
-    while (!un.fired) {
-      un.cond.wait(_lock);
-    }
+  if (rc != SQLITE_OK) {
+    record_unlock_wait(db, zSql, nSql, rc, 0);
+    return rc;
   }
-
+  sqlite3_int64 start = sqlite3_blocking_now();
+  if (!waiter.Wait(deadline)) {
+    /* Cancel the callback before the waiter is reused. SQLite delivers
+    ** callbacks and cancels them under the same global mutex, so once this
+    ** returns the callback has either finished or will never run.
+    */
+    sqlite3_unlock_notify(db, nullptr, nullptr);
+    if (!waiter.fired()) rc = SQLITE_BUSY;
+  }
+  record_unlock_wait(db, zSql, nSql, rc, sqlite3_blocking_now() - start);
   return rc;
 }
 
 }  // namespace
 
 int sqlite3_blocking_step(sqlite3_stmt *pStmt) {
+  return sqlite3_blocking_step_until(pStmt, kNoDeadline);
+}
+
+int sqlite3_blocking_prepare_v2(
+    sqlite3 *db,           /* Database handle. */
+    const char *zSql,      /* UTF-8 encoded SQL statement. */
+    int nSql,              /* Length of zSql in bytes. */
+    sqlite3_stmt **ppStmt, /* OUT: A pointer to the prepared statement */
+    const char **pz        /* OUT: End of parsed string */
+) {
+  return sqlite3_blocking_prepare_v2_until(db, zSql, nSql, ppStmt, pz,
+                                           kNoDeadline);
+}
+
+int sqlite3_blocking_exec(sqlite3 *db, const char *sql,
+                          int (*callback)(void *, int, char **, char **),
+                          void *arg, char **errmsg) {
+  return sqlite3_blocking_exec_until(db, sql, callback, arg, errmsg,
+                                     kNoDeadline);
+}
+
+sqlite3_int64 sqlite3_blocking_now(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+int sqlite3_blocking_wait_for_unlock(sqlite3 *db) {
+  return wait_for_unlock_notify(db, nullptr, -1, kNoDeadline);
+}
+
+int sqlite3_blocking_wait_for_unlock_until(sqlite3 *db,
+                                           sqlite3_int64 deadline) {
+  return wait_for_unlock_notify(db, nullptr, -1, deadline);
+}
+
+int sqlite3_blocking_step_until(sqlite3_stmt *pStmt, sqlite3_int64 deadline) {
+  DeadlineScope scope(deadline);
+  /* Retrying means resetting the statement, which is only safe if it hasn't
+  ** returned any rows yet.
+  */
+  bool fresh = !sqlite3_stmt_busy(pStmt);
   int rc;
-  while (SQLITE_LOCKED == (rc = sqlite3_step(pStmt))) {
-    rc = wait_for_unlock_notify(sqlite3_db_handle(pStmt));
+  while (SQLITE_LOCKED == (rc = sqlite3_step(pStmt)) && fresh) {
+    rc = wait_for_unlock_notify(sqlite3_db_handle(pStmt), sqlite3_sql(pStmt),
+                                -1, deadline);
     if (rc != SQLITE_OK) break;
     sqlite3_reset(pStmt);
   }
   return rc;
 }
 
-int sqlite3_blocking_prepare_v2(
+int sqlite3_blocking_prepare_v2_until(
     sqlite3 *db,           /* Database handle. */
     const char *zSql,      /* UTF-8 encoded SQL statement. */
     int nSql,              /* Length of zSql in bytes. */
     sqlite3_stmt **ppStmt, /* OUT: A pointer to the prepared statement */
-    const char **pz        /* OUT: End of parsed string */
+    const char **pz,       /* OUT: End of parsed string */
+    sqlite3_int64 deadline /* Give up waiting at this time. */
 ) {
+  DeadlineScope scope(deadline);
   int rc;
   while (SQLITE_LOCKED ==
          (rc = sqlite3_prepare_v2(db, zSql, nSql, ppStmt, pz))) {
-    rc = wait_for_unlock_notify(db);
+    rc = wait_for_unlock_notify(db, zSql, nSql, deadline);
     if (rc != SQLITE_OK) break;
   }
   return rc;
 }
 
-int sqlite3_blocking_exec(sqlite3 *db, const char *sql,
-                          int (*callback)(void *, int, char **, char **),
-                          void *arg, char **errmsg) {
+int sqlite3_blocking_exec_until(sqlite3 *db, const char *sql,
+                                int (*callback)(void *, int, char **, char **),
+                                void *arg, char **errmsg,
+                                sqlite3_int64 deadline) {
+  DeadlineScope scope(deadline);
   int rc;
   while (SQLITE_LOCKED == (rc = sqlite3_exec(db, sql, callback, arg, errmsg))) {
-    rc = wait_for_unlock_notify(db);
+    rc = wait_for_unlock_notify(db, sql, -1, deadline);
     if (rc != SQLITE_OK) break;
   }
   return rc;
 }
+
+int sqlite3_blocking_busy_backoff(sqlite3 *db,
+                                  const sqlite3_blocking_backoff *pPolicy) {
+  if (pPolicy == nullptr) return sqlite3_busy_handler(db, nullptr, nullptr);
+  return sqlite3_busy_handler(
+      db, busy_backoff_cb,
+      const_cast<void *>(static_cast<const void *>(pPolicy)));
+}
+
+void sqlite3_blocking_get_busy_stats(sqlite3_blocking_busy_stats *pStats) {
+  pStats->nBusy = busy_count.load(std::memory_order_relaxed);
+  pStats->nRetry = busy_retry_count.load(std::memory_order_relaxed);
+  pStats->nTimeout = busy_timeout_count.load(std::memory_order_relaxed);
+  pStats->waitUs = busy_wait_us.load(std::memory_order_relaxed);
+}
+
+void sqlite3_blocking_get_unlock_stats(sqlite3_blocking_unlock_stats *pStats) {
+  pStats->nWait = unlock_wait_count.load(std::memory_order_relaxed);
+  pStats->nDeadlock = unlock_deadlock_count.load(std::memory_order_relaxed);
+  pStats->nTimeout = unlock_timeout_count.load(std::memory_order_relaxed);
+  pStats->waitUs = unlock_wait_us.load(std::memory_order_relaxed);
+}
+
+void sqlite3_blocking_get_thread_unlock_stats(
+    sqlite3_blocking_unlock_stats *pStats) {
+  *pStats = tls_unlock_stats;
+}
+
+void sqlite3_blocking_get_unlock_histogram(
+    sqlite3_int64 aCount[SQLITE_BLOCKING_HISTOGRAM_BUCKETS]) {
+  for (int i = 0; i < SQLITE_BLOCKING_HISTOGRAM_BUCKETS; i++) {
+    aCount[i] = unlock_histogram[i].load(std::memory_order_relaxed);
+  }
+}
+
+void sqlite3_blocking_set_wait_hook(sqlite3_blocking_wait_hook xHook,
+                                    void *pArg) {
+  auto lock = std::unique_lock(wait_hook_mutex);
+  wait_hook = xHook;
+  wait_hook_arg = pArg;
+  wait_hook_set.store(xHook != nullptr, std::memory_order_release);
+}
+
+sqlite3_int64 sqlite3_blocking_thread_wait_us(void) { return tls_wait_us; }
@@ -26,9 +26,24 @@ extern "C" {
 ** If this function returns SQLITE_LOCKED, the caller should rollback
 ** the current transaction (if any) and try again later. Otherwise, the
 ** system may become deadlocked.
+**
+** Waiting for the lock requires the statement to be reset and run again, so
+** this only happens before the statement has returned any rows. If the lock
+** is hit after rows were returned, this function returns SQLITE_LOCKED
+** without waiting, rather than restarting the query and returning those rows
+** again. The caller may then wait with sqlite3_blocking_wait_for_unlock() and
+** resume the query itself.
 */
 int sqlite3_blocking_step(sqlite3_stmt *pStmt);
 
+/*
+** Blocks until the shared-cache lock that caused an SQLite API call on db to
+** return SQLITE_LOCKED is released, and returns SQLITE_OK. If waiting would
+** deadlock the system, returns SQLITE_LOCKED immediately, and the caller
+** should rollback the current transaction (if any).
+*/
+int sqlite3_blocking_wait_for_unlock(sqlite3 *db);
+
 /*
 ** This function is a wrapper around the SQLite function sqlite3_prepare_v2().
 ** It functions in the same way as prepare_v2(), except that if a required
@@ -63,6 +78,147 @@ int sqlite3_blocking_exec(sqlite3 *db, const char *sql,
                           int (*callback)(void *, int, char **, char **),
                           void *arg, char **errmsg);
 
+/*
+** Returns the current time on the monotonic clock used for deadlines, in
+** microseconds. A deadline for the _until functions below is this value plus
+** a timeout.
+*/
+sqlite3_int64 sqlite3_blocking_now(void);
+
+/*
+** These functions work like sqlite3_blocking_step(),
+** sqlite3_blocking_prepare_v2(), sqlite3_blocking_exec() and
+** sqlite3_blocking_wait_for_unlock(), except that they stop waiting for a
+** shared-cache lock once the clock returned by sqlite3_blocking_now() reaches
+** the deadline. In that case they return SQLITE_BUSY, and as with
+** SQLITE_LOCKED the caller should rollback the current transaction (if any)
+** and try again later.
+*/
+int sqlite3_blocking_step_until(sqlite3_stmt *pStmt, sqlite3_int64 deadline);
+
+int sqlite3_blocking_prepare_v2_until(
+    sqlite3 *db,           /* Database handle. */
+    const char *zSql,      /* UTF-8 encoded SQL statement. */
+    int nSql,              /* Length of zSql in bytes. */
+    sqlite3_stmt **ppStmt, /* OUT: A pointer to the prepared statement */
+    const char **pz,       /* OUT: End of parsed string */
+    sqlite3_int64 deadline /* Give up waiting at this time. */
+);
+
+int sqlite3_blocking_exec_until(sqlite3 *db, const char *sql,
+                                int (*callback)(void *, int, char **, char **),
+                                void *arg, char **errmsg,
+                                sqlite3_int64 deadline);
+
+int sqlite3_blocking_wait_for_unlock_until(sqlite3 *db, sqlite3_int64 deadline);
+
+/*
+** Configuration for retrying operations that fail with SQLITE_BUSY because
+** another connection (possibly in another process) holds a conflicting lock
+** on the database file. Each retry sleeps for an exponentially growing,
+** randomly jittered interval.
+*/
+typedef struct sqlite3_blocking_backoff {
+  sqlite3_int64 initialUs;  /* Nominal sleep before the first retry. */
+  sqlite3_int64 maxSleepUs; /* Upper bound on the nominal sleep. */
+  sqlite3_int64 maxWaitUs;  /* Give up after waiting this long for a lock. */
+} sqlite3_blocking_backoff;
+
+/*
+** Installs pPolicy as the busy handler of db, replacing any busy handler or
+** busy timeout. SQLite calls the handler whenever it finds the database busy,
+** so this covers every statement and exec on the connection. The policy is not
+** copied, must outlive its use by the connection and may be shared between
+** connections. Passing NULL removes the handler.
+**
+** The _until functions above also stop retrying when their deadline passes.
+*/
+int sqlite3_blocking_busy_backoff(sqlite3 *db,
+                                  const sqlite3_blocking_backoff *pPolicy);
+
+/*
+** Process-wide counters for the backoff busy handler.
+*/
+typedef struct sqlite3_blocking_busy_stats {
+  sqlite3_int64 nBusy;    /* Operations that found the database busy. */
+  sqlite3_int64 nRetry;   /* Retries made after sleeping. */
+  sqlite3_int64 nTimeout; /* Operations that gave up and returned BUSY. */
+  sqlite3_int64 waitUs;   /* Total time spent sleeping. */
+} sqlite3_blocking_busy_stats;
+
+void sqlite3_blocking_get_busy_stats(sqlite3_blocking_busy_stats *pStats);
+
+/*
+** Process-wide counters for waits on shared-cache locks by the functions
+** above.
+*/
+typedef struct sqlite3_blocking_unlock_stats {
+  sqlite3_int64 nWait;     /* Waits for an unlock-notify callback. */
+  sqlite3_int64 nDeadlock; /* Waits refused because they would deadlock. */
+  sqlite3_int64 nTimeout;  /* Waits that gave up at their deadline. */
+  sqlite3_int64 waitUs;    /* Total time spent waiting. */
+} sqlite3_blocking_unlock_stats;
+
+void sqlite3_blocking_get_unlock_stats(sqlite3_blocking_unlock_stats *pStats);
+
+/*
+** The same counters, for the calling thread's waits only.
+*/
+void sqlite3_blocking_get_thread_unlock_stats(
+    sqlite3_blocking_unlock_stats *pStats);
+
+/*
+** Process-wide histogram of the time spent in each wait for a shared-cache
+** lock, including waits that timed out. Bucket 0 counts waits shorter than
+** one microsecond and bucket i counts waits of at least 2^(i-1) and less than
+** 2^i microseconds, except that the last bucket also counts every longer
+** wait. Waits refused because they would deadlock are not included.
+*/
+#define SQLITE_BLOCKING_HISTOGRAM_BUCKETS 32
+
+void sqlite3_blocking_get_unlock_histogram(
+    sqlite3_int64 aCount[SQLITE_BLOCKING_HISTOGRAM_BUCKETS]);
+
+/*
+** Describes one wait for a shared-cache lock, for the wait hook below.
+*/
+typedef struct sqlite3_blocking_wait_info {
+  sqlite3 *db;          /* Connection that was blocked. */
+  const char *zSql;     /* SQL that was blocked, or NULL if not known. */
+  int nSql;             /* Length of zSql in bytes, or -1 if nul-terminated. */
+  int rc;               /* SQLITE_OK once unlocked, SQLITE_LOCKED if waiting
+                        ** would deadlock, SQLITE_BUSY at the deadline. */
+  sqlite3_int64 waitUs; /* Time spent waiting. */
+} sqlite3_blocking_wait_info;
+
+typedef void (*sqlite3_blocking_wait_hook)(
+    void *pArg, const sqlite3_blocking_wait_info *pInfo);
+
+/*
+** Installs xHook to be called on the waiting thread after every wait for a
+** shared-cache lock, and every wait refused because it would deadlock,
+** replacing any previous hook. Passing NULL removes it. The hook must not use
+** the blocked connection or call this function, and should be quick since it
+** runs while the caller is waiting for its result.
+**
+** For sqlite3_blocking_step() zSql is the statement's SQL, for
+** sqlite3_blocking_prepare_v2() the SQL being prepared, and for
+** sqlite3_blocking_exec() the whole script. It is NULL for
+** sqlite3_blocking_wait_for_unlock(). It is only valid during the call.
+**
+** Once this function returns no call to the previous hook is in progress, so
+** its pArg may be freed.
+*/
+void sqlite3_blocking_set_wait_hook(sqlite3_blocking_wait_hook xHook,
+                                    void *pArg);
+
+/*
+** Total time the calling thread has spent waiting for shared-cache locks and
+** sleeping in the backoff busy handler, in microseconds. Sampling it before
+** and after an operation gives the operation's lock waits.
+*/
+sqlite3_int64 sqlite3_blocking_thread_wait_us(void);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -1,5 +1,14 @@
 #include "sqlite_cpp.h"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+// Out of line unless SQLITE_CPP_HEADER_ONLY, when sqlite_cpp.h has them.
+#ifndef SQLITE_CPP_HEADER_ONLY
+#include "sqlite_cpp_inl.h"
+#endif
+
 /*
 ** The author disclaims copyright to this source code.  In place of
 ** a legal notice, here is a blessing:
@@ -11,6 +20,391 @@
 
 namespace sqlite {
 
+namespace {
+
+constexpr string_view kBeginDeferred = "BEGIN DEFERRED;";
+constexpr string_view kBeginImmediate = "BEGIN IMMEDIATE;";
+constexpr string_view kBeginExclusive = "BEGIN EXCLUSIVE;";
+constexpr string_view kCommit = "COMMIT;";
+constexpr string_view kRollback = "ROLLBACK;";
+// Savepoints all share one name; RELEASE and ROLLBACK TO act on the innermost
+// savepoint with a given name, which is the matching guard.
+constexpr string_view kSavepoint = "SAVEPOINT sqlite_cpp_savepoint;";
+constexpr string_view kRelease = "RELEASE sqlite_cpp_savepoint;";
+constexpr string_view kRollbackTo = "ROLLBACK TO sqlite_cpp_savepoint;";
+
+// Runs a statement from the cache, returning its rc with SQLITE_DONE as
+// SQLITE_OK.
+int RunCached(StatementCache* cache, string_view sql) {
+  auto stmt = cache->Get(sql);
+  if (!stmt->ok()) return stmt->rc();
+  return stmt->Run() ? SQLITE_OK : stmt->rc();
+}
+
+// Pointer type tag for arrays bound for cpp_array().
+constexpr char kArrayPointerType[] = "sqlite_cpp_array";
+
+// An array bound to a parameter with sqlite3_bind_pointer().
+struct BoundArray {
+  virtual ~BoundArray() = default;
+
+  detail::ArrayType type;
+  const void* data;
+  size_t size;
+};
+
+// A BoundArray owning a copy of the values, and of the bytes of string values.
+template <typename T>
+struct CopiedArray : public BoundArray {
+  std::vector<T> values;
+  std::vector<char> bytes;
+};
+
+template <typename T>
+BoundArray* CopyArray(const void* data, size_t size) {
+  auto* copy = new CopiedArray<T>();
+  const T* values = static_cast<const T*>(data);
+  copy->values.assign(values, values + size);
+  if constexpr (std::is_same_v<T, string_view> || std::is_same_v<T, TextView>) {
+    size_t total = 0;
+    for (const T& value : copy->values) total += value.size();
+    copy->bytes.resize(total);
+    char* next = copy->bytes.data();
+    for (T& value : copy->values) {
+      std::copy(value.begin(), value.end(), next);
+      value = T(next, value.size());
+      next += value.size();
+    }
+  }
+  copy->data = copy->values.data();
+  return copy;
+}
+
+void DeleteArray(void* array) { delete static_cast<BoundArray*>(array); }
+
+// Arrays bound without copying are only a view of the caller's values, so
+// their BoundArrays are recycled through a per-thread free list rather than
+// allocated for every bind.
+constexpr size_t kMaxFreeViews = 64;
+
+struct FreeViews {
+  FreeViews() { views.reserve(kMaxFreeViews); }
+  ~FreeViews();
+
+  std::vector<BoundArray*> views;
+};
+
+// Statements may be finalized during thread exit, after the free list is gone.
+thread_local bool free_views_destroyed = false;
+thread_local FreeViews free_views;
+
+FreeViews::~FreeViews() {
+  free_views_destroyed = true;
+  for (BoundArray* view : views) delete view;
+}
+
+BoundArray* NewView() {
+  if (free_views_destroyed || free_views.views.empty()) return new BoundArray();
+  BoundArray* view = free_views.views.back();
+  free_views.views.pop_back();
+  return view;
+}
+
+void DeleteView(void* view) {
+  if (free_views_destroyed || free_views.views.size() >= kMaxFreeViews) {
+    delete static_cast<BoundArray*>(view);
+  } else {
+    free_views.views.push_back(static_cast<BoundArray*>(view));
+  }
+}
+
+// The cpp_array() eponymous virtual table. Its hidden column "pointer" is
+// the function argument, and must be constrained for the table to have rows.
+constexpr int kArrayValueColumn = 0;
+constexpr int kArrayPointerColumn = 1;
+
+struct ArrayCursor {
+  sqlite3_vtab_cursor base;
+  const BoundArray* array = nullptr;
+  size_t row = 0;
+};
+
+int ArrayConnect(sqlite3* db, void*, int, const char* const*,
+                 sqlite3_vtab** vtab, char**) {
+  int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(value, pointer HIDDEN)");
+  if (rc != SQLITE_OK) return rc;
+  *vtab = static_cast<sqlite3_vtab*>(sqlite3_malloc(sizeof(sqlite3_vtab)));
+  if (*vtab == nullptr) return SQLITE_NOMEM;
+  **vtab = sqlite3_vtab{};
+  return SQLITE_OK;
+}
+
+int ArrayDisconnect(sqlite3_vtab* vtab) {
+  sqlite3_free(vtab);
+  return SQLITE_OK;
+}
+
+int ArrayBestIndex(sqlite3_vtab*, sqlite3_index_info* info) {
+  bool constrained = false;
+  for (int i = 0; i < info->nConstraint; ++i) {
+    const auto& constraint = info->aConstraint[i];
+    if (constraint.iColumn != kArrayPointerColumn) continue;
+    if (!constraint.usable ||
+        constraint.op != SQLITE_INDEX_CONSTRAINT_EQ) {
+      constrained = true;
+      continue;
+    }
+    info->aConstraintUsage[i].argvIndex = 1;
+    info->aConstraintUsage[i].omit = 1;
+    info->idxNum = 1;
+    info->estimatedCost = 10;
+    info->estimatedRows = 100;
+    return SQLITE_OK;
+  }
+  // The argument is only available in some other join order.
+  if (constrained) return SQLITE_CONSTRAINT;
+  // Without an argument there are no rows.
+  info->idxNum = 0;
+  info->estimatedCost = 1;
+  info->estimatedRows = 1;
+  return SQLITE_OK;
+}
+
+int ArrayOpen(sqlite3_vtab*, sqlite3_vtab_cursor** cursor) {
+  auto* array_cursor = new ArrayCursor();
+  *cursor = &array_cursor->base;
+  return SQLITE_OK;
+}
+
+int ArrayClose(sqlite3_vtab_cursor* cursor) {
+  delete reinterpret_cast<ArrayCursor*>(cursor);
+  return SQLITE_OK;
+}
+
+int ArrayFilter(sqlite3_vtab_cursor* cursor, int idx_num, const char*, int,
+                sqlite3_value** argv) {
+  auto* array_cursor = reinterpret_cast<ArrayCursor*>(cursor);
+  array_cursor->row = 0;
+  array_cursor->array =
+      idx_num == 1 ? static_cast<const BoundArray*>(
+                         sqlite3_value_pointer(argv[0], kArrayPointerType))
+                   : nullptr;
+  return SQLITE_OK;
+}
+
+int ArrayNext(sqlite3_vtab_cursor* cursor) {
+  ++reinterpret_cast<ArrayCursor*>(cursor)->row;
+  return SQLITE_OK;
+}
+
+int ArrayEof(sqlite3_vtab_cursor* cursor) {
+  auto* array_cursor = reinterpret_cast<ArrayCursor*>(cursor);
+  return array_cursor->array == nullptr ||
+         array_cursor->row >= array_cursor->array->size;
+}
+
+int ArrayColumn(sqlite3_vtab_cursor* cursor, sqlite3_context* ctx,
+                int column) {
+  auto* array_cursor = reinterpret_cast<ArrayCursor*>(cursor);
+  if (column != kArrayValueColumn) {
+    sqlite3_result_null(ctx);
+    return SQLITE_OK;
+  }
+  const BoundArray* array = array_cursor->array;
+  size_t row = array_cursor->row;
+  // The values, copied or not, stay valid while the parameter is bound, and it
+  // can only be rebound once the statement is reset, so strings are returned
+  // without copying.
+  switch (array->type) {
+    case detail::ArrayType::kInt64:
+      sqlite3_result_int64(ctx, static_cast<const int64*>(array->data)[row]);
+      break;
+    case detail::ArrayType::kDouble:
+      sqlite3_result_double(ctx, static_cast<const double*>(array->data)[row]);
+      break;
+    case detail::ArrayType::kBlob: {
+      string_view value = static_cast<const string_view*>(array->data)[row];
+      sqlite3_result_blob64(
+          ctx, value.empty() ? &detail::kNothing : value.data(), value.size(),
+          SQLITE_STATIC);
+      break;
+    }
+    case detail::ArrayType::kText: {
+      TextView value = static_cast<const TextView*>(array->data)[row];
+      sqlite3_result_text64(
+          ctx, value.empty() ? &detail::kNothing : value.data(), value.size(),
+          SQLITE_STATIC, SQLITE_UTF8);
+      break;
+    }
+  }
+  return SQLITE_OK;
+}
+
+int ArrayRowid(sqlite3_vtab_cursor* cursor, sqlite3_int64* rowid) {
+  *rowid = reinterpret_cast<ArrayCursor*>(cursor)->row + 1;
+  return SQLITE_OK;
+}
+
+sqlite3_module MakeArrayModule() {
+  sqlite3_module module = {};
+  // No xCreate makes the table eponymous-only: it exists as cpp_array() in
+  // every schema and cannot be created with CREATE VIRTUAL TABLE.
+  module.xConnect = ArrayConnect;
+  module.xBestIndex = ArrayBestIndex;
+  module.xDisconnect = ArrayDisconnect;
+  module.xOpen = ArrayOpen;
+  module.xClose = ArrayClose;
+  module.xFilter = ArrayFilter;
+  module.xNext = ArrayNext;
+  module.xEof = ArrayEof;
+  module.xColumn = ArrayColumn;
+  module.xRowid = ArrayRowid;
+  return module;
+}
+
+const sqlite3_module kArrayModule = MakeArrayModule();
+
+constexpr string_view kScanPrefix = "SCAN ";
+
+// Builds the plan nodes whose parent is parent from EXPLAIN QUERY PLAN rows of
+// (id, parent, detail), in the order sqlite reported them.
+void BuildPlan(std::vector<std::tuple<int, int, string>>& rows, int parent,
+               std::vector<PlanNode>* nodes) {
+  for (auto& [id, row_parent, detail] : rows) {
+    if (row_parent != parent) continue;
+    nodes->push_back(PlanNode{/*id=*/id, /*detail=*/std::move(detail),
+                              /*children=*/{}});
+    BuildPlan(rows, id, &nodes->back().children);
+  }
+}
+
+bool IsIdentifierChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == '$' ||
+         static_cast<unsigned char>(c) >= 0x80;
+}
+
+// Splits sql into identifiers (unquoted) and single punctuation characters,
+// skipping whitespace, literals and comments. Good enough to find the table
+// before an alias, not to parse sql.
+std::vector<string> Tokenize(string_view sql) {
+  std::vector<string> tokens;
+  size_t i = 0;
+  while (i < sql.size()) {
+    char c = sql[i];
+    if (c == '\'') {
+      ++i;
+      while (i < sql.size() && sql[i] != '\'') ++i;
+      ++i;
+    } else if (c == '"' || c == '`' || c == '[') {
+      char close = c == '[' ? ']' : c;
+      size_t start = ++i;
+      while (i < sql.size() && sql[i] != close) ++i;
+      tokens.emplace_back(sql.substr(start, i - start));
+      ++i;
+    } else if (sql.substr(i, 2) == "--") {
+      while (i < sql.size() && sql[i] != '\n') ++i;
+    } else if (sql.substr(i, 2) == "/*") {
+      size_t end = sql.find("*/", i + 2);
+      i = end == string_view::npos ? sql.size() : end + 2;
+    } else if (IsIdentifierChar(c)) {
+      size_t start = i;
+      while (i < sql.size() && IsIdentifierChar(sql[i])) ++i;
+      tokens.emplace_back(sql.substr(start, i - start));
+    } else {
+      if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+        tokens.emplace_back(1, c);
+      }
+      ++i;
+    }
+  }
+  return tokens;
+}
+
+string QuoteIdentifier(string_view name) {
+  string quoted = "\"";
+  for (char c : name) {
+    quoted += c;
+    if (c == '"') quoted += c;
+  }
+  return quoted + "\"";
+}
+
+// Counts the rows of table, stopping at limit + 1, or returns -1 if there is
+// no such table.
+int64 CountRows(sqlite3* db, string_view schema, string_view table,
+                int64 limit) {
+  string name = QuoteIdentifier(table);
+  if (!schema.empty()) name = QuoteIdentifier(schema) + "." + name;
+  Statement count(db, "SELECT count(*) FROM (SELECT 1 FROM " + name +
+                          " LIMIT ?);");
+  // No table can have more rows than the largest limit, and a negative limit
+  // is none at all.
+  int64 stop = limit < std::numeric_limits<int64>::max() ? limit + 1 : -1;
+  if (!count.ok() || !count.Bind(stop)) return -1;
+  auto row = count.GetRow<int64>();
+  return row.has_value() ? std::get<0>(*row) : -1;
+}
+
+// Splits "schema.name" as it appears in a plan.
+std::pair<string_view, string_view> SplitSchema(string_view name) {
+  size_t dot = name.find('.');
+  if (dot == string_view::npos) return {string_view(), name};
+  return {name.substr(0, dot), name.substr(dot + 1)};
+}
+
+bool SameIdentifier(string_view a, string_view b) {
+  return a.size() == b.size() &&
+         sqlite3_strnicmp(a.data(), b.data(), static_cast<int>(a.size())) == 0;
+}
+
+}  // namespace
+
+bool PlanNode::IsFullScan() const {
+  if (detail.compare(0, kScanPrefix.size(), kScanPrefix) != 0) return false;
+  string_view rest = string_view(detail).substr(kScanPrefix.size());
+  return !rest.empty() && rest[0] != '(' && rest != "CONSTANT ROW" &&
+         rest.find(" USING ") == string_view::npos &&
+         rest.find(" VIRTUAL TABLE") == string_view::npos;
+}
+
+string_view PlanNode::scanned() const {
+  if (!IsFullScan()) return string_view();
+  string_view rest = string_view(detail).substr(kScanPrefix.size());
+  return rest.substr(0, rest.find(' '));
+}
+
+int RegisterArrayFunction(sqlite3* db) {
+  return sqlite3_create_module(db, "cpp_array", &kArrayModule, nullptr);
+}
+
+namespace detail {
+
+int BindArray(sqlite3_stmt* stmt, int position, ArrayType type,
+              const void* data, size_t size, bool copy) {
+  BoundArray* array;
+  if (!copy) {
+    array = NewView();
+  } else if (type == ArrayType::kInt64) {
+    array = CopyArray<int64>(data, size);
+  } else if (type == ArrayType::kDouble) {
+    array = CopyArray<double>(data, size);
+  } else if (type == ArrayType::kBlob) {
+    array = CopyArray<string_view>(data, size);
+  } else {
+    array = CopyArray<TextView>(data, size);
+  }
+  array->type = type;
+  if (!copy) array->data = data;
+  array->size = size;
+  // sqlite deletes the array when the parameter is rebound or cleared, or the
+  // statement is finalized, and if binding fails.
+  return sqlite3_bind_pointer(stmt, position, array, kArrayPointerType,
+                              copy ? DeleteArray : DeleteView);
+}
+
+}  // namespace detail
+
 int ExecRC(sqlite3* db, string_view script) {
   // We compile and execute the script in long-form so that we can accept
   // string_views, which may not be nul-terminated; sqlite3_exec only accepts
@@ -35,6 +429,151 @@ int ExecRC(sqlite3* db, string_view script) {
   return SQLITE_OK;
 }
 
+size_t RowArena::capacity() const {
+  size_t total = 0;
+  for (const auto& block : blocks_) total += block.size;
+  return total;
+}
+
+char* RowArena::AllocateSlow(size_t bytes) {
+  // Move on to the next block that fits. Blocks that are passed over are still
+  // reused after the next Reset().
+  while (++current_ < blocks_.size()) {
+    if (blocks_[current_].size >= bytes) {
+      used_ = bytes;
+      return blocks_[current_].data.get();
+    }
+  }
+  size_t size = std::max(block_size_, bytes);
+  blocks_.push_back({std::unique_ptr<char[]>(new char[size]), size});
+  current_ = blocks_.size() - 1;
+  used_ = bytes;
+  return blocks_.back().data.get();
+}
+
+ParamPack::ParamPack(const ParamPack& copy_from)
+    : size_(copy_from.size_), count_(copy_from.count_) {
+  if (size_ > kInlineCapacity) {
+    heap_.reset(new char[size_]);
+    capacity_ = size_;
+  }
+  std::memcpy(data(), copy_from.data(), size_);
+}
+
+ParamPack& ParamPack::operator=(const ParamPack& copy_from) {
+  if (this != &copy_from) {
+    Clear();
+    Reserve(copy_from.size_);
+    std::memcpy(data(), copy_from.data(), copy_from.size_);
+    size_ = copy_from.size_;
+    count_ = copy_from.count_;
+  }
+  return *this;
+}
+
+ParamPack::ParamPack(ParamPack&& move_from) noexcept
+    : heap_(std::move(move_from.heap_)),
+      capacity_(move_from.capacity_),
+      size_(move_from.size_),
+      count_(move_from.count_) {
+  if (!heap_) std::memcpy(inline_, move_from.inline_, size_);
+  move_from.capacity_ = kInlineCapacity;
+  move_from.Clear();
+}
+
+ParamPack& ParamPack::operator=(ParamPack&& move_from) noexcept {
+  if (this != &move_from) {
+    heap_ = std::move(move_from.heap_);
+    capacity_ = move_from.capacity_;
+    size_ = move_from.size_;
+    count_ = move_from.count_;
+    if (!heap_) std::memcpy(inline_, move_from.inline_, size_);
+    move_from.capacity_ = kInlineCapacity;
+    move_from.Clear();
+  }
+  return *this;
+}
+
+int ParamPack::Bind(sqlite3_stmt* stmt, bool copy) const {
+  const char* next = data();
+  const char* end = next + size_;
+  for (int position = 1; next < end; ++position) {
+    auto tag = static_cast<Tag>(*next++);
+    int rc = SQLITE_OK;
+    switch (tag) {
+      case Tag::kInt:
+      case Tag::kZeroBlob: {
+        int64 integer;
+        std::memcpy(&integer, next, sizeof(integer));
+        next += sizeof(integer);
+        rc = tag == Tag::kInt
+                 ? detail::BindParam<false>(stmt, position, integer)
+                 : detail::BindParam<false>(stmt, position, ZeroBlob{integer});
+        break;
+      }
+      case Tag::kDouble: {
+        double real;
+        std::memcpy(&real, next, sizeof(real));
+        next += sizeof(real);
+        rc = detail::BindParam<false>(stmt, position, real);
+        break;
+      }
+      case Tag::kText:
+      case Tag::kBlob: {
+        size_t size;
+        std::memcpy(&size, next, sizeof(size));
+        next += sizeof(size);
+        if (tag == Tag::kText) {
+          TextView text(next, size);
+          rc = copy ? detail::BindParam<true>(stmt, position, text)
+                    : detail::BindParam<false>(stmt, position, text);
+        } else {
+          string_view blob(next, size);
+          rc = copy ? detail::BindParam<true>(stmt, position, blob)
+                    : detail::BindParam<false>(stmt, position, blob);
+        }
+        next += size;
+        break;
+      }
+      case Tag::kNull:
+        rc = detail::BindParam<false>(stmt, position, std::nullopt);
+        break;
+    }
+    if (rc != SQLITE_OK) return rc;
+  }
+  return SQLITE_OK;
+}
+
+void ParamPack::Reserve(size_t capacity) {
+  if (capacity <= capacity_) return;
+  // Grow geometrically so that a pack built up by Add() reallocates rarely.
+  capacity = std::max(capacity, capacity_ * 2);
+  std::unique_ptr<char[]> grown(new char[capacity]);
+  std::memcpy(grown.get(), data(), size_);
+  heap_ = std::move(grown);
+  capacity_ = capacity;
+}
+
+void ParamPack::Append(Tag tag, const void* payload, size_t size) {
+  Reserve(size_ + 1 + size);
+  char* out = data() + size_;
+  *out = static_cast<char>(tag);
+  if (size > 0) std::memcpy(out + 1, payload, size);
+  size_ += 1 + size;
+  ++count_;
+}
+
+void ParamPack::AppendBytes(Tag tag, string_view bytes) {
+  size_t size = bytes.size();
+  Reserve(size_ + 1 + sizeof(size) + size);
+  char* out = data() + size_;
+  *out = static_cast<char>(tag);
+  std::memcpy(out + 1, &size, sizeof(size));
+  if (size > 0) std::memcpy(out + 1 + sizeof(size), bytes.data(), size);
+  size_ += 1 + sizeof(size) + size;
+  ++count_;
+}
+
 Statement::Statement(sqlite3* db, string_view sql, bool must_compile_all) {
   const char* remainder = nullptr;
   rc_ = sqlite3_blocking_prepare_v2(db, sql.data(), sql.size(), &stmt_,
@@ -64,26 +603,604 @@ Statement::Statement(sqlite3* db, string_view sql, bool must_compile_all) {
   }
 }
 
-Statement::Statement(Statement&& move_from) noexcept
-    : stmt_(move_from.stmt_), rc_(move_from.rc_) {
-  move_from.stmt_ = nullptr;
+int Statement::ExplainQueryPlan(std::vector<PlanNode>* plan) const {
+  plan->clear();
+  if (stmt_ == nullptr) return SQLITE_MISUSE;
+  Statement explain(sqlite3_db_handle(stmt_),
+                    string("EXPLAIN QUERY PLAN ") + sqlite3_sql(stmt_));
+  if (!explain.ok()) return explain.rc();
+  std::vector<std::tuple<int, int, string>> rows;
+  // Columns are id, parent, notused and detail.
+  while (auto row = explain.GetRow<int, int, int, string>()) {
+    auto& [id, parent, notused, detail] = *row;
+    rows.emplace_back(id, parent, std::move(detail));
+  }
+  if (explain.rc() != SQLITE_DONE) return explain.rc();
+  BuildPlan(rows, 0, plan);
+  return SQLITE_OK;
 }
 
-Statement::~Statement() { sqlite3_finalize(stmt_); }
+Statement::ManyControl::~ManyControl() {
+  sqlite3_finalize(begin);
+  sqlite3_finalize(commit);
+  sqlite3_finalize(rollback);
+}
 
-Statement& Statement::operator=(Statement&& move_from) noexcept {
-  sqlite3_finalize(stmt_);
-  stmt_ = move_from.stmt_;
-  move_from.stmt_ = nullptr;
-  rc_ = move_from.rc_;
+bool Statement::BeginMany(bool* own_transaction) {
+  sqlite3* db = sqlite3_db_handle(stmt_);
+  if (db == nullptr) {
+    rc_ = SQLITE_MISUSE;
+    return false;
+  }
+  *own_transaction = sqlite3_get_autocommit(db) != 0;
+  if (!*own_transaction) {
+    rc_ = SQLITE_OK;
+    return true;
+  }
+  if (many_ == nullptr) {
+    auto many = std::make_unique<ManyControl>();
+    if ((rc_ = sqlite3_blocking_prepare_v2(db, "BEGIN;", -1, &many->begin,
+                                           nullptr)) != SQLITE_OK ||
+        (rc_ = sqlite3_blocking_prepare_v2(db, "COMMIT;", -1, &many->commit,
+                                           nullptr)) != SQLITE_OK ||
+        (rc_ = sqlite3_blocking_prepare_v2(db, "ROLLBACK;", -1,
+                                           &many->rollback, nullptr)) !=
+            SQLITE_OK) {
+      *own_transaction = false;
+      return false;
+    }
+    many_ = std::move(many);
+  }
+  rc_ = RunControl(many_->begin);
+  if (rc_ != SQLITE_DONE) {
+    *own_transaction = false;
+    return false;
+  }
+  rc_ = SQLITE_OK;
+  return true;
+}
+
+bool Statement::EndMany(bool own_transaction) {
+  // Rows were bound without copying, so don't leave dangling bindings behind.
+  ClearBinds();
+  // Every row ran, or there were none.
+  bool succeeded = rc_ == SQLITE_DONE || rc_ == SQLITE_OK;
+  if (!own_transaction) return succeeded;
+  if (succeeded) {
+    int rc = RunControl(many_->commit);
+    if (rc == SQLITE_DONE) return true;
+    rc_ = rc;
+  }
+  // The statement must not be running for the rollback to succeed.
+  sqlite3_reset(stmt_);
+  RunControl(many_->rollback);
+  return false;
+}
+
+bool PreparedScript::Run() {
+  rc_ = SQLITE_OK;
+  for (size_t i = 0; i < statements_.size() || PrepareNext(); ++i) {
+    Statement& stmt = statements_[i];
+    sqlite3_reset(stmt.stmt_);
+    while ((stmt.rc_ = sqlite3_blocking_step(stmt.stmt_)) == SQLITE_ROW) {
+      // Ignore rows.
+    }
+    if (stmt.rc_ != SQLITE_DONE) {
+      rc_ = stmt.rc_;
+      return false;
+    }
+  }
+  return ok();
+}
+
+bool PreparedScript::Prepare() {
+  rc_ = SQLITE_OK;
+  while (PrepareNext()) {
+  }
+  return ok();
+}
+
+bool PreparedScript::PrepareNext() {
+  while (rc_ == SQLITE_OK && prepared_to_ < script_.size()) {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = nullptr;
+    rc_ = sqlite3_blocking_prepare_v2(
+        db_, script_.data() + prepared_to_,
+        static_cast<int>(script_.size() - prepared_to_), &stmt, &tail);
+    if (rc_ != SQLITE_OK) return false;
+    prepared_to_ = tail - script_.data();
+    // Whitespace and comments compile to no statement.
+    if (stmt != nullptr) {
+      statements_.push_back(Statement(stmt));
+      return true;
+    }
+  }
+  return false;
+}
+
+Statement::ResumePoint::~ResumePoint() { sqlite3_value_free(value_key_); }
+
+void Statement::ResumePoint::Remember(sqlite3_stmt* stmt, int column) {
+  has_key_ = true;
+  if (sqlite3_column_type(stmt, column) == SQLITE_INTEGER) {
+    int_key_ = sqlite3_column_int64(stmt, column);
+    sqlite3_value_free(value_key_);
+    value_key_ = nullptr;
+  } else {
+    sqlite3_value_free(value_key_);
+    value_key_ = sqlite3_value_dup(sqlite3_column_value(stmt, column));
+    if (value_key_ == nullptr) has_key_ = false;  // Out of memory.
+  }
+}
+
+void Statement::ResumePoint::Clear() {
+  has_key_ = false;
+  sqlite3_value_free(value_key_);
+  value_key_ = nullptr;
+  resumes_ = 0;
+}
+
+bool Statement::ResumePoint::Resume(sqlite3_stmt* stmt, int param, int* rc) {
+  *rc = sqlite3_blocking_wait_for_unlock(sqlite3_db_handle(stmt));
+  if (*rc != SQLITE_OK) return false;
+  ++resumes_;
+  sqlite3_reset(stmt);
+  *rc = value_key_ != nullptr ? sqlite3_bind_value(stmt, param, value_key_)
+                              : sqlite3_bind_int64(stmt, param, int_key_);
+  if (*rc != SQLITE_OK) return false;
+  // The statement is fresh again, so this waits out any lock it hits before
+  // its first row by itself.
+  *rc = sqlite3_blocking_step(stmt);
+  return true;
+}
+
+Statement::BatchWriter::BatchWriter(Statement* s, int64 batch_size)
+    : s_(s), batch_size_(batch_size > 0 ? batch_size : 1) {
+  s_->Reset();
+  sqlite3* db = sqlite3_db_handle(s_->stmt_);
+  if (db != nullptr) {
+    sqlite3_blocking_prepare_v2(db, "BEGIN;", -1, &begin_, nullptr);
+    sqlite3_blocking_prepare_v2(db, "COMMIT;", -1, &commit_, nullptr);
+    sqlite3_blocking_prepare_v2(db, "ROLLBACK;", -1, &rollback_, nullptr);
+  }
+}
+
+Statement::BatchWriter::~BatchWriter() {
+  if (open_) RollbackBatch();
+  s_->ClearBinds();
+  sqlite3_finalize(begin_);
+  sqlite3_finalize(commit_);
+  sqlite3_finalize(rollback_);
+}
+
+bool Statement::BatchWriter::Finish() {
+  bool ok = !open_ || CommitBatch();
+  // Rows were bound without copying, so don't leave dangling bindings behind.
+  s_->ClearBinds();
+  return ok;
+}
+
+void Statement::BatchWriter::Commit() {
+  if (!CommitBatch()) {
+    throw BatchSinkException(sqlite3_errstr(rc_), committed_);
+  }
+}
+
+void Statement::BatchWriter::Fail(int rc) {
+  if (open_) RollbackBatch();
+  rc_ = rc;
+  throw BatchSinkException(sqlite3_errstr(rc_), committed_);
+}
+
+bool Statement::BatchWriter::CommitBatch() {
+  int rc = RunControl(commit_);
+  if (rc != SQLITE_DONE) {
+    rc_ = rc;
+    RollbackBatch();
+    return false;
+  }
+  committed_ += pending_;
+  pending_ = 0;
+  open_ = false;
+  return true;
+}
+
+void Statement::BatchWriter::RollbackBatch() {
+  RunControl(rollback_);
+  pending_ = 0;
+  open_ = false;
+}
+
+int Statement::RunControl(sqlite3_stmt* stmt) {
+  // Stepping a null statement is a misuse rather than a crash.
+  int rc = sqlite3_blocking_step(stmt);
+  sqlite3_reset(stmt);
+  return rc;
+}
+
+StatementCache::Lease::Lease(Lease&& move_from) noexcept
+    : cache_(move_from.cache_), entry_(move_from.entry_) {
+  move_from.cache_ = nullptr;
+}
+
+StatementCache::Lease& StatementCache::Lease::operator=(
+    Lease&& move_from) noexcept {
+  if (this != &move_from) {
+    if (cache_ != nullptr) cache_->Return(entry_);
+    cache_ = move_from.cache_;
+    entry_ = move_from.entry_;
+    move_from.cache_ = nullptr;
+  }
   return *this;
 }
 
-void Statement::ClearBinds() { sqlite3_clear_bindings(stmt_); }
+StatementCache::Lease::~Lease() {
+  if (cache_ != nullptr) cache_->Return(entry_);
+}
+
+StatementCache::~StatementCache() { sqlite3_finalize(schema_version_); }
 
-bool Statement::Run() {
-  sqlite3_reset(stmt_);
-  return (rc_ = sqlite3_blocking_step(stmt_)) == SQLITE_DONE;
+StatementCache::Lease StatementCache::Get(string_view sql) {
+  auto found = index_.find(sql);
+  if (found != index_.end() && !found->second->leased &&
+      ScanVerdictStale(*found->second)) {
+    // Drop it, and prepare and check sql again below.
+    entries_.erase(found->second);
+    index_.erase(found);
+    found = index_.end();
+  }
+  if (found != index_.end() && !found->second->leased) {
+    ++hits_;
+    auto entry = found->second;
+    entries_.splice(entries_.begin(), entries_, entry);
+    entry->leased = true;
+    // Refused statements fail the same way every time, even after a Reset().
+    if (entry->refused) entry->stmt.rc_ = SQLITE_AUTH;
+    return Lease(this, entry);
+  }
+  ++misses_;
+  // Each sql is checked once per guard: a second lease of sql that is leased
+  // already takes the verdict of the first.
+  bool check = scan_guard_.has_value();
+  bool refused = false;
+  int64 schema_version = 0;
+  if (check && found != index_.end() &&
+      found->second->checked_under == guard_generation_ &&
+      !ScanVerdictStale(*found->second)) {
+    check = false;
+    refused = found->second->refused;
+    schema_version = found->second->schema_version;
+  }
+  Statement stmt(static_cast<sqlite3_stmt*>(nullptr));
+  if (!refused) stmt = Statement(db_, sql);
+  std::vector<ScanFinding> scans;
+  if (check && stmt.ok()) {
+    schema_version = SchemaVersion();
+    refused = !CheckScans(sql, stmt, &scans);
+  }
+  if (refused) {
+    // Refused statements can't be run, even after a Reset().
+    stmt = Statement(static_cast<sqlite3_stmt*>(nullptr));
+    stmt.rc_ = SQLITE_AUTH;
+  }
+  entries_.emplace_front(sql, std::move(stmt));
+  auto entry = entries_.begin();
+  entry->leased = true;
+  if (scan_guard_.has_value()) entry->checked_under = guard_generation_;
+  entry->refused = refused;
+  entry->schema_version = schema_version;
+  if (entry->stmt.stmt_ != nullptr) {
+    entry->reprepares = sqlite3_stmt_status(entry->stmt.stmt_,
+                                            SQLITE_STMTSTATUS_REPREPARE, 0);
+  }
+  // Only cache statements that compiled cleanly (refused ones included, to
+  // keep their verdict), and leave any outstanding lease of the same sql as
+  // the cached copy.
+  if (found == index_.end() && (entry->stmt.ok() || refused)) {
+    entry->cached = true;
+    index_.emplace(entry->sql, entry);
+    Evict();
+  }
+  Lease lease(this, entry);
+  // The verdict is kept even if reporting throws.
+  ReportScans(sql, scans);
+  return lease;
+}
+
+void StatementCache::Clear() {
+  for (auto entry = entries_.begin(); entry != entries_.end();) {
+    if (entry->leased) {
+      ++entry;
+      continue;
+    }
+    index_.erase(entry->sql);
+    entry = entries_.erase(entry);
+  }
+  sqlite3_finalize(schema_version_);
+  schema_version_ = nullptr;
+}
+
+void StatementCache::set_capacity(size_t capacity) {
+  capacity_ = capacity;
+  Evict();
+}
+
+void StatementCache::Return(EntryList::iterator entry) {
+  if (!entry->cached) {
+    entries_.erase(entry);
+    return;
+  }
+  if (!entry->refused) {
+    entry->stmt.Reset();
+    entry->stmt.ClearBinds();
+  }
+  entry->leased = false;
+  Evict();
+}
+
+bool StatementCache::ScanVerdictStale(const Entry& entry) {
+  if (entry.refused) {
+    return !scan_guard_.has_value() ||
+           entry.checked_under != guard_generation_ ||
+           entry.schema_version != SchemaVersion();
+  }
+  return scan_guard_.has_value() &&
+         sqlite3_stmt_status(entry.stmt.stmt_, SQLITE_STMTSTATUS_REPREPARE,
+                             0) != entry.reprepares;
+}
+
+int64 StatementCache::SchemaVersion() {
+  if (schema_version_ == nullptr &&
+      sqlite3_blocking_prepare_v2(db_, "PRAGMA schema_version;", -1,
+                                  &schema_version_, nullptr) != SQLITE_OK) {
+    return -1;
+  }
+  int64 version = -1;
+  if (sqlite3_blocking_step(schema_version_) == SQLITE_ROW) {
+    version = sqlite3_column_int64(schema_version_, 0);
+  }
+  sqlite3_reset(schema_version_);
+  return version;
+}
+
+void StatementCache::Evict() {
+  // Walk from the least recently leased end, skipping entries that are still
+  // in use; those are evicted when they come back if we are still over.
+  auto entry = entries_.end();
+  while (index_.size() > capacity_ && entry != entries_.begin()) {
+    --entry;
+    if (entry->leased || !entry->cached) continue;
+    index_.erase(entry->sql);
+    entry = entries_.erase(entry);
+    ++evictions_;
+  }
+}
+
+bool StatementCache::CheckScans(string_view sql, const Statement& stmt,
+                                std::vector<ScanFinding>* scans) {
+  std::vector<PlanNode> plan;
+  if (sqlite3_stmt_isexplain(stmt.stmt_) ||
+      stmt.ExplainQueryPlan(&plan) != SQLITE_OK) {
+    return true;
+  }
+  const ScanGuard& guard = *scan_guard_;
+  std::vector<string> tokens;
+  bool passes = true;
+  std::function<void(const PlanNode&)> check = [&](const PlanNode& node) {
+    for (const auto& child : node.children) check(child);
+    if (!node.IsFullScan()) return;
+    auto [schema, name] = SplitSchema(node.scanned());
+    // The plan names the alias if there is one, so look for the table before
+    // it in the sql: "table alias", "table AS alias" or "schema.table alias".
+    if (tokens.empty()) tokens = Tokenize(sql);
+    string table;
+    int64 rows = -1;
+    for (size_t i = 1; rows < 0 && i < tokens.size(); ++i) {
+      if (!SameIdentifier(tokens[i], name)) continue;
+      size_t j = i - 1;
+      if (SameIdentifier(tokens[j], "AS")) {
+        if (j == 0) continue;
+        --j;
+      }
+      const string& candidate = tokens[j];
+      if (sqlite3_keyword_check(candidate.data(),
+                                static_cast<int>(candidate.size())) ||
+          !IsIdentifierChar(candidate[0])) {
+        continue;
+      }
+      string_view candidate_schema =
+          j >= 2 && tokens[j - 1] == "." ? string_view(tokens[j - 2]) : schema;
+      rows = CountRows(db_, candidate_schema, candidate, guard.max_rows);
+      if (rows >= 0) table = candidate;
+    }
+    if (rows < 0) {
+      rows = CountRows(db_, schema, name, guard.max_rows);
+      table = string(name);
+    }
+    if (rows <= guard.max_rows) return;
+    passes = false;
+    scans->push_back({std::move(table), node});
+  };
+  for (const auto& node : plan) check(node);
+  return passes || !guard.reject;
+}
+
+void StatementCache::ReportScans(string_view sql,
+                                 const std::vector<ScanFinding>& scans) {
+  if (scans.empty()) return;
+  const ScanGuard& guard = *scan_guard_;
+  for (const auto& found : scans) {
+    if (guard.report) {
+      guard.report(sql, found.table, found.scan);
+    } else {
+      sqlite3_log(SQLITE_WARNING,
+                  "full scan of %s, with more than %lld rows, in: %.*s",
+                  found.table.c_str(), static_cast<long long>(guard.max_rows),
+                  static_cast<int>(sql.size()), sql.data());
+    }
+  }
+}
+
+Transaction::Transaction(StatementCache& cache, TransactionMode mode)
+    : cache_(&cache) {
+  string_view begin = kBeginDeferred;
+  if (mode == TransactionMode::kImmediate) begin = kBeginImmediate;
+  if (mode == TransactionMode::kExclusive) begin = kBeginExclusive;
+  active_ = Run(begin);
+}
+
+Transaction::~Transaction() {
+  if (active_) Rollback();
+}
+
+bool Transaction::Commit() {
+  Run(kCommit);
+  UpdateActive();
+  return ok();
+}
+
+bool Transaction::Rollback() {
+  Run(kRollback);
+  UpdateActive();
+  return ok();
+}
+
+bool Transaction::Run(string_view sql) {
+  rc_ = RunCached(cache_, sql);
+  return ok();
+}
+
+void Transaction::UpdateActive() {
+  // A failed COMMIT may leave the transaction open, and some errors roll it
+  // back automatically, so the connection is the authority on whether it is.
+  active_ = !sqlite3_get_autocommit(cache_->db());
+}
+
+Savepoint::Savepoint(StatementCache& cache) : cache_(&cache) {
+  active_ = Run(kSavepoint);
+}
+
+Savepoint::~Savepoint() {
+  if (active_) Rollback();
+}
+
+bool Savepoint::Release() {
+  if (Run(kRelease)) active_ = false;
+  return ok();
+}
+
+bool Savepoint::Rollback() {
+  // ROLLBACK TO leaves the savepoint on the stack, so it is released after.
+  if (Run(kRollbackTo) && Run(kRelease)) active_ = false;
+  // If the enclosing transaction was rolled back entirely, so was this.
+  if (sqlite3_get_autocommit(cache_->db())) active_ = false;
+  return ok();
+}
+
+bool Savepoint::Run(string_view sql) {
+  rc_ = RunCached(cache_, sql);
+  return ok();
+}
+
+Database::Database(const string& path, const TuningProfile& profile,
+                   int flags) {
+  rc_ = sqlite3_open_v2(path.c_str(), &db_, flags, nullptr);
+  if (rc_ == SQLITE_OK) rc_ = Apply(profile);
+  if (rc_ != SQLITE_OK) {
+    // A handle is usually allocated even when opening fails.
+    sqlite3_close(db_);
+    db_ = nullptr;
+  }
+}
+
+Database::Database(Database&& move_from) noexcept
+    : db_(move_from.db_),
+      tuning_(std::move(move_from.tuning_)),
+      rc_(move_from.rc_) {
+  move_from.db_ = nullptr;
+}
+
+Database& Database::operator=(Database&& move_from) noexcept {
+  if (this != &move_from) {
+    sqlite3_close(db_);
+    db_ = move_from.db_;
+    tuning_ = std::move(move_from.tuning_);
+    rc_ = move_from.rc_;
+    move_from.db_ = nullptr;
+  }
+  return *this;
+}
+
+Database::~Database() { sqlite3_close(db_); }
+
+int Database::Apply(const TuningProfile& profile) {
+  auto set = [this](const char* pragma, const string& value) {
+    return ExecRC(db_, string("PRAGMA ") + pragma + "=" + value + ";");
+  };
+  int rc = SQLITE_OK;
+  if (profile.page_size >= 0) {
+    rc = set("page_size", std::to_string(profile.page_size));
+  }
+  if (rc == SQLITE_OK && profile.journal_mode != nullptr) {
+    rc = set("journal_mode", profile.journal_mode);
+  }
+  if (rc == SQLITE_OK && profile.synchronous >= 0) {
+    rc = set("synchronous", std::to_string(profile.synchronous));
+  }
+  // Negative cache sizes are meaningful, so only -1 is left alone.
+  if (rc == SQLITE_OK && profile.cache_size != -1) {
+    rc = set("cache_size", std::to_string(profile.cache_size));
+  }
+  if (rc == SQLITE_OK && profile.mmap_size >= 0) {
+    rc = set("mmap_size", std::to_string(profile.mmap_size));
+  }
+  if (rc == SQLITE_OK && profile.temp_store >= 0) {
+    rc = set("temp_store", std::to_string(profile.temp_store));
+  }
+  if (rc != SQLITE_OK) return rc;
+
+  auto get = [this, &rc](const char* pragma, auto* value) {
+    using Value = std::remove_pointer_t<decltype(value)>;
+    Statement stmt(db_, string("PRAGMA ") + pragma + ";");
+    auto row = stmt.GetRow<Value>();
+    if (row.has_value()) {
+      *value = std::get<0>(*row);
+    } else if (!stmt.done()) {
+      rc = stmt.rc();
+    }
+  };
+  get("page_size", &tuning_.page_size);
+  get("journal_mode", &tuning_.journal_mode);
+  get("synchronous", &tuning_.synchronous);
+  get("cache_size", &tuning_.cache_size);
+  get("mmap_size", &tuning_.mmap_size);
+  get("temp_store", &tuning_.temp_store);
+  return rc;
+}
+
+int ConfigureGlobalMemory(const GlobalMemoryConfig& config) {
+  // sqlite uses the page cache arena until it is shut down and reconfigured,
+  // so it is kept for the life of the process.
+  static std::unique_ptr<char[]> page_cache;
+  int rc = SQLITE_OK;
+  if (config.page_cache_pages > 0) {
+    // Each slot holds a page and the cache's header for it.
+    int header = 0;
+    rc = sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header);
+    if (rc != SQLITE_OK) return rc;
+    int slot_size = config.page_size + header;
+    std::unique_ptr<char[]> arena(
+        new char[size_t(slot_size) * config.page_cache_pages]);
+    rc = sqlite3_config(SQLITE_CONFIG_PAGECACHE, arena.get(), slot_size,
+                        config.page_cache_pages);
+    if (rc != SQLITE_OK) return rc;
+    page_cache = std::move(arena);
+  }
+  if (config.lookaside_slots >= 0) {
+    rc = sqlite3_config(SQLITE_CONFIG_LOOKASIDE, config.lookaside_slot_size,
+                        config.lookaside_slots);
+  }
+  return rc;
 }
 
 }  // namespace sqlite
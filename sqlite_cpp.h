@@ -10,12 +10,23 @@
 **    May you share freely, never taking more than you give.
 */
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "sqlite3.h"
 #include "sqlite_blocking.h"
@@ -24,6 +35,14 @@ namespace sqlite {
 
 using int64 = sqlite3_int64;
 
+// Clock for deadlines on waits for locks held by other connections.
+using Clock = std::chrono::steady_clock;
+
+// A reasonable policy for retrying when the database is busy; install it with
+// sqlite3_blocking_busy_backoff().
+inline constexpr sqlite3_blocking_backoff kDefaultBusyBackoff = {
+    /*initialUs=*/100, /*maxSleepUs=*/20000, /*maxWaitUs=*/5000000};
+
 // Replace these to change the implementation used
 // (for example, absl::string_view)
 using string = std::string;
@@ -61,208 +80,821 @@ class Text : public string {
   }
 };
 
+// A list of values bound to a single parameter and read back in sql through
+// the cpp_array() table-valued function (see RegisterArrayFunction()), so one
+// statement serves lists of any length:
+//
+//   SELECT name FROM users WHERE id IN cpp_array(?);
+//
+// T is int64, double, string_view (read as blobs) or TextView (read as text).
+// Like other views, the values are not copied unless bound with BindCopy() or
+// SetCopy(), and must then outlive the statement's use of them.
+//
+// Example:
+//
+// std::vector<int64> ids = ...;
+// stmt.Bind(ArrayParam(ids));
+template <typename T>
+class ArrayParam {
+ public:
+  static_assert(std::is_same_v<T, int64> || std::is_same_v<T, double> ||
+                    std::is_same_v<T, string_view> ||
+                    std::is_same_v<T, TextView>,
+                "arrays hold int64, double, string_view or TextView");
+
+  ArrayParam(const T* data, size_t size) noexcept : data_(data), size_(size) {}
+  // From any contiguous container of T, such as std::vector or std::array.
+  template <typename Container,
+            typename = std::enable_if_t<std::is_same_v<
+                std::remove_cv_t<std::remove_pointer_t<decltype(
+                    std::data(std::declval<const Container&>()))>>,
+                T>>>
+  ArrayParam(const Container& values) noexcept
+      : data_(std::data(values)), size_(std::size(values)) {}
+
+  inline const T* data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+ private:
+  const T* data_;
+  size_t size_;
+};
+
+template <typename Container>
+ArrayParam(const Container&)
+    -> ArrayParam<std::remove_cv_t<std::remove_pointer_t<decltype(
+        std::data(std::declval<const Container&>()))>>>;
+
+// Registers the cpp_array() table-valued function on db, which yields the
+// values of an ArrayParam bound to its argument as column "value". Must be
+// called on each connection before preparing statements that use it. Returns
+// the sqlite return code (rc).
+int RegisterArrayFunction(sqlite3* db);
+
+// A parameter value binding a blob of size zero bytes, reserving space that
+// can then be written incrementally with a Blob or BlobStream.
+struct ZeroBlob {
+  int64 size;
+};
+
 // Only thrown by output iterators.
 struct SqliteException : public std::runtime_error {
   using runtime_error::runtime_error;
 };
 
+// Thrown by batched output iterators. rows_committed is the number of rows
+// that were committed before the failure; the rows of the failed batch were
+// rolled back.
+struct BatchSinkException : public SqliteException {
+  BatchSinkException(const char* what, int64 rows_committed)
+      : SqliteException(what), rows_committed(rows_committed) {}
+
+  int64 rows_committed;
+};
+
+// Compares equal to any of a Statement's row iterators that has reached the
+// end of its rows, for use with algorithms that take an iterator and a
+// sentinel (such as std::ranges ones). The ranges' own end() iterators work
+// too, and compare equal to this themselves.
+struct RowSentinel {};
+
+namespace detail {
+
+// What the row iterators' postfix ++ returns: a copy of the value they moved
+// past, so that *it++ works as C++17 input iterators require.
+template <typename Value>
+class PostIncrement {
+ public:
+  explicit PostIncrement(Value value) : value_(std::move(value)) {}
+  const Value& operator*() const { return value_; }
+
+ private:
+  Value value_;
+};
+
+}  // namespace detail
+
+// Specialize RowFields for a struct to read and bind it as a whole row: kFields
+// lists pointers to its members in column order. The struct must be default
+// constructible. Rows<MyStruct>() then yields MyStruct rather than a tuple,
+// and MyStruct can be passed wherever a tuple of parameters can (BindTuple(),
+// Sink(), BatchSink()).
+//
+// Example:
+//
+// struct User {
+//   int64 id;
+//   string name;
+//   std::optional<int> age;
+// };
+// template <>
+// struct sqlite::RowFields<User> {
+//   static constexpr auto kFields = std::make_tuple(&User::id, &User::name,
+//                                                   &User::age);
+// };
+template <typename Struct>
+struct RowFields;
+
+// Bump allocator for column values read by Statement::Rows(RowArena&, ...).
+// Reset() makes all of its memory available again without freeing it, so an
+// arena that is reset between pages of results stops allocating once it has
+// grown to fit a page.
+class RowArena {
+ public:
+  static constexpr size_t kDefaultBlockSize = 64 << 10;
+
+  explicit RowArena(size_t block_size = kDefaultBlockSize)
+      : block_size_(block_size) {}
+  RowArena(const RowArena&) = delete;
+  RowArena& operator=(const RowArena&) = delete;
+
+  // Returns bytes of uninitialized, unaligned storage valid until Reset().
+  inline char* Allocate(size_t bytes) {
+    if (current_ < blocks_.size() &&
+        blocks_[current_].size - used_ >= bytes) {
+      char* result = blocks_[current_].data.get() + used_;
+      used_ += bytes;
+      return result;
+    }
+    return AllocateSlow(bytes);
+  }
+
+  // Copies size bytes from data into the arena.
+  inline string_view Copy(const char* data, size_t size) {
+    if (size == 0) return string_view();
+    char* copy = Allocate(size);
+    std::char_traits<char>::copy(copy, data, size);
+    return string_view(copy, size);
+  }
+
+  // Invalidates everything allocated so far, keeping the memory for reuse.
+  inline void Reset() {
+    current_ = 0;
+    used_ = 0;
+  }
+
+  // Total bytes of memory held by the arena.
+  size_t capacity() const;
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  char* AllocateSlow(size_t bytes);
+
+  size_t block_size_;
+  std::vector<Block> blocks_;
+  // Index of the block being allocated from, and how much of it is used.
+  size_t current_ = 0;
+  size_t used_ = 0;
+};
+
+// An owned, copyable list of parameter values, for capturing the arguments of
+// a Bind() call to replay later, perhaps on another thread. Integers, doubles,
+// text (TextView, Text or C strings), blobs (anything else convertible to
+// string_view), null (std::nullopt or an empty std::optional) and ZeroBlob are
+// packed one after another into a single buffer, which is stored inline when
+// it is small enough, so a pack and each of its copies take at most one
+// allocation.
+//
+// Example:
+//
+// ParamPack params(id, TextView(name), std::nullopt);
+// queue.push_back(std::move(params));
+// ...
+// stmt.Bind(queue.front());
+// stmt.Run();
+class ParamPack {
+ public:
+  static constexpr size_t kInlineCapacity = 96;
+
+  ParamPack() noexcept {}
+  template <typename... Params>
+  explicit ParamPack(const Params&... params) {
+    Reserve((EncodedSize(params) + ... + 0));
+    (Add(params), ...);
+  }
+  ParamPack(const ParamPack& copy_from);
+  ParamPack& operator=(const ParamPack& copy_from);
+  ParamPack(ParamPack&& move_from) noexcept;
+  ParamPack& operator=(ParamPack&& move_from) noexcept;
+  ~ParamPack() = default;
+
+  // Appends a value, to be bound to the next parameter.
+  template <typename T>
+  ParamPack& Add(const T& value) {
+    if constexpr (std::is_same_v<T, std::nullopt_t>) {
+      Append(Tag::kNull, nullptr, 0);
+    } else if constexpr (IsOptional<T>::value) {
+      if (value.has_value()) return Add(*value);
+      Append(Tag::kNull, nullptr, 0);
+    } else if constexpr (std::is_same_v<T, ZeroBlob>) {
+      Append(Tag::kZeroBlob, &value.size, sizeof(value.size));
+    } else if constexpr (std::is_same_v<T, TextView> ||
+                         std::is_same_v<T, Text>) {
+      AppendBytes(Tag::kText, TextView(value));
+    } else if constexpr (std::is_same_v<std::decay_t<T>, const char*> ||
+                         std::is_same_v<std::decay_t<T>, char*>) {
+      // As Bind() does, C strings (and string literals) are text.
+      AppendBytes(Tag::kText, TextView(value));
+    } else if constexpr (std::is_convertible_v<const T&, string_view> &&
+                         !std::is_pointer_v<std::decay_t<T>>) {
+      AppendBytes(Tag::kBlob, value);
+    } else if constexpr (std::is_integral_v<T>) {
+      int64 integer = value;
+      Append(Tag::kInt, &integer, sizeof(integer));
+    } else if constexpr (std::is_floating_point_v<T>) {
+      double real = value;
+      Append(Tag::kDouble, &real, sizeof(real));
+    } else {
+      static_assert(sizeof(T) == 0, "type cannot be packed as a parameter");
+    }
+    return *this;
+  }
+
+  // Binds each value to the parameter at its position, returning the sqlite
+  // return code (rc). Unless copied, text and blobs are read from the pack
+  // when the statement is evaluated, so it must outlive that use.
+  int Bind(sqlite3_stmt* stmt, bool copy = false) const;
+
+  // Removes every value, keeping the buffer.
+  inline void Clear() {
+    size_ = 0;
+    count_ = 0;
+  }
+
+  // Number of values.
+  inline int size() const { return count_; }
+  inline bool empty() const { return count_ == 0; }
+  // Bytes of the buffer in use.
+  inline size_t bytes() const { return size_; }
+
+ private:
+  enum class Tag : char { kInt, kDouble, kText, kBlob, kNull, kZeroBlob };
+
+  template <typename T>
+  struct IsOptional : std::false_type {};
+  template <typename T>
+  struct IsOptional<std::optional<T>> : std::true_type {};
+
+  // Bytes Add(value) appends.
+  template <typename T>
+  static constexpr size_t EncodedSize(const T& value) {
+    if constexpr (std::is_same_v<T, std::nullopt_t>) {
+      return 1;
+    } else if constexpr (IsOptional<T>::value) {
+      return value.has_value() ? EncodedSize(*value) : 1;
+    } else if constexpr (std::is_same_v<T, TextView> ||
+                         std::is_same_v<T, Text> ||
+                         std::is_convertible_v<const T&, string_view>) {
+      return 1 + sizeof(size_t) +
+             (std::is_same_v<T, Text> ? TextView(value).size()
+                                      : string_view(value).size());
+    } else {
+      return 1 + 8;
+    }
+  }
+
+  inline char* data() { return heap_ ? heap_.get() : inline_; }
+  inline const char* data() const { return heap_ ? heap_.get() : inline_; }
+  // Grows the buffer to hold at least capacity bytes.
+  void Reserve(size_t capacity);
+  void Append(Tag tag, const void* payload, size_t size);
+  void AppendBytes(Tag tag, string_view bytes);
+
+  std::unique_ptr<char[]> heap_;
+  size_t capacity_ = kInlineCapacity;
+  size_t size_ = 0;
+  int count_ = 0;
+  char inline_[kInlineCapacity];
+};
+
 namespace detail {
 
 // Non-null empty-string surrogate.
 constexpr static char kNothing = 0;
 
-// Template archetype for reading columns. This must be in a struct because, as
-// they only vary on return type, they cannot be deduced except by partial
-// specialization. (This lets us use optional<> for nullable easily.)
-template <typename Col>
-struct ColumnReader;
+// Reads a result column, for SourceReader.
+struct ColumnSource {
+  sqlite3_stmt* stmt;
+  int position;
+
+  int type() const { return sqlite3_column_type(stmt, position); }
+  int64 int64_value() const { return sqlite3_column_int64(stmt, position); }
+  int int_value() const { return sqlite3_column_int(stmt, position); }
+  double double_value() const { return sqlite3_column_double(stmt, position); }
+  const void* blob() const { return sqlite3_column_blob(stmt, position); }
+  const unsigned char* text() const {
+    return sqlite3_column_text(stmt, position);
+  }
+  int bytes() const { return sqlite3_column_bytes(stmt, position); }
+};
+
+// Template archetype for reading values from a Source, which is ColumnSource
+// for columns and has the same members for function arguments (see
+// sqlite_function.h), so both read the same types the same way. This must be
+// in a struct because, as they only vary on return type, they cannot be
+// deduced except by partial specialization. (This lets us use optional<> for
+// nullable easily.)
+template <typename T>
+struct SourceReader;
 
 template <>
-struct ColumnReader<int64> {
-  static int64 Read(sqlite3_stmt* stmt, int position) {
-    return sqlite3_column_int64(stmt, position);
+struct SourceReader<int64> {
+  template <typename Source>
+  static int64 Read(const Source& source) {
+    return source.int64_value();
   }
 };
 
 template <>
-struct ColumnReader<long> {
-  static long Read(sqlite3_stmt* stmt, int position) {
-    return sqlite3_column_int64(stmt, position);
+struct SourceReader<long> {
+  template <typename Source>
+  static long Read(const Source& source) {
+    return source.int64_value();
   }
 };
 
 template <>
-struct ColumnReader<int> {
-  static int Read(sqlite3_stmt* stmt, int position) {
-    return sqlite3_column_int(stmt, position);
+struct SourceReader<int> {
+  template <typename Source>
+  static int Read(const Source& source) {
+    return source.int_value();
   }
 };
 
 template <>
-struct ColumnReader<double> {
-  static double Read(sqlite3_stmt* stmt, int position) {
-    return sqlite3_column_double(stmt, position);
+struct SourceReader<double> {
+  template <typename Source>
+  static double Read(const Source& source) {
+    return source.double_value();
   }
 };
 
 template <>
-struct ColumnReader<string> {
-  static string Read(sqlite3_stmt* stmt, int position) {
-    return string(
-        reinterpret_cast<const char*>(sqlite3_column_blob(stmt, position)),
-        sqlite3_column_bytes(stmt, position));
+struct SourceReader<string_view> {
+  template <typename Source>
+  static string_view Read(const Source& source) {
+    // The pointer must be fetched before the size.
+    auto* data = static_cast<const char*>(source.blob());
+    return string_view(data, source.bytes());
   }
 };
 
 template <>
-struct ColumnReader<string_view> {
-  static string_view Read(sqlite3_stmt* stmt, int position) {
-    return string_view(
-        reinterpret_cast<const char*>(sqlite3_column_blob(stmt, position)),
-        sqlite3_column_bytes(stmt, position));
+struct SourceReader<string> {
+  template <typename Source>
+  static string Read(const Source& source) {
+    return string(SourceReader<string_view>::Read(source));
   }
 };
 
 template <>
-struct ColumnReader<Text> {
-  static Text Read(sqlite3_stmt* stmt, int position) {
-    return Text(
-        reinterpret_cast<const char*>(sqlite3_column_text(stmt, position)),
+struct SourceReader<TextView> {
+  template <typename Source>
+  static TextView Read(const Source& source) {
+    auto* data = reinterpret_cast<const char*>(source.text());
+    return TextView(data, source.bytes());
+  }
+};
+
+template <>
+struct SourceReader<Text> {
+  template <typename Source>
+  static Text Read(const Source& source) {
+    TextView text = SourceReader<TextView>::Read(source);
+    return Text(text.data(), text.size());
+  }
+};
+
+template <typename Nullable>
+struct SourceReader<std::optional<Nullable>> {
+  template <typename Source>
+  static std::optional<Nullable> Read(const Source& source) {
+    if (source.type() == SQLITE_NULL) {
+      return std::nullopt;
+    } else {
+      return SourceReader<Nullable>::Read(source);
+    }
+  }
+};
+
+// Reads result columns as Col.
+template <typename Col>
+struct ColumnReader {
+  static Col Read(sqlite3_stmt* stmt, int position) {
+    return SourceReader<Col>::Read(ColumnSource{stmt, position});
+  }
+};
+
+// Assigns columns into existing values. Strings are assigned in place so that
+// their capacity is reused from row to row; everything else is read as usual.
+// A null resets its optional, so its string's capacity is not kept.
+template <typename Col>
+struct ColumnAssigner {
+  static void Assign(sqlite3_stmt* stmt, int position, Col& out) {
+    out = ColumnReader<Col>::Read(stmt, position);
+  }
+};
+
+template <>
+struct ColumnAssigner<string> {
+  static void Assign(sqlite3_stmt* stmt, int position, string& out) {
+    out.assign(
+        reinterpret_cast<const char*>(sqlite3_column_blob(stmt, position)),
         sqlite3_column_bytes(stmt, position));
   }
 };
 
 template <>
-struct ColumnReader<TextView> {
-  static TextView Read(sqlite3_stmt* stmt, int position) {
-    return TextView(
+struct ColumnAssigner<Text> {
+  static void Assign(sqlite3_stmt* stmt, int position, Text& out) {
+    out.assign(
         reinterpret_cast<const char*>(sqlite3_column_text(stmt, position)),
         sqlite3_column_bytes(stmt, position));
   }
 };
 
 template <typename Nullable>
-struct ColumnReader<std::optional<Nullable>> {
-  static std::optional<Nullable> Read(sqlite3_stmt* stmt, int position) {
+struct ColumnAssigner<std::optional<Nullable>> {
+  static void Assign(sqlite3_stmt* stmt, int position,
+                     std::optional<Nullable>& out) {
     if (sqlite3_column_type(stmt, position) == SQLITE_NULL) {
-      return std::nullopt;
-    } else {
-      return ColumnReader<Nullable>::Read(stmt, position);
+      out.reset();
+      return;
     }
+    if (!out.has_value()) out.emplace();
+    ColumnAssigner<Nullable>::Assign(stmt, position, *out);
   }
 };
 
-// Base case and variadic extension for reading entire rows.
-template <int Pos, typename Col, typename... Rest>
+template <typename Row, typename = void>
+struct IsMappedRow : std::false_type {};
+
+template <typename Row>
+struct IsMappedRow<Row, std::void_t<decltype(RowFields<Row>::kFields)>>
+    : std::true_type {};
+
+template <typename Row>
+constexpr size_t kNumFields =
+    std::tuple_size_v<std::decay_t<decltype(RowFields<Row>::kFields)>>;
+
+// The type of the field a member pointer points to.
+template <typename MemberPointer>
+struct MemberType;
+
+template <typename Struct, typename Member>
+struct MemberType<Member Struct::*> {
+  using type = Member;
+};
+
+template <typename Row, size_t Pos>
+using FieldType = typename MemberType<std::decay_t<
+    decltype(std::get<Pos>(RowFields<Row>::kFields))>>::type;
+
+template <typename Row, size_t... Pos>
+void DoReadFields(sqlite3_stmt* stmt, Row& row, std::index_sequence<Pos...>) {
+  (ColumnAssigner<FieldType<Row, Pos>>::Assign(
+       stmt, Pos, row.*std::get<Pos>(RowFields<Row>::kFields)),
+   ...);
+}
+
+// Reads the current row into the fields of a mapped struct, in place.
+template <typename Row>
+void ReadFields(sqlite3_stmt* stmt, Row& row) {
+  DoReadFields(stmt, row, std::make_index_sequence<kNumFields<Row>>());
+}
+
+template <typename... Cols, size_t... Pos>
+void DoAssignTuple(sqlite3_stmt* stmt, std::tuple<Cols...>& row,
+                   std::index_sequence<Pos...>) {
+  (ColumnAssigner<Cols>::Assign(stmt, Pos, std::get<Pos>(row)), ...);
+}
+
+// Reads the current row into an existing tuple or mapped struct.
+template <typename Row>
+void AssignRow(sqlite3_stmt* stmt, Row& row) {
+  static_assert(IsMappedRow<Row>::value,
+                "rows must be tuples or have a RowFields specialization");
+  // Reading an unmapped row would only add errors after the one above.
+  if constexpr (IsMappedRow<Row>::value) ReadFields(stmt, row);
+}
+
+template <typename... Cols>
+void AssignRow(sqlite3_stmt* stmt, std::tuple<Cols...>& row) {
+  DoAssignTuple(stmt, row, std::index_sequence_for<Cols...>());
+}
+
+template <typename... Cols, size_t... Pos>
+std::tuple<Cols...> DoReadRow(sqlite3_stmt* stmt,
+                              std::index_sequence<Pos...>) {
+  // Braced initialization reads the columns in order.
+  return std::tuple<Cols...>{ColumnReader<Cols>::Read(stmt, Pos)...};
+}
+
+// Reads entire rows. A row of a single mapped struct is read as that struct
+// rather than as a tuple.
+template <typename... Cols>
 struct RowReader {
-  static std::tuple<Col> Read(sqlite3_stmt* stmt) {
-    return {ColumnReader<Col>::Read(stmt, Pos)};
+  using Row = std::tuple<Cols...>;
+
+  static Row Read(sqlite3_stmt* stmt) {
+    // Result columns are zero-indexed!
+    return DoReadRow<Cols...>(stmt, std::index_sequence_for<Cols...>());
+  }
+};
+
+template <typename Col>
+struct RowReader<Col> {
+  using Row =
+      std::conditional_t<IsMappedRow<Col>::value, Col, std::tuple<Col>>;
+
+  static Row Read(sqlite3_stmt* stmt) {
+    if constexpr (IsMappedRow<Col>::value) {
+      Row row{};
+      ReadFields(stmt, row);
+      return row;
+    } else {
+      return Row{ColumnReader<Col>::Read(stmt, 0)};
+    }
+  }
+};
+
+// The type of the rows read by GetRow<Cols...>() and Rows<Cols...>().
+template <typename... Cols>
+using RowOf = typename RowReader<Cols...>::Row;
+
+template <typename... Cols>
+RowOf<Cols...> ReadRow(sqlite3_stmt* stmt) {
+  return RowReader<Cols...>::Read(stmt);
+}
+
+// Column readers that copy string_view and TextView values into an arena,
+// so that they outlive the current row. Other types read as usual.
+template <typename Col>
+struct ArenaColumnReader {
+  static Col Read(sqlite3_stmt* stmt, int position, RowArena& /*arena*/) {
+    return ColumnReader<Col>::Read(stmt, position);
+  }
+};
+
+template <>
+struct ArenaColumnReader<string_view> {
+  static string_view Read(sqlite3_stmt* stmt, int position, RowArena& arena) {
+    return arena.Copy(
+        reinterpret_cast<const char*>(sqlite3_column_blob(stmt, position)),
+        sqlite3_column_bytes(stmt, position));
+  }
+};
+
+template <>
+struct ArenaColumnReader<TextView> {
+  static TextView Read(sqlite3_stmt* stmt, int position, RowArena& arena) {
+    return TextView(arena.Copy(
+        reinterpret_cast<const char*>(sqlite3_column_text(stmt, position)),
+        sqlite3_column_bytes(stmt, position)));
   }
 };
 
-template <int Pos, typename Col, typename More, typename... Rest>
-struct RowReader<Pos, Col, More, Rest...> {
-  static std::tuple<Col, More, Rest...> Read(sqlite3_stmt* stmt) {
-    return std::tuple_cat(std::tuple<Col>(ColumnReader<Col>::Read(stmt, Pos)),
-                          RowReader<Pos + 1, More, Rest...>::Read(stmt));
+template <typename Nullable>
+struct ArenaColumnReader<std::optional<Nullable>> {
+  static std::optional<Nullable> Read(sqlite3_stmt* stmt, int position,
+                                      RowArena& arena) {
+    if (sqlite3_column_type(stmt, position) == SQLITE_NULL) {
+      return std::nullopt;
+    } else {
+      return ArenaColumnReader<Nullable>::Read(stmt, position, arena);
+    }
   }
 };
 
-// Wrapper function to bake in the starting index.
+template <typename... Cols, size_t... Pos>
+std::tuple<Cols...> DoReadRowInArena(sqlite3_stmt* stmt, RowArena& arena,
+                                     std::index_sequence<Pos...>) {
+  // Braced initialization reads the columns in order.
+  return std::tuple<Cols...>{
+      ArenaColumnReader<Cols>::Read(stmt, Pos, arena)...};
+}
+
 template <typename... Cols>
-std::tuple<Cols...> ReadRow(sqlite3_stmt* stmt) {
+std::tuple<Cols...> ReadRowInArena(sqlite3_stmt* stmt, RowArena& arena) {
   // Result columns are zero-indexed!
-  return RowReader<0, Cols...>::Read(stmt);
+  return DoReadRowInArena<Cols...>(stmt, arena,
+                                   std::index_sequence_for<Cols...>());
 }
 
-// Templates for binding values to columns. CopyOnBind, where relevant,
-// determines whether sqlite is instructed to eagerly copy byte buffers as soon
-// as the call occurs (true) or whether it will only read the buffers when the
-// statement is evaluated (false).
+// Binds a parameter, for PutValue. CopyOnBind, where relevant, determines
+// whether sqlite is instructed to eagerly copy byte buffers as soon as the call
+// occurs (true) or whether it will only read the buffers when the statement is
+// evaluated (false).
 template <bool CopyOnBind>
-int BindParam(sqlite3_stmt* stmt, int position, int64 param) {
-  return sqlite3_bind_int64(stmt, position, param);
+struct ParamTarget {
+  sqlite3_stmt* stmt;
+  int position;
+
+  static sqlite3_destructor_type copy_mode() {
+    if constexpr (CopyOnBind) {
+      return SQLITE_TRANSIENT;
+    } else {
+      return SQLITE_STATIC;
+    }
+  }
+
+  int SetInt64(int64 value) const {
+    return sqlite3_bind_int64(stmt, position, value);
+  }
+  int SetInt(int value) const {
+    return sqlite3_bind_int(stmt, position, value);
+  }
+  int SetDouble(double value) const {
+    return sqlite3_bind_double(stmt, position, value);
+  }
+  int SetBlob(const void* data, size_t size) const {
+    return sqlite3_bind_blob64(stmt, position, data, size, copy_mode());
+  }
+  int SetText(const char* data, size_t size) const {
+    return sqlite3_bind_text64(stmt, position, data, size, copy_mode(),
+                               SQLITE_UTF8);
+  }
+  int SetZeroBlob(sqlite3_uint64 size) const {
+    return sqlite3_bind_zeroblob64(stmt, position, size);
+  }
+  int SetNull() const { return sqlite3_bind_null(stmt, position); }
+  int SetValue(sqlite3_value* value) const {
+    return sqlite3_bind_value(stmt, position, value);
+  }
+};
+
+// Templates for putting values into a Target, which is ParamTarget for
+// parameters and has the same members for function results (see
+// sqlite_function.h), so both take the same types the same way.
+template <typename Target>
+auto PutValue(const Target& target, int64 value) {
+  return target.SetInt64(value);
 }
 
-template <bool CopyOnBind>
-int BindParam(sqlite3_stmt* stmt, int position, long param) {
-  return sqlite3_bind_int64(stmt, position, param);
+template <typename Target>
+auto PutValue(const Target& target, long value) {
+  return target.SetInt64(value);
 }
 
-template <bool CopyOnBind>
-int BindParam(sqlite3_stmt* stmt, int position, int param) {
-  return sqlite3_bind_int(stmt, position, param);
+template <typename Target>
+auto PutValue(const Target& target, int value) {
+  return target.SetInt(value);
 }
 
-template <bool CopyOnBind>
-int BindParam(sqlite3_stmt* stmt, int position, double param) {
-  return sqlite3_bind_double(stmt, position, param);
+template <typename Target>
+auto PutValue(const Target& target, double value) {
+  return target.SetDouble(value);
 }
 
-template <bool CopyOnBind>
-int BindParam(sqlite3_stmt* stmt, int position, string_view param) {
-  if (param.empty()) {
-    return sqlite3_bind_zeroblob(stmt, position, 0);
-  }
-  sqlite3_destructor_type copy_mode;
-  if constexpr (CopyOnBind) {
-    copy_mode = SQLITE_TRANSIENT;
-  } else {
-    copy_mode = SQLITE_STATIC;
-  }
-  return sqlite3_bind_blob64(stmt, position, param.data(), param.size(),
-                             copy_mode);
+template <typename Target>
+auto PutValue(const Target& target, string_view value) {
+  if (value.empty()) return target.SetZeroBlob(0);
+  return target.SetBlob(value.data(), value.size());
 }
 
-template <bool CopyOnBind>
-int BindParam(sqlite3_stmt* stmt, int position, TextView param) {
-  sqlite3_destructor_type copy_mode;
-  if constexpr (CopyOnBind) {
-    copy_mode = SQLITE_TRANSIENT;
-  } else {
-    copy_mode = SQLITE_STATIC;
-  }
+template <typename Target>
+auto PutValue(const Target& target, const string& value) {
+  return PutValue(target, string_view(value));
+}
+
+template <typename Target>
+auto PutValue(const Target& target, TextView value) {
   // Force a non-null pointer to avoid binding SQL NULL. For BLOB types we use
   // bind_zeroblob but there is no good equivalent to this that produces a TEXT
   // value.
-  return sqlite3_bind_text64(stmt, position,
-                             (param.empty() ? &kNothing : param.data()),
-                             param.size(), copy_mode, SQLITE_UTF8);
+  return target.SetText(value.empty() ? &kNothing : value.data(), value.size());
 }
 
-template <bool CopyOnBind>
-int BindParam(sqlite3_stmt* stmt, int position, std::nullopt_t) {
-  return sqlite3_bind_null(stmt, position);
+template <typename Target>
+auto PutValue(const Target& target, const Text& value) {
+  return PutValue(target, TextView(value));
+}
+
+template <typename Target>
+auto PutValue(const Target& target, const char* value) {
+  return PutValue(target, TextView(value));
 }
 
-template <bool CopyOnBind, typename Nullable>
-int BindParam(sqlite3_stmt* stmt, int position,
-              const std::optional<Nullable>& param) {
-  if (!param.has_value()) return sqlite3_bind_null(stmt, position);
-  return BindParam<CopyOnBind>(stmt, position, *param);
+template <typename Target>
+auto PutValue(const Target& target, ZeroBlob value) {
+  return target.SetZeroBlob(value.size);
+}
+
+template <typename Target>
+auto PutValue(const Target& target, std::nullopt_t) {
+  return target.SetNull();
+}
+
+template <typename Target>
+auto PutValue(const Target& target, sqlite3_value* value) {
+  return target.SetValue(value);
+}
+
+template <typename Target, typename Nullable>
+auto PutValue(const Target& target, const std::optional<Nullable>& value) {
+  if (!value.has_value()) return target.SetNull();
+  return PutValue(target, *value);
+}
+
+// Binds a value to a parameter.
+template <bool CopyOnBind, typename Param>
+int BindParam(sqlite3_stmt* stmt, int position, const Param& param) {
+  return PutValue(ParamTarget<CopyOnBind>{stmt, position}, param);
+}
+
+// Element types of the arrays bound by BindArray().
+enum class ArrayType { kInt64, kDouble, kBlob, kText };
+
+template <typename T>
+constexpr ArrayType kArrayTypeOf =
+    std::is_same_v<T, int64>
+        ? ArrayType::kInt64
+        : std::is_same_v<T, double>
+              ? ArrayType::kDouble
+              : std::is_same_v<T, TextView> ? ArrayType::kText
+                                             : ArrayType::kBlob;
+
+// Binds a pointer to size values of the given type for cpp_array() to read,
+// copying them first if copy is set.
+int BindArray(sqlite3_stmt* stmt, int position, ArrayType type,
+              const void* data, size_t size, bool copy);
+
+template <bool CopyOnBind, typename T>
+int BindParam(sqlite3_stmt* stmt, int position, const ArrayParam<T>& param) {
+  return BindArray(stmt, position, kArrayTypeOf<T>, param.data(), param.size(),
+                   CopyOnBind);
 }
 
 // Binds params from a tuple or other std::get-decomposable argument.
 template <bool CopyOnBind, int Pos = 0, typename Tuple>
 int DoBindTupleParams(sqlite3_stmt* stmt, const Tuple& params) {
-  // Params are one-indexed! so we add 1 to Pos
-  int rc = BindParam<CopyOnBind>(stmt, Pos + 1, std::get<Pos>(params));
-  if (rc != SQLITE_OK) return rc;
-  if constexpr (Pos + 1 < std::tuple_size<Tuple>::value) {
-    return DoBindTupleParams<CopyOnBind, Pos + 1, Tuple>(stmt, params);
-  } else {
+  if constexpr (std::tuple_size<Tuple>::value == 0) {
     return SQLITE_OK;
+  } else {
+    // Params are one-indexed! so we add 1 to Pos
+    int rc = BindParam<CopyOnBind>(stmt, Pos + 1, std::get<Pos>(params));
+    if (rc != SQLITE_OK) return rc;
+    if constexpr (Pos + 1 < std::tuple_size<Tuple>::value) {
+      return DoBindTupleParams<CopyOnBind, Pos + 1, Tuple>(stmt, params);
+    } else {
+      return SQLITE_OK;
+    }
+  }
+}
+
+// Binds params from the fields of a mapped struct, in order.
+template <bool CopyOnBind, typename Row, size_t... Pos>
+int DoBindFields(sqlite3_stmt* stmt, const Row& params,
+                 std::index_sequence<Pos...>) {
+  int rc = SQLITE_OK;
+  // Stops at the first error.
+  ((rc = BindParam<CopyOnBind>(stmt, Pos + 1,
+                               params.*std::get<Pos>(RowFields<Row>::kFields)),
+    rc == SQLITE_OK) &&
+   ...);
+  return rc;
+}
+
+template <bool CopyOnBind, typename Tuple>
+int BindRowParams(sqlite3_stmt* stmt, const Tuple& params) {
+  if constexpr (IsMappedRow<Tuple>::value) {
+    return DoBindFields<CopyOnBind>(
+        stmt, params, std::make_index_sequence<kNumFields<Tuple>>());
+  } else {
+    return DoBindTupleParams<CopyOnBind>(stmt, params);
   }
 }
 
 template <typename Tuple>
 int BindTupleParams(sqlite3_stmt* stmt, const Tuple& params) {
-  return DoBindTupleParams<false>(stmt, params);
+  return BindRowParams<false>(stmt, params);
 }
 
 template <typename Tuple>
 int BindTupleParamsCopy(sqlite3_stmt* stmt, const Tuple& params) {
-  return DoBindTupleParams<true>(stmt, params);
+  return BindRowParams<true>(stmt, params);
+}
+
+// Binds element row of each column to the corresponding parameter, without
+// copying strings.
+template <typename... Columns, size_t... Pos>
+int DoBindColumnsAt(sqlite3_stmt* stmt, size_t row,
+                    std::index_sequence<Pos...>, const Columns&... columns) {
+  int rc = SQLITE_OK;
+  // Stops at the first error.
+  ((rc = BindParam<false>(stmt, Pos + 1, columns[row]), rc == SQLITE_OK) &&
+   ...);
+  return rc;
+}
+
+template <typename... Columns>
+int BindColumnsAt(sqlite3_stmt* stmt, size_t row, const Columns&... columns) {
+  return DoBindColumnsAt(stmt, row, std::index_sequence_for<Columns...>(),
+                         columns...);
 }
 
 inline int ColIndex(sqlite3_stmt* stmt, const char* name) {
@@ -271,63 +903,279 @@ inline int ColIndex(sqlite3_stmt* stmt, const char* name) {
 inline int ColIndex(sqlite3_stmt* stmt, const string& name) {
   return sqlite3_bind_parameter_index(stmt, name.data());
 }
-inline int ColIndex(sqlite3_stmt* stmt, int index) { return index; }
+inline int ColIndex(sqlite3_stmt* /*stmt*/, int index) { return index; }
+
+// Converts a deadline to the representation used by sqlite_blocking.
+inline int64 DeadlineMicros(Clock::time_point deadline) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             deadline.time_since_epoch())
+      .count();
+}
 
 }  // namespace detail
 
-// Execute a script that may contain multiple statements, ignoring any result
-// rows. Returns the sqlite return code (rc).
-int ExecRC(sqlite3* db, string_view script);
+// Column-oriented buffers filled by Statement::FetchBatch(). Each buffer keeps
+// its allocations when it is cleared, so reusing a ColumnBatch for every batch
+// of a query stops allocating once it has grown to the batch size.
+template <typename Col>
+class ColumnBuffer;
 
-// Execute a script that may contain multiple statements, ignoring any result
-// rows. Returns true if there is no error code.
-inline bool Exec(sqlite3* db, string_view script) {
-  return ExecRC(db, script) == SQLITE_OK;
-}
+// A contiguous array of numbers. NULLs read as zero.
+template <typename Number>
+class NumericColumnBuffer {
+ public:
+  inline size_t size() const { return values_.size(); }
+  inline const Number* data() const { return values_.data(); }
+  inline Number operator[](size_t i) const { return values_[i]; }
+  inline const std::vector<Number>& values() const { return values_; }
+
+  inline void Clear() { values_.clear(); }
+  inline void Reserve(size_t rows) { values_.reserve(rows); }
+  inline void Append(sqlite3_stmt* stmt, int position) {
+    values_.push_back(detail::ColumnReader<Number>::Read(stmt, position));
+  }
+  inline void AppendNull() { values_.push_back(Number()); }
 
-class Statement {
  private:
-  template <typename... Cols>
-  friend class RowIterator;
-  template <typename... Cols>
-  friend class Rowset;
-  template <typename... Cols>
-  class Rowset;
-  class SinkIterator;
-  class SinkCopyIterator;
+  std::vector<Number> values_;
+};
 
- public:
-  Statement(sqlite3* db, string_view sql, bool must_compile_all = true);
-  Statement(const Statement&) = delete;
-  Statement& operator=(const Statement&) = delete;
-  Statement(Statement&& move_from) noexcept;
-  Statement& operator=(Statement&& move_from) noexcept;
-  ~Statement();
+template <>
+class ColumnBuffer<int64> : public NumericColumnBuffer<int64> {};
+template <>
+class ColumnBuffer<long> : public NumericColumnBuffer<long> {};
+template <>
+class ColumnBuffer<int> : public NumericColumnBuffer<int> {};
+template <>
+class ColumnBuffer<double> : public NumericColumnBuffer<double> {};
 
-  inline void Reset() {
-    sqlite3_reset(stmt_);
-    rc_ = stmt_ == nullptr ? SQLITE_ERROR : SQLITE_OK;
+// The bytes of every value stored end to end in one arena, with the value at
+// row i spanning offsets()[i] to offsets()[i + 1]. NULLs read as empty.
+// View is string_view for blob columns and TextView for text columns.
+template <typename View>
+class ArenaColumnBuffer {
+ public:
+  inline size_t size() const { return offsets_.size() - 1; }
+  inline View operator[](size_t i) const {
+    return View(arena_.data() + offsets_[i], offsets_[i + 1] - offsets_[i]);
   }
+  inline const string& arena() const { return arena_; }
+  inline const std::vector<size_t>& offsets() const { return offsets_; }
 
-  // Binds values to the statement, returning false if an error occurs. String
-  // values are copied.
-  template <typename... Params>
-  bool BindCopy(const Params&... params) {
-    Reset();
-    return (rc_ = detail::BindTupleParamsCopy(stmt_, std::tie(params...))) ==
-           SQLITE_OK;
+  inline void Clear() {
+    arena_.clear();
+    offsets_.resize(1);
   }
-
-  // Binds values to the statement, returning false if an error occurs. String
-  // values are copied.
-  template <typename TupleParams>
-  bool BindTupleCopy(const TupleParams& params) {
-    Reset();
-    return (rc_ = detail::BindTupleParamsCopy(stmt_, params)) == SQLITE_OK;
+  inline void Reserve(size_t rows) { offsets_.reserve(rows + 1); }
+  inline void Append(sqlite3_stmt* stmt, int position) {
+    // Which of these is called first decides the column's type conversion,
+    // and so the bytes it counts.
+    const char* data;
+    if constexpr (std::is_same_v<View, TextView>) {
+      data = reinterpret_cast<const char*>(sqlite3_column_text(stmt, position));
+    } else {
+      data = reinterpret_cast<const char*>(sqlite3_column_blob(stmt, position));
+    }
+    arena_.append(data == nullptr ? &detail::kNothing : data,
+                  sqlite3_column_bytes(stmt, position));
+    offsets_.push_back(arena_.size());
   }
+  inline void AppendNull() { offsets_.push_back(arena_.size()); }
 
-  // Binds values to the statement, returning false if an error occurs.
-  template <typename... Params>
+ private:
+  string arena_;
+  std::vector<size_t> offsets_ = {0};
+};
+
+template <>
+class ColumnBuffer<string> : public ArenaColumnBuffer<string_view> {};
+template <>
+class ColumnBuffer<Text> : public ArenaColumnBuffer<TextView> {};
+
+// Values of a nullable column, with a bitmap of which rows are not NULL.
+template <typename Nullable>
+class ColumnBuffer<std::optional<Nullable>> {
+ public:
+  inline size_t size() const { return values_.size(); }
+  inline bool valid(size_t i) const {
+    return (validity_[i / 64] >> (i % 64)) & 1;
+  }
+  // The values, where rows that are NULL hold a zero or empty value.
+  inline const ColumnBuffer<Nullable>& values() const { return values_; }
+  // Bit i % 64 of word i / 64 is set when row i is not NULL.
+  inline const std::vector<uint64_t>& validity() const { return validity_; }
+
+  inline void Clear() {
+    values_.Clear();
+    validity_.clear();
+  }
+  inline void Reserve(size_t rows) {
+    values_.Reserve(rows);
+    validity_.reserve((rows + 63) / 64);
+  }
+  inline void Append(sqlite3_stmt* stmt, int position) {
+    size_t row = size();
+    if (row % 64 == 0) validity_.push_back(0);
+    if (sqlite3_column_type(stmt, position) == SQLITE_NULL) {
+      values_.AppendNull();
+    } else {
+      validity_.back() |= uint64_t{1} << (row % 64);
+      values_.Append(stmt, position);
+    }
+  }
+  inline void AppendNull() {
+    if (size() % 64 == 0) validity_.push_back(0);
+    values_.AppendNull();
+  }
+
+ private:
+  ColumnBuffer<Nullable> values_;
+  std::vector<uint64_t> validity_;
+};
+
+// One ColumnBuffer per column of a query's results.
+//
+// Example:
+//
+// Statement stmt(db, "SELECT price, qty, note FROM orders;");
+// ColumnBatch<double, int64, std::optional<string>> batch;
+// while (stmt.FetchBatch(batch, 1024) > 0) {
+//   const double* prices = batch.column<0>().data();
+//   ...
+// }
+// if (!stmt.done()) cerr << "oh no! " << stmt.errstr() << endl;
+template <typename... Cols>
+class ColumnBatch {
+ public:
+  inline size_t size() const { return std::get<0>(columns_).size(); }
+
+  template <size_t I>
+  inline const auto& column() const {
+    return std::get<I>(columns_);
+  }
+
+  void Clear() {
+    std::apply([](auto&... column) { (column.Clear(), ...); }, columns_);
+  }
+  void Reserve(size_t rows) {
+    std::apply([rows](auto&... column) { (column.Reserve(rows), ...); },
+               columns_);
+  }
+  // Appends the current row of stmt.
+  void Append(sqlite3_stmt* stmt) {
+    AppendRow(stmt, std::index_sequence_for<Cols...>());
+  }
+
+ private:
+  template <size_t... Pos>
+  void AppendRow(sqlite3_stmt* stmt, std::index_sequence<Pos...>) {
+    // Result columns are zero-indexed!
+    (std::get<Pos>(columns_).Append(stmt, Pos), ...);
+  }
+
+  std::tuple<ColumnBuffer<Cols>...> columns_;
+};
+
+// One step of a query plan, as reported by EXPLAIN QUERY PLAN, with the steps
+// nested within it.
+struct PlanNode {
+  int id;
+  // What sqlite does at this step, such as "SCAN t" or
+  // "SEARCH t USING INDEX t_k (k=?)".
+  string detail;
+  std::vector<PlanNode> children;
+
+  // Whether this step reads every row of a table, rather than searching it or
+  // scanning an index. Scans of subqueries, virtual tables and constant rows
+  // don't count.
+  bool IsFullScan() const;
+  // The table (or alias) scanned by a full scan, as named in the plan.
+  string_view scanned() const;
+};
+
+template <const char* Sql, typename ParamList, typename ColList>
+class TypedStatement;
+class AsyncStatement;
+class QueryProfiler;
+
+// Execute a script that may contain multiple statements, ignoring any result
+// rows. Returns the sqlite return code (rc).
+int ExecRC(sqlite3* db, string_view script);
+
+// Execute a script that may contain multiple statements, ignoring any result
+// rows. Returns true if there is no error code.
+inline bool Exec(sqlite3* db, string_view script) {
+  return ExecRC(db, script) == SQLITE_OK;
+}
+
+class Statement {
+ private:
+  template <typename... Cols>
+  friend class RowIterator;
+  template <typename... Cols>
+  friend class Rowset;
+  template <typename... Cols>
+  class Rowset;
+  template <typename Row>
+  class RowIntoIterator;
+  template <typename Row>
+  class RowIntoRowset;
+  template <typename... Cols>
+  class ArenaRowIterator;
+  template <typename... Cols>
+  class ArenaRowset;
+  template <typename... Cols>
+  class ResumableRowIterator;
+  template <typename... Cols>
+  class ResumableRowset;
+  template <typename... Cols>
+  class ChunkIterator;
+  template <typename... Cols>
+  class ChunkedRowset;
+  class ResumePoint;
+  class SinkIterator;
+  class SinkCopyIterator;
+  class BatchWriter;
+  class BatchSinkIterator;
+  friend class StatementCache;
+  friend class PreparedScript;
+  friend class AsyncStatement;
+  friend class QueryProfiler;
+  template <const char* Sql, typename ParamList, typename ColList>
+  friend class TypedStatement;
+
+ public:
+  Statement(sqlite3* db, string_view sql, bool must_compile_all = true);
+  Statement(const Statement&) = delete;
+  Statement& operator=(const Statement&) = delete;
+  Statement(Statement&& move_from) noexcept;
+  Statement& operator=(Statement&& move_from) noexcept;
+  ~Statement();
+
+  inline void Reset() {
+    sqlite3_reset(stmt_);
+    rc_ = stmt_ == nullptr ? SQLITE_ERROR : SQLITE_OK;
+  }
+
+  // Binds values to the statement, returning false if an error occurs. String
+  // values are copied.
+  template <typename... Params>
+  bool BindCopy(const Params&... params) {
+    Reset();
+    return (rc_ = detail::BindTupleParamsCopy(stmt_, std::tie(params...))) ==
+           SQLITE_OK;
+  }
+
+  // Binds values to the statement, returning false if an error occurs. String
+  // values are copied.
+  template <typename TupleParams>
+  bool BindTupleCopy(const TupleParams& params) {
+    Reset();
+    return (rc_ = detail::BindTupleParamsCopy(stmt_, params)) == SQLITE_OK;
+  }
+
+  // Binds values to the statement, returning false if an error occurs.
+  template <typename... Params>
   bool Bind(const Params&... params) {
     Reset();
     return (rc_ = detail::BindTupleParams(stmt_, std::tie(params...))) ==
@@ -341,6 +1189,20 @@ class Statement {
     return (rc_ = detail::BindTupleParams(stmt_, params)) == SQLITE_OK;
   }
 
+  // Binds the values of a ParamPack, returning false if an error occurs.
+  // Text and blobs are copied only by BindCopy(); otherwise the pack must
+  // outlive the statement's use of them, so a temporary can't be bound.
+  inline bool Bind(const ParamPack& params) {
+    Reset();
+    return (rc_ = params.Bind(stmt_)) == SQLITE_OK;
+  }
+  bool Bind(ParamPack&& params) = delete;
+
+  inline bool BindCopy(const ParamPack& params) {
+    Reset();
+    return (rc_ = params.Bind(stmt_, true)) == SQLITE_OK;
+  }
+
   // Bind a specific named or numbered parameter to the statement. The name can
   // be a string, a "C string literal", or an int giving the column number.
   template <typename Name, typename Value>
@@ -359,13 +1221,21 @@ class Statement {
                                            value)) == SQLITE_OK;
   }
 
+  // Returns the index of a named parameter, or 0 if there is no such
+  // parameter. Looking the index up once and passing it to Set() avoids
+  // looking the name up on every bind.
+  inline int ParamIndex(const char* name) const {
+    return sqlite3_bind_parameter_index(stmt_, name);
+  }
+
   // Resets all the bindings of the statement to null.
   void ClearBinds();
 
   // Advances the statement to read a row if present. If there are no more rows
-  // or there is an error, returns nullopt.
+  // or there is an error, returns nullopt. GetRow<MyStruct>() returns a
+  // mapped struct; see RowFields.
   template <typename... Cols>
-  std::optional<std::tuple<Cols...>> GetRow() {
+  std::optional<detail::RowOf<Cols...>> GetRow() {
     rc_ = sqlite3_blocking_step(stmt_);
     if (rc_ == SQLITE_ROW) {
       return detail::ReadRow<Cols...>(stmt_);
@@ -373,6 +1243,49 @@ class Statement {
     return std::nullopt;
   }
 
+  // As GetRow(), but stops waiting for locks held by other connections at the
+  // deadline, in which case rc() is SQLITE_BUSY.
+  template <typename... Cols>
+  std::optional<detail::RowOf<Cols...>> GetRow(Clock::time_point deadline) {
+    rc_ = sqlite3_blocking_step_until(stmt_, detail::DeadlineMicros(deadline));
+    if (rc_ == SQLITE_ROW) {
+      return detail::ReadRow<Cols...>(stmt_);
+    }
+    return std::nullopt;
+  }
+
+  // Advances the statement and reads the row, if present, into an existing
+  // tuple or mapped struct (see RowFields). String columns are assigned in
+  // place, reusing their capacity. Returns false if there are no more rows or
+  // there is an error.
+  template <typename Row>
+  bool ReadInto(Row& row) {
+    rc_ = sqlite3_blocking_step(stmt_);
+    if (rc_ != SQLITE_ROW) return false;
+    detail::AssignRow(stmt_, row);
+    return true;
+  }
+
+  // Clears batch and advances the statement over up to max_rows rows,
+  // appending them to batch. Returns the number of rows read, which is less
+  // than max_rows once there are no more rows or an error occurs; check done()
+  // to tell which. After that, further calls return 0 until the statement is
+  // reset.
+  template <typename... Cols>
+  size_t FetchBatch(ColumnBatch<Cols...>& batch, size_t max_rows) {
+    batch.Clear();
+    // Stepping a finished statement would start it over.
+    if (rc_ != SQLITE_OK && rc_ != SQLITE_ROW) return 0;
+    batch.Reserve(max_rows);
+    size_t rows = 0;
+    while (rows < max_rows &&
+           (rc_ = sqlite3_blocking_step(stmt_)) == SQLITE_ROW) {
+      batch.Append(stmt_);
+      ++rows;
+    }
+    return rows;
+  }
+
   // Resets and runs a statement expecting no returned rows. Returns false if an
   // error occurs or a row was returned.
   bool Run();
@@ -394,16 +1307,173 @@ class Statement {
   //   cout << name << " is alive and " << age << " years old" << endl;
   // }
   // if (!stmt.done()) cerr << "oh no! " << stmt.errstr() << endl;
+  //
+  // If a shared-cache lock has to be waited for after some rows were yielded,
+  // iteration stops with rc() SQLITE_LOCKED rather than restarting the query
+  // and yielding those rows again; see ResumableRows().
   template <typename... Cols>
   Rowset<Cols...> Rows() {
     return Rowset<Cols...>(this);
   }
 
+  // Like Rows(), but every row is read into row, a tuple or mapped struct
+  // (see RowFields), and the iterator yields a reference to it. String columns
+  // are assigned in place, so once their capacity has grown to fit the rows
+  // reading them stops allocating.
+  //
+  // Example:
+  //
+  // std::tuple<int64, string> row;
+  // for (const auto& [id, name] : stmt.RowsInto(row)) {
+  //   cout << id << ": " << name << endl;
+  // }
+  template <typename Row>
+  RowIntoRowset<Row> RowsInto(Row& row) {
+    return RowIntoRowset<Row>(this, &row);
+  }
+
+  // Like Rows(), but string_view and TextView columns are copied into arena so
+  // that they stay valid after the statement moves on, without allocating a
+  // string per value. If page_rows is nonzero the arena is reset whenever
+  // page_rows more rows have been read, so the values of a row stay valid
+  // until then; otherwise they stay valid until the caller resets the arena.
+  //
+  // Example:
+  //
+  // RowArena arena;
+  // std::vector<std::tuple<int64, TextView>> page;
+  // for (const auto& row : stmt.Rows<int64, TextView>(arena, 1000)) {
+  //   page.push_back(row);
+  //   if (page.size() == 1000) {
+  //     Export(page);
+  //     page.clear();
+  //   }
+  // }
+  // Export(page);
+  template <typename... Cols>
+  ArenaRowset<Cols...> Rows(RowArena& arena, size_t page_rows = 0) {
+    return ArenaRowset<Cols...>(this, &arena, page_rows);
+  }
+
+  // Like Rows(), but when a shared-cache lock has to be waited for partway
+  // through, waits for it and then resumes after the last row yielded. The
+  // query must be ordered by a unique key which it selects as column
+  // key_column (zero-indexed) and must only select rows after the key bound to
+  // parameter key_param (a name or one-based index). Before iterating, bind
+  // that parameter to a value below the first key. Resuming rebinds it, so
+  // rebind it before iterating again from the start.
+  //
+  // Iteration still stops with rc() SQLITE_LOCKED if waiting would deadlock.
+  //
+  // Example:
+  //
+  // Statement stmt(db, "SELECT id, name FROM users WHERE id > ? ORDER BY id;");
+  // stmt.Bind(std::numeric_limits<int64>::min());
+  // for (const auto& [id, name] : stmt.ResumableRows<int64, string>(0, 1)) {
+  //   cout << id << ": " << name << endl;
+  // }
+  template <typename... Cols, typename Name>
+  ResumableRowset<Cols...> ResumableRows(int key_column, Name key_param) {
+    return ResumableRowset<Cols...>(this, key_column,
+                                    detail::ColIndex(stmt_, key_param));
+  }
+
+  // Like Rows(), but yields the rows in vectors of up to chunk_rows at a time,
+  // for handing to batch consumers (or parallel algorithms) without collecting
+  // every row first. The last chunk may be short.
+  //
+  // Example:
+  //
+  // auto batch = insert.BatchSink(1000);
+  // for (const auto& chunk : select.Chunks<int64, string>(1000)) {
+  //   std::copy(chunk.begin(), chunk.end(), batch.Sink());
+  // }
+  // batch.Finish();
+  template <typename... Cols>
+  ChunkedRowset<Cols...> Chunks(size_t chunk_rows) {
+    return ChunkedRowset<Cols...>(this, chunk_rows);
+  }
+
+  // Runs the statement once for each index of the given columns, binding
+  // parameter i to element index of the i-th column. Columns are any
+  // containers with size() and operator[], such as std::vector or std::array,
+  // and must all be the same size; otherwise rc() is SQLITE_RANGE and nothing
+  // is run. Values are bound straight from the columns without copying, and
+  // the statement is reset once per row; the bindings are cleared before
+  // returning, so none are left pointing into the columns.
+  //
+  // Unless the connection is already in a transaction, all the rows are run
+  // in one new transaction that is rolled back if any row fails. Its control
+  // statements are prepared the first time and kept with the statement.
+  // Returns false if an error occurs or a row was returned.
+  //
+  // Example:
+  //
+  // std::vector<int64> ids = ...;
+  // std::vector<double> scores = ...;
+  // std::vector<string_view> names = ...;
+  // Statement stmt(db,
+  //                "INSERT INTO features(id, score, name) VALUES (?, ?, ?);");
+  // if (!stmt.ExecuteMany(ids, scores, names)) cerr << stmt.errstr() << endl;
+  template <typename Column, typename... Columns>
+  bool ExecuteMany(const Column& column, const Columns&... columns) {
+    size_t rows = column.size();
+    if (((columns.size() != rows) || ...)) {
+      rc_ = SQLITE_RANGE;
+      return false;
+    }
+    bool own_transaction = false;
+    if (!BeginMany(&own_transaction)) return false;
+    for (size_t row = 0; row < rows; ++row) {
+      sqlite3_reset(stmt_);
+      rc_ = detail::BindColumnsAt(stmt_, row, column, columns...);
+      if (rc_ != SQLITE_OK) break;
+      rc_ = sqlite3_blocking_step(stmt_);
+      if (rc_ != SQLITE_DONE) break;
+    }
+    return EndMany(own_transaction);
+  }
+
   // Returns an output iterator for any kind of tuple that can be bound to this
   // statement. A SqliteException will be thrown if the statement fails to run
   // or returns a row.
   inline SinkIterator Sink() { return SinkIterator(this); }
 
+  // Returns a writer that inserts rows in transactions of batch_size rows,
+  // binding each row exactly once and resetting the statement once per row.
+  // Rows must bind every parameter of the statement, since bindings are not
+  // cleared between rows. The connection must not already be in a
+  // transaction.
+  //
+  // Rows are written through the writer's Sink() output iterator, which
+  // throws a BatchSinkException carrying the number of committed rows if a
+  // row or a commit fails. Finish() must be called to commit the final
+  // partial batch; if the writer is destroyed first, that batch is rolled
+  // back. Invalidated when the Statement is moved or destroyed.
+  //
+  // Example:
+  //
+  // Statement stmt(db, "INSERT INTO users(name, age) VALUES (?, ?);");
+  // auto batch = stmt.BatchSink(1000);
+  // std::copy(users.begin(), users.end(), batch.Sink());
+  // if (!batch.Finish()) cerr << "oh no! " << batch.errstr() << endl;
+  inline BatchWriter BatchSink(int64 batch_size) {
+    return BatchWriter(this, batch_size);
+  }
+
+  // Fills plan with the steps sqlite plans to take to run the statement, from
+  // EXPLAIN QUERY PLAN. Does not affect the statement itself. Returns the
+  // sqlite return code (rc).
+  //
+  // Example:
+  //
+  // std::vector<PlanNode> plan;
+  // stmt.ExplainQueryPlan(&plan);
+  // for (const auto& step : plan) {
+  //   if (step.IsFullScan()) cerr << "scans " << step.scanned() << endl;
+  // }
+  int ExplainQueryPlan(std::vector<PlanNode>* plan) const;
+
   inline bool ok() const { return rc_ == SQLITE_OK; }
   inline bool done() const { return rc_ == SQLITE_DONE; }
   inline int rc() const { return rc_; }
@@ -415,7 +1485,11 @@ class Statement {
   template <typename... Cols>
   class RowIterator {
    public:
-    using value_type = std::tuple<Cols...>;
+    using value_type = detail::RowOf<Cols...>;
+    using reference = value_type;
+    using pointer = void;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::input_iterator_tag;
 
     RowIterator() : s_(nullptr) {}
     explicit RowIterator(Statement* s) : s_(s) {}
@@ -424,10 +1498,26 @@ class Statement {
       s_->rc_ = sqlite3_blocking_step(s_->stmt_);
       return *this;
     }
-    value_type operator*() { return detail::ReadRow<Cols...>(s_->stmt_); }
+    detail::PostIncrement<value_type> operator++(int) {
+      detail::PostIncrement<value_type> old(**this);
+      ++*this;
+      return old;
+    }
+    value_type operator*() const {
+      return detail::ReadRow<Cols...>(s_->stmt_);
+    }
     bool operator!=(const RowIterator& other) const {
       return (s_ != other.s_) && !(stopped() && other.stopped());
     }
+    bool operator==(const RowIterator& other) const {
+      return !(*this != other);
+    }
+    friend bool operator==(const RowIterator& it, RowSentinel) {
+      return it.stopped();
+    }
+    friend bool operator!=(const RowIterator& it, RowSentinel) {
+      return !it.stopped();
+    }
 
    private:
     bool stopped() const { return s_ == nullptr || s_->rc() != SQLITE_ROW; }
@@ -454,6 +1544,348 @@ class Statement {
     Statement* s_;
   };
 
+  // Iterator for rows read into existing storage by a RowIntoRowset.
+  // Invalidated when the Statement is moved or destroyed.
+  template <typename Row>
+  class RowIntoIterator {
+   public:
+    using value_type = Row;
+    using reference = Row&;
+    using pointer = void;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::input_iterator_tag;
+
+    RowIntoIterator() : s_(nullptr), row_(nullptr) {}
+    RowIntoIterator(Statement* s, Row* row) : s_(s), row_(row) {}
+
+    RowIntoIterator& operator++() {
+      s_->ReadInto(*row_);
+      return *this;
+    }
+    detail::PostIncrement<value_type> operator++(int) {
+      detail::PostIncrement<value_type> old(**this);
+      ++*this;
+      return old;
+    }
+    Row& operator*() const { return *row_; }
+    bool operator!=(const RowIntoIterator& other) const {
+      return (s_ != other.s_) && !(stopped() && other.stopped());
+    }
+    bool operator==(const RowIntoIterator& other) const {
+      return !(*this != other);
+    }
+    friend bool operator==(const RowIntoIterator& it, RowSentinel) {
+      return it.stopped();
+    }
+    friend bool operator!=(const RowIntoIterator& it, RowSentinel) {
+      return !it.stopped();
+    }
+
+   private:
+    bool stopped() const { return s_ == nullptr || s_->rc() != SQLITE_ROW; }
+
+    Statement* s_;
+    Row* row_;
+  };
+
+  // Range for rows read into existing storage. Rerunnable when exhausted.
+  // Invalidated when the Statement is moved or destroyed.
+  template <typename Row>
+  class RowIntoRowset {
+   public:
+    RowIntoRowset(Statement* s, Row* row) : s_(s), row_(row) {}
+
+    RowIntoIterator<Row> begin() {
+      s_->Reset();
+      RowIntoIterator<Row> it(s_, row_);
+      ++it;
+      return it;
+    }
+    RowIntoIterator<Row> end() { return {}; }
+
+   private:
+    Statement* s_;
+    Row* row_;
+  };
+
+  // Iterator for rows produced by an ArenaRowset. Invalidated when the Rowset
+  // or Statement is moved or destroyed.
+  template <typename... Cols>
+  class ArenaRowIterator {
+   public:
+    using value_type = std::tuple<Cols...>;
+    using reference = value_type;
+    using pointer = void;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::input_iterator_tag;
+
+    ArenaRowIterator() : r_(nullptr) {}
+    explicit ArenaRowIterator(ArenaRowset<Cols...>* r) : r_(r) {}
+
+    ArenaRowIterator& operator++() {
+      r_->Advance();
+      return *this;
+    }
+    detail::PostIncrement<value_type> operator++(int) {
+      detail::PostIncrement<value_type> old(**this);
+      ++*this;
+      return old;
+    }
+    value_type operator*() const {
+      return detail::ReadRowInArena<Cols...>(r_->s_->stmt_, *r_->arena_);
+    }
+    bool operator!=(const ArenaRowIterator& other) const {
+      return (r_ != other.r_) && !(stopped() && other.stopped());
+    }
+    bool operator==(const ArenaRowIterator& other) const {
+      return !(*this != other);
+    }
+    friend bool operator==(const ArenaRowIterator& it, RowSentinel) {
+      return it.stopped();
+    }
+    friend bool operator!=(const ArenaRowIterator& it, RowSentinel) {
+      return !it.stopped();
+    }
+
+   private:
+    bool stopped() const {
+      return r_ == nullptr || r_->s_->rc() != SQLITE_ROW;
+    }
+
+    ArenaRowset<Cols...>* r_;
+  };
+
+  // Range for rows produced by a Statement whose strings are read into an
+  // arena. Rerunnable when exhausted. Invalidated when the Statement is moved
+  // or destroyed.
+  template <typename... Cols>
+  class ArenaRowset {
+   public:
+    ArenaRowset(Statement* s, RowArena* arena, size_t page_rows)
+        : s_(s), arena_(arena), page_rows_(page_rows) {}
+
+    ArenaRowIterator<Cols...> begin() {
+      s_->Reset();
+      arena_->Reset();
+      page_used_ = 0;
+      ArenaRowIterator<Cols...> it(this);
+      ++it;
+      return it;
+    }
+    ArenaRowIterator<Cols...> end() { return {}; }
+
+   private:
+    friend class ArenaRowIterator<Cols...>;
+
+    void Advance() {
+      s_->rc_ = sqlite3_blocking_step(s_->stmt_);
+      if (page_rows_ != 0 && page_used_++ == page_rows_) {
+        arena_->Reset();
+        page_used_ = 1;
+      }
+    }
+
+    Statement* s_;
+    RowArena* arena_;
+    size_t page_rows_;
+    // Rows read into the arena since it was last reset.
+    size_t page_used_ = 0;
+  };
+
+  // The key of the last row yielded by a ResumableRowset. Integer keys are
+  // kept without allocating.
+  class ResumePoint {
+   public:
+    ResumePoint() = default;
+    ResumePoint(const ResumePoint&) = delete;
+    ResumePoint& operator=(const ResumePoint&) = delete;
+    ~ResumePoint();
+
+    // Remembers the key of the current row of stmt.
+    void Remember(sqlite3_stmt* stmt, int column);
+    // Forgets the key and the count of resumes, for a new pass.
+    void Clear();
+    // Waits for the lock, then resumes the statement after the remembered key
+    // and sets *rc to its new rc. If the wait fails, as when it would
+    // deadlock, sets *rc to why and returns false without resuming.
+    bool Resume(sqlite3_stmt* stmt, int param, int* rc);
+
+    inline bool empty() const { return !has_key_; }
+    inline int64 resumes() const { return resumes_; }
+
+   private:
+    bool has_key_ = false;
+    int64 int_key_ = 0;
+    // Non-null if the key is not an integer.
+    sqlite3_value* value_key_ = nullptr;
+    int64 resumes_ = 0;
+  };
+
+  // Iterator for rows produced by a ResumableRowset. Invalidated when the
+  // Rowset or Statement is moved or destroyed.
+  template <typename... Cols>
+  class ResumableRowIterator {
+   public:
+    using value_type = detail::RowOf<Cols...>;
+    using reference = value_type;
+    using pointer = void;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::input_iterator_tag;
+
+    ResumableRowIterator() : r_(nullptr) {}
+    explicit ResumableRowIterator(ResumableRowset<Cols...>* r) : r_(r) {}
+
+    ResumableRowIterator& operator++() {
+      r_->Advance();
+      return *this;
+    }
+    detail::PostIncrement<value_type> operator++(int) {
+      detail::PostIncrement<value_type> old(**this);
+      ++*this;
+      return old;
+    }
+    value_type operator*() const {
+      return detail::ReadRow<Cols...>(r_->s_->stmt_);
+    }
+    bool operator!=(const ResumableRowIterator& other) const {
+      return (r_ != other.r_) && !(stopped() && other.stopped());
+    }
+    bool operator==(const ResumableRowIterator& other) const {
+      return !(*this != other);
+    }
+    friend bool operator==(const ResumableRowIterator& it, RowSentinel) {
+      return it.stopped();
+    }
+    friend bool operator!=(const ResumableRowIterator& it, RowSentinel) {
+      return !it.stopped();
+    }
+
+   private:
+    bool stopped() const {
+      return r_ == nullptr || r_->s_->rc() != SQLITE_ROW;
+    }
+
+    ResumableRowset<Cols...>* r_;
+  };
+
+  // Range for rows produced by a Statement that resumes after lock waits.
+  // Invalidated when the Statement is moved or destroyed.
+  template <typename... Cols>
+  class ResumableRowset {
+   public:
+    ResumableRowset(Statement* s, int key_column, int key_param)
+        : s_(s), key_column_(key_column), key_param_(key_param) {}
+
+    ResumableRowIterator<Cols...> begin() {
+      s_->Reset();
+      resume_.Clear();
+      ResumableRowIterator<Cols...> it(this);
+      ++it;
+      return it;
+    }
+    ResumableRowIterator<Cols...> end() { return {}; }
+
+    // Number of times the query was resumed after waiting for a lock, since
+    // iteration last began.
+    inline int64 resumes() const { return resume_.resumes(); }
+
+   private:
+    friend class ResumableRowIterator<Cols...>;
+
+    void Advance() {
+      if (s_->rc_ == SQLITE_ROW) resume_.Remember(s_->stmt_, key_column_);
+      s_->rc_ = sqlite3_blocking_step(s_->stmt_);
+      while (s_->rc_ == SQLITE_LOCKED && !resume_.empty()) {
+        if (!resume_.Resume(s_->stmt_, key_param_, &s_->rc_)) break;
+      }
+    }
+
+    Statement* s_;
+    int key_column_;
+    int key_param_;
+    ResumePoint resume_;
+  };
+
+  // Iterator for the chunks of rows produced by a ChunkedRowset. Invalidated
+  // when the Rowset or Statement is moved or destroyed.
+  template <typename... Cols>
+  class ChunkIterator {
+   public:
+    using value_type = std::vector<detail::RowOf<Cols...>>;
+    using reference = const value_type&;
+    using pointer = const value_type*;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::input_iterator_tag;
+
+    ChunkIterator() : r_(nullptr) {}
+    explicit ChunkIterator(ChunkedRowset<Cols...>* r) : r_(r) {}
+
+    ChunkIterator& operator++() {
+      r_->Advance();
+      return *this;
+    }
+    detail::PostIncrement<value_type> operator++(int) {
+      detail::PostIncrement<value_type> old(**this);
+      ++*this;
+      return old;
+    }
+    const value_type& operator*() const { return r_->chunk_; }
+    const value_type* operator->() const { return &r_->chunk_; }
+    bool operator!=(const ChunkIterator& other) const {
+      return (r_ != other.r_) && !(stopped() && other.stopped());
+    }
+    bool operator==(const ChunkIterator& other) const {
+      return !(*this != other);
+    }
+    friend bool operator==(const ChunkIterator& it, RowSentinel) {
+      return it.stopped();
+    }
+    friend bool operator!=(const ChunkIterator& it, RowSentinel) {
+      return !it.stopped();
+    }
+
+   private:
+    bool stopped() const { return r_ == nullptr || r_->chunk_.empty(); }
+
+    ChunkedRowset<Cols...>* r_;
+  };
+
+  // Range for the rows produced by a Statement, in vectors of up to
+  // chunk_rows rows. The vector is reused from chunk to chunk. Rerunnable when
+  // exhausted. Invalidated when the Statement is moved or destroyed.
+  template <typename... Cols>
+  class ChunkedRowset {
+   public:
+    ChunkedRowset(Statement* s, size_t chunk_rows)
+        : s_(s), chunk_rows_(std::max<size_t>(chunk_rows, 1)) {}
+
+    ChunkIterator<Cols...> begin() {
+      s_->Reset();
+      ChunkIterator<Cols...> it(this);
+      ++it;
+      return it;
+    }
+    ChunkIterator<Cols...> end() { return {}; }
+
+   private:
+    friend class ChunkIterator<Cols...>;
+
+    void Advance() {
+      chunk_.clear();
+      // Stepping a finished statement would start it over.
+      while (chunk_.size() < chunk_rows_ &&
+             (s_->rc_ == SQLITE_OK || s_->rc_ == SQLITE_ROW)) {
+        auto row = s_->GetRow<Cols...>();
+        if (!row.has_value()) break;
+        chunk_.push_back(std::move(*row));
+      }
+    }
+
+    Statement* s_;
+    size_t chunk_rows_;
+    std::vector<detail::RowOf<Cols...>> chunk_;
+  };
+
   // Converts assignments to this object into BindTuple calls on the wrapped
   // statement.
   class AssignBinder {
@@ -487,10 +1919,549 @@ class Statement {
     Statement* s_;
   };
 
+  // Writes rows to a Statement in batched transactions. Invalidated when the
+  // Statement is moved or destroyed.
+  class BatchWriter {
+   public:
+    BatchWriter(Statement* s, int64 batch_size);
+    BatchWriter(const BatchWriter&) = delete;
+    BatchWriter& operator=(const BatchWriter&) = delete;
+    ~BatchWriter();
+
+    // Binds and runs one row, committing when the batch is full. Throws a
+    // BatchSinkException if the row or the commit fails.
+    template <typename TupleCols>
+    void Write(const TupleCols& row) {
+      if (!open_) {
+        int rc = RunControl(begin_);
+        if (rc != SQLITE_DONE) Fail(rc);
+        open_ = true;
+      }
+      // The statement is always left reset after a row, so it can be bound
+      // directly.
+      int rc = detail::BindTupleParams(s_->stmt_, row);
+      if (rc == SQLITE_OK) rc = sqlite3_blocking_step(s_->stmt_);
+      sqlite3_reset(s_->stmt_);
+      s_->rc_ = rc;
+      if (rc != SQLITE_DONE) Fail(rc);
+      if (++pending_ >= batch_size_) Commit();
+    }
+
+    // Output iterator writing to this batch.
+    inline BatchSinkIterator Sink() { return BatchSinkIterator(this); }
+
+    // Commits any partially filled batch. Returns false if the commit failed,
+    // in which case that batch was rolled back.
+    bool Finish();
+
+    // Number of rows committed so far.
+    inline int64 committed() const { return committed_; }
+    // Number of rows written in the current, uncommitted batch.
+    inline int64 pending() const { return pending_; }
+    inline int rc() const { return rc_; }
+    inline string_view errstr() const { return sqlite3_errstr(rc_); }
+
+   private:
+    // Commits the current batch, throwing if that fails.
+    void Commit();
+    // Rolls back the current batch and throws.
+    [[noreturn]] void Fail(int rc);
+    bool CommitBatch();
+    void RollbackBatch();
+
+    Statement* s_;
+    int64 batch_size_;
+    int64 pending_ = 0;
+    int64 committed_ = 0;
+    int rc_ = SQLITE_OK;
+    // Whether a batch transaction is currently open.
+    bool open_ = false;
+    // Transaction control statements, prepared once per writer.
+    sqlite3_stmt* begin_ = nullptr;
+    sqlite3_stmt* commit_ = nullptr;
+    sqlite3_stmt* rollback_ = nullptr;
+  };
+
+  // Output iterator for a BatchWriter.
+  class BatchSinkIterator {
+   public:
+    explicit BatchSinkIterator(BatchWriter* w) : w_(w) {}
+
+    BatchSinkIterator& operator++() { return *this; }
+    BatchSinkIterator& operator*() { return *this; }
+    template <typename TupleCols>
+    BatchSinkIterator& operator=(const TupleCols& row) {
+      w_->Write(row);
+      return *this;
+    }
+
+   private:
+    BatchWriter* w_;
+  };
+
+  // Transaction control statements for ExecuteMany(), prepared the first time
+  // it runs outside a transaction and kept with the statement.
+  struct ManyControl {
+    ManyControl() = default;
+    ManyControl(const ManyControl&) = delete;
+    ManyControl& operator=(const ManyControl&) = delete;
+    ~ManyControl();
+
+    sqlite3_stmt* begin = nullptr;
+    sqlite3_stmt* commit = nullptr;
+    sqlite3_stmt* rollback = nullptr;
+  };
+
+  // Begins the transaction for ExecuteMany() if the connection is not in one
+  // already, setting *own_transaction if it did.
+  bool BeginMany(bool* own_transaction);
+  // Commits or, after an error, rolls back ExecuteMany()'s transaction.
+  bool EndMany(bool own_transaction);
+  // Runs and resets a transaction control statement, returning its rc.
+  static int RunControl(sqlite3_stmt* stmt);
+
+  // Takes ownership of an already prepared statement.
+  explicit Statement(sqlite3_stmt* stmt)
+      : stmt_(stmt), rc_(stmt == nullptr ? SQLITE_ERROR : SQLITE_OK) {}
+
   sqlite3_stmt* stmt_ = nullptr;
   int rc_ = 0;
+  std::unique_ptr<ManyControl> many_;
+};
+
+// A script of any number of statements that is split and prepared once and
+// then run repeatedly, for scripts that are executed over and over. Each
+// statement is prepared the first time a run reaches it, so statements may
+// depend on tables created earlier in the script; Prepare() prepares the rest
+// up front instead. Statements run in order, ignoring result rows, and keep
+// their parameter bindings between runs.
+//
+// Example:
+//
+// PreparedScript cleanup(db, R"sql(
+//   DELETE FROM sessions WHERE expires < ?;
+//   DELETE FROM tokens WHERE session NOT IN (SELECT id FROM sessions);
+// )sql");
+// cleanup.Prepare();
+// cleanup.statement(0).Bind(now);
+// if (!cleanup.Run()) cerr << "oh no! " << cleanup.errstr() << endl;
+class PreparedScript {
+ public:
+  PreparedScript(sqlite3* db, string_view script) : db_(db), script_(script) {}
+  PreparedScript(const PreparedScript&) = delete;
+  PreparedScript& operator=(const PreparedScript&) = delete;
+  PreparedScript(PreparedScript&&) = default;
+  PreparedScript& operator=(PreparedScript&&) = default;
+
+  // Runs every statement of the script in order, stopping at the first error.
+  // Returns false if an error occurs.
+  bool Run();
+
+  // Prepares every statement not yet prepared. Returns false if one fails to
+  // compile; it is tried again by the next Run() or Prepare().
+  bool Prepare();
+
+  // The number of statements prepared so far.
+  inline size_t size() const { return statements_.size(); }
+  // The i-th statement of the script (zero-indexed), for binding its
+  // parameters. Invalidated when more statements are prepared.
+  inline Statement& statement(size_t i) { return statements_[i]; }
+
+  inline bool ok() const { return rc_ == SQLITE_OK; }
+  inline int rc() const { return rc_; }
+  inline string_view errstr() const { return sqlite3_errstr(rc_); }
+
+ private:
+  // Prepares the next statement of the script, returning false if there are
+  // no more or an error occurs.
+  bool PrepareNext();
+
+  sqlite3* db_;
+  string script_;
+  // Offset in script_ of the first statement not yet prepared.
+  size_t prepared_to_ = 0;
+  std::vector<Statement> statements_;
+  int rc_ = SQLITE_OK;
+};
+
+// Checks made by a StatementCache on the plan of each statement it prepares,
+// to catch queries that read whole tables because no index serves them.
+struct ScanGuard {
+  // Full scans of tables with more rows than this are reported. Counting stops
+  // there, so checking a table reads at most this many rows.
+  int64 max_rows = 1000;
+  // Whether the Statement also fails, with SQLITE_AUTH as if an authorizer had
+  // refused it, rather than only being reported.
+  bool reject = false;
+  // Called with the sql, the table and the plan step of each full scan found.
+  // By default scans are logged with sqlite3_log() as SQLITE_WARNING. It may
+  // throw to abort the StatementCache::Get() that prepared sql.
+  std::function<void(string_view sql, string_view table, const PlanNode& scan)>
+      report;
+};
+
+// Per-connection LRU cache of prepared Statements keyed by their SQL text.
+// Statements are handed out as Leases, which return the Statement to the cache
+// when they are destroyed; returned Statements are reset and have their
+// bindings cleared, ready for the next user.
+//
+// If the same SQL is leased again while a previous lease of it is still
+// outstanding, a fresh uncached Statement is prepared for the second lease and
+// finalized when it is returned. Statements that fail to compile are never
+// cached.
+//
+// Not thread-safe; like the connection itself, a cache should only be used by
+// one thread at a time. All Leases must be returned before the cache is
+// destroyed, and the cache must be destroyed (or Clear()ed) before the
+// connection is closed.
+//
+// Example:
+//
+// StatementCache cache(db);
+// auto stmt = cache.Get("SELECT name FROM users WHERE id = ?;");
+// stmt->Bind(id);
+// auto row = stmt->GetRow<string>();
+class StatementCache {
+ private:
+  struct Entry;
+  using EntryList = std::list<Entry>;
+
+ public:
+  class Lease {
+   public:
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    Lease(Lease&& move_from) noexcept;
+    Lease& operator=(Lease&& move_from) noexcept;
+    ~Lease();
+
+    Statement& operator*() const { return entry_->stmt; }
+    Statement* operator->() const { return &entry_->stmt; }
+    Statement* get() const { return &entry_->stmt; }
+
+   private:
+    friend class StatementCache;
+    Lease(StatementCache* cache, EntryList::iterator entry)
+        : cache_(cache), entry_(entry) {}
+
+    StatementCache* cache_;
+    EntryList::iterator entry_;
+  };
+
+  static constexpr size_t kDefaultCapacity = 64;
+
+  explicit StatementCache(sqlite3* db, size_t capacity = kDefaultCapacity)
+      : db_(db), capacity_(capacity) {}
+  StatementCache(const StatementCache&) = delete;
+  StatementCache& operator=(const StatementCache&) = delete;
+  ~StatementCache();
+
+  // Leases a Statement compiled from sql, preparing it only if no idle cached
+  // Statement for the same text is available. The whole of sql must compile
+  // to exactly one statement, as with must_compile_all.
+  Lease Get(string_view sql);
+
+  // Finalizes every idle cached Statement. Leased Statements are unaffected.
+  void Clear();
+
+  // Changes the capacity, evicting idle Statements if necessary.
+  void set_capacity(size_t capacity);
+
+  // Checks the plans of statements prepared from now on with guard, or stops
+  // checking them with nullopt. Each sql is checked when it is prepared, not
+  // on every Get(). Refused sql is cached like any other, as a Statement that
+  // fails with SQLITE_AUTH without being prepared or reported again, until
+  // the guard is set again, the schema changes or it is evicted. A cached
+  // Statement that sqlite has had to reprepare since it was prepared, as after
+  // a schema change, is checked again the next time it is leased. Tables are
+  // found by name, or through their alias in sql; tables read through views
+  // are not checked.
+  inline void set_scan_guard(std::optional<ScanGuard> guard) {
+    scan_guard_ = std::move(guard);
+    ++guard_generation_;
+  }
+
+  inline sqlite3* db() const { return db_; }
+  inline size_t capacity() const { return capacity_; }
+  // Number of cached Statements, including those currently leased.
+  inline size_t size() const { return index_.size(); }
+  inline int64 hits() const { return hits_; }
+  inline int64 misses() const { return misses_; }
+  inline int64 evictions() const { return evictions_; }
+
+ private:
+  struct Entry {
+    Entry(string_view sql_text, Statement&& prepared)
+        : sql(sql_text), stmt(std::move(prepared)) {}
+
+    const string sql;
+    Statement stmt;
+    bool leased = false;
+    // Whether this entry is reachable from index_. Uncached entries are
+    // finalized as soon as they are returned.
+    bool cached = false;
+    // The guard_generation_ sql was checked under, or zero if it wasn't.
+    int64 checked_under = 0;
+    // Whether the guard refused sql, leaving stmt failed with SQLITE_AUTH.
+    bool refused = false;
+    // The schema version sql was refused under.
+    int64 schema_version = 0;
+    // How many times sqlite had reprepared stmt when it was prepared.
+    int reprepares = 0;
+  };
+
+  // A full scan found by CheckScans().
+  struct ScanFinding {
+    string table;
+    PlanNode scan;
+  };
+
+  void Return(EntryList::iterator entry);
+  void Evict();
+  // Whether the verdict entry holds on its sql may no longer be right.
+  bool ScanVerdictStale(const Entry& entry);
+  // Finds the full scans in the plan of stmt that the guard reports, returning
+  // whether it passes.
+  bool CheckScans(string_view sql, const Statement& stmt,
+                  std::vector<ScanFinding>* scans);
+  // Reports scans found in the plan of sql to the guard.
+  void ReportScans(string_view sql, const std::vector<ScanFinding>& scans);
+  // Returns the schema version of the connection, or -1 if it can't be read.
+  int64 SchemaVersion();
+
+  sqlite3* db_;
+  size_t capacity_;
+  std::optional<ScanGuard> scan_guard_;
+  // Counts the guards set, so that entries know which one checked them.
+  int64 guard_generation_ = 0;
+  // Prepared the first time SchemaVersion() is called.
+  sqlite3_stmt* schema_version_ = nullptr;
+  // Entries in most-recently-leased order.
+  EntryList entries_;
+  // Keys view the sql member of their entry, whose address is stable.
+  std::unordered_map<string_view, EntryList::iterator> index_;
+  int64 hits_ = 0;
+  int64 misses_ = 0;
+  int64 evictions_ = 0;
 };
 
+// How a Transaction acquires its locks. Immediate and exclusive transactions
+// take the write lock when they begin, so a writer fails (or waits) up front
+// instead of getting SQLITE_BUSY when it tries to upgrade mid-transaction.
+enum class TransactionMode { kDeferred, kImmediate, kExclusive };
+
+// RAII guard for a transaction, which is rolled back when the guard is
+// destroyed unless it was committed. The control statements are prepared once
+// per connection through its StatementCache.
+//
+// Example:
+//
+// Transaction txn(cache, TransactionMode::kImmediate);
+// if (!txn.ok()) return;
+// ... writes ...
+// if (!txn.Commit()) cerr << "oh no! " << txn.errstr() << endl;
+class Transaction {
+ public:
+  explicit Transaction(StatementCache& cache,
+                       TransactionMode mode = TransactionMode::kDeferred);
+  Transaction(const Transaction&) = delete;
+  Transaction& operator=(const Transaction&) = delete;
+  ~Transaction();
+
+  // Commits the transaction. Returns false if the commit failed; if the
+  // transaction is still active() after that (as after SQLITE_BUSY), the
+  // commit may be retried.
+  bool Commit();
+  // Rolls back the transaction. Returns false if the rollback failed.
+  bool Rollback();
+
+  inline bool active() const { return active_; }
+  inline bool ok() const { return rc_ == SQLITE_OK; }
+  inline int rc() const { return rc_; }
+  inline string_view errstr() const { return sqlite3_errstr(rc_); }
+
+ private:
+  // Runs one of the control statements.
+  bool Run(string_view sql);
+  void UpdateActive();
+
+  StatementCache* cache_;
+  bool active_ = false;
+  int rc_ = SQLITE_OK;
+};
+
+// RAII guard for a savepoint, which can be nested inside a Transaction, inside
+// other Savepoints, or used on its own (in which case it behaves like a
+// deferred transaction). It is rolled back when the guard is destroyed unless
+// it was released. Savepoints must be destroyed in the reverse order of their
+// creation.
+class Savepoint {
+ public:
+  explicit Savepoint(StatementCache& cache);
+  Savepoint(const Savepoint&) = delete;
+  Savepoint& operator=(const Savepoint&) = delete;
+  ~Savepoint();
+
+  // Releases the savepoint, keeping its changes as part of the enclosing
+  // transaction (or committing them, if there is none).
+  bool Release();
+  // Undoes every change made since the savepoint and releases it.
+  bool Rollback();
+
+  inline bool active() const { return active_; }
+  inline bool ok() const { return rc_ == SQLITE_OK; }
+  inline int rc() const { return rc_; }
+  inline string_view errstr() const { return sqlite3_errstr(rc_); }
+
+ private:
+  bool Run(string_view sql);
+
+  StatementCache* cache_;
+  bool active_ = false;
+  int rc_ = SQLITE_OK;
+};
+
+// Per-connection settings applied by Database when it opens a connection.
+// Fields left at -1 (or nullptr) keep sqlite's defaults. They are applied in
+// the order below: page_size only takes effect on a new database, and before
+// it is switched to WAL.
+struct TuningProfile {
+  // Bytes per page, a power of two from 512 to 65536.
+  int64 page_size;
+  // "WAL", "DELETE", "MEMORY", "OFF" and so on; see PRAGMA journal_mode.
+  const char* journal_mode;
+  // 0 (OFF), 1 (NORMAL), 2 (FULL) or 3 (EXTRA).
+  int64 synchronous;
+  // Page cache size as PRAGMA cache_size takes it: positive for pages,
+  // negative for KiB.
+  int64 cache_size;
+  // Maximum bytes of the file to memory-map. Reads through the map don't copy
+  // pages, and string_view or TextView columns then point straight into it.
+  // The effective value is capped by SQLITE_MAX_MMAP_SIZE.
+  int64 mmap_size;
+  // 0 (DEFAULT), 1 (FILE) or 2 (MEMORY) for temporary tables and indices.
+  int64 temp_store;
+};
+
+// Leaves every setting at sqlite's default.
+inline constexpr TuningProfile kDefaultProfile = {
+    /*page_size=*/-1,  /*journal_mode=*/nullptr, /*synchronous=*/-1,
+    /*cache_size=*/-1, /*mmap_size=*/-1,         /*temp_store=*/-1};
+
+// For databases that are mostly read: the file is memory-mapped (up to 1 GiB)
+// and given a 64 MiB page cache, and WAL lets readers run alongside a writer.
+inline constexpr TuningProfile kReadHeavyProfile = {
+    /*page_size=*/-1,
+    /*journal_mode=*/"WAL",
+    /*synchronous=*/-1,
+    /*cache_size=*/-(64 << 10),
+    /*mmap_size=*/int64{1} << 30,
+    /*temp_store=*/2};
+
+// For databases with frequent writes: WAL with synchronous=NORMAL, which only
+// syncs at checkpoints (a crash may lose the last commits but never corrupts
+// the database), and a 32 MiB page cache.
+inline constexpr TuningProfile kWriteHeavyProfile = {
+    /*page_size=*/-1,
+    /*journal_mode=*/"WAL",
+    /*synchronous=*/1,
+    /*cache_size=*/-(32 << 10),
+    /*mmap_size=*/-1,
+    /*temp_store=*/2};
+
+// For in-memory or throwaway scratch databases that needn't survive a crash:
+// the rollback journal is kept in memory and nothing is synced.
+inline constexpr TuningProfile kScratchProfile = {
+    /*page_size=*/-1,
+    /*journal_mode=*/"MEMORY",
+    /*synchronous=*/0,
+    /*cache_size=*/-(16 << 10),
+    /*mmap_size=*/-1,
+    /*temp_store=*/2};
+
+// The settings of a connection as sqlite reports them, which may differ from
+// those requested (for example, in-memory databases cannot use WAL). The
+// journal mode is reported in lower case.
+struct AppliedTuning {
+  int64 page_size = 0;
+  string journal_mode;
+  int64 synchronous = 0;
+  int64 cache_size = 0;
+  int64 mmap_size = 0;
+  int64 temp_store = 0;
+};
+
+// RAII owner of a connection, opened with a TuningProfile applied. The
+// connection is closed on destruction, so every Statement using it must be
+// destroyed first.
+//
+// Example:
+//
+// Database database("data.db", kReadHeavyProfile);
+// if (!database.ok()) cerr << "oh no! " << database.errstr() << endl;
+// if (database.tuning().mmap_size == 0) cerr << "not memory-mapped" << endl;
+// Statement stmt(database.db(), "SELECT name FROM users;");
+class Database {
+ public:
+  // Opens path with the given sqlite3_open_v2() flags. If opening or tuning
+  // fails, the connection is closed and rc() is the error.
+  Database(const string& path, const TuningProfile& profile = kDefaultProfile,
+           int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                       SQLITE_OPEN_URI);
+  Database(const Database&) = delete;
+  Database& operator=(const Database&) = delete;
+  Database(Database&& move_from) noexcept;
+  Database& operator=(Database&& move_from) noexcept;
+  ~Database();
+
+  inline sqlite3* db() const { return db_; }
+  // Gives up ownership of the connection.
+  inline sqlite3* release() {
+    sqlite3* db = db_;
+    db_ = nullptr;
+    return db;
+  }
+  // The settings in effect after the profile was applied.
+  inline const AppliedTuning& tuning() const { return tuning_; }
+
+  inline bool ok() const { return rc_ == SQLITE_OK; }
+  inline int rc() const { return rc_; }
+  inline string_view errstr() const { return sqlite3_errstr(rc_); }
+
+ private:
+  int Apply(const TuningProfile& profile);
+
+  sqlite3* db_ = nullptr;
+  AppliedTuning tuning_;
+  int rc_ = SQLITE_OK;
+};
+
+// Process-wide memory for sqlite, set by ConfigureGlobalMemory().
+struct GlobalMemoryConfig {
+  // A page cache arena with room for this many pages of page_size bytes,
+  // allocated once and shared by every connection. Larger pages, and pages
+  // beyond the arena, are allocated individually as usual. Zero keeps the
+  // default of allocating every page individually.
+  int page_cache_pages;
+  int page_size;
+  // The default lookaside arena of each connection, for small allocations:
+  // this many slots of lookaside_slot_size bytes. Zero slots disables it; -1
+  // keeps the default.
+  int lookaside_slot_size;
+  int lookaside_slots;
+};
+
+// Configures sqlite's global page cache and lookaside arenas. This must be
+// done before sqlite is initialized, which the first sqlite3_open() does;
+// otherwise it fails with SQLITE_MISUSE. Returns the sqlite return code (rc).
+int ConfigureGlobalMemory(const GlobalMemoryConfig& config);
+
 }  // namespace sqlite
 
+// With SQLITE_CPP_HEADER_ONLY, the hottest Statement members are defined
+// inline here rather than in sqlite_cpp.cc.
+#ifdef SQLITE_CPP_HEADER_ONLY
+#include "sqlite_cpp_inl.h"
+#endif
+
 #endif  // THIRD_PARTY_SQLITE_SQLITE_CPP_H_
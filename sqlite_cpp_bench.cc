@@ -0,0 +1,455 @@
+#include <benchmark/benchmark.h>
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+// Benchmarks comparing sqlite_cpp with the equivalent raw sqlite3 calls. Each
+// benchmark runs against an in-memory database (/wal:0) and an on-disk WAL
+// database (/wal:1); the wrapper should never be measurably slower.
+
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sqlite_blocking.h"
+#include "sqlite_cpp.h"
+
+namespace {
+
+using sqlite::int64;
+
+constexpr int64 kRows = 1000;
+constexpr int64 kBatchRows = 1000;
+const char kPath[] = "sqlite_cpp_bench.db";
+
+// A database holding kRows rows of every column type, either in memory or in a
+// WAL-mode file that is removed afterwards.
+class BenchDatabase {
+ public:
+  explicit BenchDatabase(bool wal) : wal_(wal) {
+    Remove();
+    sqlite3_open(wal_ ? kPath : ":memory:", &db_);
+    if (wal_) {
+      sqlite::Exec(db_, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+    }
+    sqlite::Exec(db_, R"sql(
+      CREATE TABLE t (
+        id INTEGER PRIMARY KEY,
+        i INTEGER,
+        d REAL,
+        s TEXT,
+        b BLOB,
+        o INTEGER
+      );
+      CREATE TABLE sink (i INTEGER, d REAL, s TEXT, b BLOB, o INTEGER);
+    )sql");
+    sqlite::Statement insert(db_, R"sql(
+      INSERT INTO t(id, i, d, s, b, o) VALUES (?, ?, ?, ?, ?, ?);
+    )sql");
+    auto batch = insert.BatchSink(kRows);
+    for (int64 id = 1; id <= kRows; ++id) {
+      std::string text = "row number " + std::to_string(id);
+      batch.Write(std::make_tuple(
+          id, id * 7, id * 0.5, sqlite::TextView(text), std::string_view(text),
+          id % 3 == 0 ? std::nullopt : std::optional<int64>(id)));
+    }
+    batch.Finish();
+  }
+  BenchDatabase(const BenchDatabase&) = delete;
+  BenchDatabase& operator=(const BenchDatabase&) = delete;
+  ~BenchDatabase() {
+    sqlite3_close(db_);
+    Remove();
+  }
+
+  sqlite3* db() const { return db_; }
+
+ private:
+  void Remove() {
+    if (!wal_) return;
+    std::remove(kPath);
+    std::remove((std::string(kPath) + "-wal").c_str());
+    std::remove((std::string(kPath) + "-shm").c_str());
+  }
+
+  bool wal_;
+  sqlite3* db_ = nullptr;
+};
+
+// Runs a benchmark against both kinds of BenchDatabase.
+void WalArgs(benchmark::internal::Benchmark* b) {
+  b->ArgName("wal")->Arg(0)->Arg(1);
+}
+
+// Column types to benchmark, with the raw sqlite3 equivalent of reading them.
+struct IntColumn {
+  using Type = int64;
+  static constexpr const char* kLookup = "SELECT i FROM t WHERE id = ?;";
+  static Type RawRead(sqlite3_stmt* stmt, int col) {
+    return sqlite3_column_int64(stmt, col);
+  }
+};
+
+struct DoubleColumn {
+  using Type = double;
+  static constexpr const char* kLookup = "SELECT d FROM t WHERE id = ?;";
+  static Type RawRead(sqlite3_stmt* stmt, int col) {
+    return sqlite3_column_double(stmt, col);
+  }
+};
+
+struct TextColumn {
+  using Type = sqlite::TextView;
+  static constexpr const char* kLookup = "SELECT s FROM t WHERE id = ?;";
+  static Type RawRead(sqlite3_stmt* stmt, int col) {
+    return Type(reinterpret_cast<const char*>(sqlite3_column_text(stmt, col)),
+                sqlite3_column_bytes(stmt, col));
+  }
+};
+
+struct TextCopyColumn {
+  using Type = sqlite::Text;
+  static constexpr const char* kLookup = "SELECT s FROM t WHERE id = ?;";
+  static Type RawRead(sqlite3_stmt* stmt, int col) {
+    return Type(reinterpret_cast<const char*>(sqlite3_column_text(stmt, col)),
+                sqlite3_column_bytes(stmt, col));
+  }
+};
+
+struct BlobColumn {
+  using Type = std::string_view;
+  static constexpr const char* kLookup = "SELECT b FROM t WHERE id = ?;";
+  static Type RawRead(sqlite3_stmt* stmt, int col) {
+    return Type(reinterpret_cast<const char*>(sqlite3_column_blob(stmt, col)),
+                sqlite3_column_bytes(stmt, col));
+  }
+};
+
+struct OptionalColumn {
+  using Type = std::optional<int64>;
+  static constexpr const char* kLookup = "SELECT o FROM t WHERE id = ?;";
+  static Type RawRead(sqlite3_stmt* stmt, int col) {
+    if (sqlite3_column_type(stmt, col) == SQLITE_NULL) return std::nullopt;
+    return sqlite3_column_int64(stmt, col);
+  }
+};
+
+// Point lookups: bind one key, step once and read one column.
+
+template <typename Column>
+void BM_LookupRaw(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite3_stmt* stmt = nullptr;
+  sqlite3_prepare_v2(bench.db(), Column::kLookup, -1, &stmt, nullptr);
+  int64 id = 0;
+  for (auto _ : state) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, id++ % kRows + 1);
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+      state.SkipWithError("no row");
+      break;
+    }
+    benchmark::DoNotOptimize(Column::RawRead(stmt, 0));
+  }
+  sqlite3_finalize(stmt);
+}
+
+template <typename Column>
+void BM_LookupStatement(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), Column::kLookup);
+  int64 id = 0;
+  for (auto _ : state) {
+    stmt.Bind(id++ % kRows + 1);
+    auto row = stmt.GetRow<typename Column::Type>();
+    if (!row.has_value()) {
+      state.SkipWithError("no row");
+      break;
+    }
+    benchmark::DoNotOptimize(row);
+  }
+}
+
+template <typename Column>
+void BM_LookupCached(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::StatementCache cache(bench.db());
+  int64 id = 0;
+  for (auto _ : state) {
+    auto stmt = cache.Get(Column::kLookup);
+    stmt->Bind(id++ % kRows + 1);
+    auto row = stmt->template GetRow<typename Column::Type>();
+    if (!row.has_value()) {
+      state.SkipWithError("no row");
+      break;
+    }
+    benchmark::DoNotOptimize(row);
+  }
+}
+
+#define LOOKUP_BENCHMARKS(Column)                               \
+  BENCHMARK_TEMPLATE(BM_LookupRaw, Column)->Apply(WalArgs);       \
+  BENCHMARK_TEMPLATE(BM_LookupStatement, Column)->Apply(WalArgs); \
+  BENCHMARK_TEMPLATE(BM_LookupCached, Column)->Apply(WalArgs)
+
+LOOKUP_BENCHMARKS(IntColumn);
+LOOKUP_BENCHMARKS(DoubleColumn);
+LOOKUP_BENCHMARKS(TextColumn);
+LOOKUP_BENCHMARKS(TextCopyColumn);
+LOOKUP_BENCHMARKS(BlobColumn);
+LOOKUP_BENCHMARKS(OptionalColumn);
+
+#undef LOOKUP_BENCHMARKS
+
+// Full scans reading every column of every row.
+
+constexpr char kScan[] = "SELECT i, d, s, b, o FROM t;";
+
+void BM_ScanRaw(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite3_stmt* stmt = nullptr;
+  sqlite3_prepare_v2(bench.db(), kScan, -1, &stmt, nullptr);
+  for (auto _ : state) {
+    sqlite3_reset(stmt);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      benchmark::DoNotOptimize(IntColumn::RawRead(stmt, 0));
+      benchmark::DoNotOptimize(DoubleColumn::RawRead(stmt, 1));
+      benchmark::DoNotOptimize(TextColumn::RawRead(stmt, 2));
+      benchmark::DoNotOptimize(BlobColumn::RawRead(stmt, 3));
+      benchmark::DoNotOptimize(OptionalColumn::RawRead(stmt, 4));
+    }
+  }
+  sqlite3_finalize(stmt);
+  state.SetItemsProcessed(state.iterations() * kRows);
+}
+BENCHMARK(BM_ScanRaw)->Apply(WalArgs);
+
+void BM_ScanRows(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), kScan);
+  for (auto _ : state) {
+    for (const auto& row :
+         stmt.Rows<int64, double, sqlite::TextView, std::string_view,
+                   std::optional<int64>>()) {
+      benchmark::DoNotOptimize(row);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kRows);
+}
+BENCHMARK(BM_ScanRows)->Apply(WalArgs);
+
+void BM_ScanRowsCopy(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), kScan);
+  for (auto _ : state) {
+    for (const auto& row :
+         stmt.Rows<int64, double, sqlite::Text, std::string,
+                   std::optional<int64>>()) {
+      benchmark::DoNotOptimize(row);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kRows);
+}
+BENCHMARK(BM_ScanRowsCopy)->Apply(WalArgs);
+
+void BM_ScanRowsInto(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), kScan);
+  std::tuple<int64, double, sqlite::Text, std::string, std::optional<int64>>
+      row;
+  for (auto _ : state) {
+    for (const auto& read : stmt.RowsInto(row)) {
+      benchmark::DoNotOptimize(read);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kRows);
+}
+BENCHMARK(BM_ScanRowsInto)->Apply(WalArgs);
+
+void BM_ScanFetchBatch(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), kScan);
+  sqlite::ColumnBatch<int64, double, sqlite::Text, std::string,
+                      std::optional<int64>>
+      batch;
+  for (auto _ : state) {
+    stmt.Reset();
+    while (stmt.FetchBatch(batch, 256) > 0) {
+      benchmark::DoNotOptimize(batch.column<0>().data());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kRows);
+}
+BENCHMARK(BM_ScanFetchBatch)->Apply(WalArgs);
+
+// Inserts, committed every kBatchRows rows.
+
+constexpr char kInsert[] =
+    "INSERT INTO sink(i, d, s, b, o) VALUES (?, ?, ?, ?, ?);";
+const std::string kText = "some text to insert";
+
+void BM_InsertRaw(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite3_stmt* stmt = nullptr;
+  sqlite3_prepare_v2(bench.db(), kInsert, -1, &stmt, nullptr);
+  int64 n = 0;
+  sqlite3_exec(bench.db(), "BEGIN;", nullptr, nullptr, nullptr);
+  for (auto _ : state) {
+    sqlite3_bind_int64(stmt, 1, n);
+    sqlite3_bind_double(stmt, 2, n * 0.5);
+    sqlite3_bind_text64(stmt, 3, kText.data(), kText.size(), SQLITE_STATIC,
+                        SQLITE_UTF8);
+    sqlite3_bind_blob64(stmt, 4, kText.data(), kText.size(), SQLITE_STATIC);
+    sqlite3_bind_null(stmt, 5);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      state.SkipWithError("insert failed");
+      break;
+    }
+    sqlite3_reset(stmt);
+    if (++n % kBatchRows == 0) {
+      sqlite3_exec(bench.db(), "COMMIT; BEGIN;", nullptr, nullptr, nullptr);
+    }
+  }
+  sqlite3_exec(bench.db(), "COMMIT;", nullptr, nullptr, nullptr);
+  sqlite3_finalize(stmt);
+}
+BENCHMARK(BM_InsertRaw)->Apply(WalArgs);
+
+void BM_InsertSink(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), kInsert);
+  auto sink = stmt.Sink();
+  int64 n = 0;
+  sqlite::Exec(bench.db(), "BEGIN;");
+  for (auto _ : state) {
+    *sink = std::make_tuple(n, n * 0.5, sqlite::TextView(kText),
+                            std::string_view(kText), std::nullopt);
+    if (++n % kBatchRows == 0) sqlite::Exec(bench.db(), "COMMIT; BEGIN;");
+  }
+  sqlite::Exec(bench.db(), "COMMIT;");
+}
+BENCHMARK(BM_InsertSink)->Apply(WalArgs);
+
+void BM_InsertBatchSink(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), kInsert);
+  auto batch = stmt.BatchSink(kBatchRows);
+  int64 n = 0;
+  for (auto _ : state) {
+    batch.Write(std::make_tuple(n, n * 0.5, sqlite::TextView(kText),
+                                std::string_view(kText), std::nullopt));
+    ++n;
+  }
+  batch.Finish();
+}
+BENCHMARK(BM_InsertBatchSink)->Apply(WalArgs);
+
+void BM_InsertExecuteMany(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), kInsert);
+  std::vector<int64> ints(kBatchRows);
+  std::vector<double> doubles(kBatchRows);
+  std::vector<sqlite::TextView> texts(kBatchRows, sqlite::TextView(kText));
+  std::vector<std::string_view> blobs(kBatchRows, std::string_view(kText));
+  std::vector<std::nullopt_t> nulls(kBatchRows, std::nullopt);
+  int64 n = 0;
+  for (auto _ : state) {
+    for (auto& value : ints) value = n++;
+    for (size_t i = 0; i < doubles.size(); ++i) doubles[i] = ints[i] * 0.5;
+    if (!stmt.ExecuteMany(ints, doubles, texts, blobs, nulls)) {
+      state.SkipWithError("insert failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchRows);
+}
+BENCHMARK(BM_InsertExecuteMany)->Apply(WalArgs);
+
+// Binding alone.
+
+void BM_BindRaw(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite3_stmt* stmt = nullptr;
+  sqlite3_prepare_v2(bench.db(), kInsert, -1, &stmt, nullptr);
+  int64 n = 0;
+  for (auto _ : state) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, n);
+    sqlite3_bind_double(stmt, 2, n * 0.5);
+    sqlite3_bind_text64(stmt, 3, kText.data(), kText.size(), SQLITE_STATIC,
+                        SQLITE_UTF8);
+    sqlite3_bind_blob64(stmt, 4, kText.data(), kText.size(), SQLITE_STATIC);
+    sqlite3_bind_null(stmt, 5);
+    ++n;
+  }
+  sqlite3_finalize(stmt);
+}
+BENCHMARK(BM_BindRaw)->Apply(WalArgs);
+
+void BM_BindStatement(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), kInsert);
+  int64 n = 0;
+  for (auto _ : state) {
+    stmt.Bind(n, n * 0.5, sqlite::TextView(kText), std::string_view(kText),
+              std::nullopt);
+    ++n;
+  }
+}
+BENCHMARK(BM_BindStatement)->Apply(WalArgs);
+
+// Capturing the parameters to replay later, as a queued write does.
+void BM_BindParamPack(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::Statement stmt(bench.db(), kInsert);
+  int64 n = 0;
+  for (auto _ : state) {
+    sqlite::ParamPack params(n, n * 0.5, sqlite::TextView(kText),
+                             std::string_view(kText), std::nullopt);
+    stmt.Bind(params);
+    ++n;
+  }
+}
+BENCHMARK(BM_BindParamPack)->Apply(WalArgs);
+
+// Short scripts.
+
+constexpr char kScript[] = "SELECT 1; SELECT 2;";
+
+void BM_ExecRaw(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  for (auto _ : state) {
+    sqlite3_exec(bench.db(), kScript, nullptr, nullptr, nullptr);
+  }
+}
+BENCHMARK(BM_ExecRaw)->Apply(WalArgs);
+
+void BM_ExecRC(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sqlite::ExecRC(bench.db(), kScript));
+  }
+}
+BENCHMARK(BM_ExecRC)->Apply(WalArgs);
+
+void BM_ExecPreparedScript(benchmark::State& state) {
+  BenchDatabase bench(state.range(0));
+  sqlite::PreparedScript script(bench.db(), kScript);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(script.Run());
+  }
+}
+BENCHMARK(BM_ExecPreparedScript)->Apply(WalArgs);
+
+}  // namespace
+
+BENCHMARK_MAIN();
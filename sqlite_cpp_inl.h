@@ -0,0 +1,66 @@
+#ifndef THIRD_PARTY_SQLITE_SQLITE_CPP_INL_H_
+#define THIRD_PARTY_SQLITE_SQLITE_CPP_INL_H_
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+// The Statement members on the hottest paths: running a statement and
+// clearing its parameters for the next binding, and moving statements in and
+// out of caches and containers. They are compiled into sqlite_cpp.cc, unless
+// SQLITE_CPP_HEADER_ONLY is defined, when sqlite_cpp.h includes them inline so
+// that every caller can inline them. Define it for the whole program, library
+// included, or not at all.
+
+#include <utility>
+
+#include "sqlite3.h"
+#include "sqlite_blocking.h"
+#include "sqlite_cpp.h"
+
+#ifdef SQLITE_CPP_HEADER_ONLY
+#define SQLITE_CPP_INLINE inline
+#else
+#define SQLITE_CPP_INLINE
+#endif
+
+namespace sqlite {
+
+SQLITE_CPP_INLINE Statement::Statement(Statement&& move_from) noexcept
+    : stmt_(move_from.stmt_),
+      rc_(move_from.rc_),
+      many_(std::move(move_from.many_)) {
+  move_from.stmt_ = nullptr;
+}
+
+SQLITE_CPP_INLINE Statement::~Statement() { sqlite3_finalize(stmt_); }
+
+SQLITE_CPP_INLINE Statement& Statement::operator=(
+    Statement&& move_from) noexcept {
+  sqlite3_finalize(stmt_);
+  stmt_ = move_from.stmt_;
+  move_from.stmt_ = nullptr;
+  rc_ = move_from.rc_;
+  many_ = std::move(move_from.many_);
+  return *this;
+}
+
+SQLITE_CPP_INLINE void Statement::ClearBinds() {
+  sqlite3_clear_bindings(stmt_);
+}
+
+SQLITE_CPP_INLINE bool Statement::Run() {
+  sqlite3_reset(stmt_);
+  return (rc_ = sqlite3_blocking_step(stmt_)) == SQLITE_DONE;
+}
+
+}  // namespace sqlite
+
+#undef SQLITE_CPP_INLINE
+
+#endif  // THIRD_PARTY_SQLITE_SQLITE_CPP_INL_H_
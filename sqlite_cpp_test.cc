@@ -13,17 +13,158 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <mutex>
 #include <optional>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <utility>
 #include <vector>
 
 #include "sqlite3.h"
+#include "sqlite_function.h"
+#include "sqlite_typed.h"
+
+#if __cplusplus >= 202002L
+#include <ranges>
+#endif
+
+namespace {
+
+// SQL function flaky(x) that returns x, except that it fails with
+// SQLITE_LOCKED once when x reaches the value in its user data. This stands in
+// for a shared-cache lock being hit partway through a query.
+void Flaky(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  auto* fail_at = static_cast<sqlite3_int64*>(sqlite3_user_data(ctx));
+  if (sqlite3_value_int64(argv[0]) == *fail_at) {
+    *fail_at = -1;
+    sqlite3_result_error_code(ctx, SQLITE_LOCKED);
+    return;
+  }
+  sqlite3_result_value(ctx, argv[0]);
+}
+
+// Like Flaky, but fails by reading table t, so that the lock it is refused is
+// a real one held by another connection.
+void ReadsT(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  auto* fail_at = static_cast<sqlite3_int64*>(sqlite3_user_data(ctx));
+  if (sqlite3_value_int64(argv[0]) == *fail_at) {
+    int rc = sqlite3_exec(sqlite3_context_db_handle(ctx), "SELECT * FROM t;",
+                          nullptr, nullptr, nullptr);
+    if (rc != SQLITE_OK) {
+      sqlite3_result_error_code(ctx, rc);
+      return;
+    }
+  }
+  sqlite3_result_value(ctx, argv[0]);
+}
+
+// Wait hook that records the SQL and outcome of every shared-cache lock wait.
+struct WaitLog {
+  std::mutex mutex;
+  std::vector<std::pair<std::string, int>> waits;
+};
+
+void LogWait(void* arg, const sqlite3_blocking_wait_info* info) {
+  auto* log = static_cast<WaitLog*>(arg);
+  std::string sql = info->zSql == nullptr ? "" : info->zSql;
+  if (info->nSql >= 0) sql.resize(info->nSql);
+  std::lock_guard<std::mutex> lock(log->mutex);
+  log->waits.emplace_back(std::move(sql), info->rc);
+}
+
+// Aggregate of the sum of its arguments' squares, with the count of live
+// instances to check that every group's state is destroyed.
+struct SumSquares {
+  static inline int live = 0;
+  SumSquares() { ++live; }
+  ~SumSquares() { --live; }
+  void Step(double x) { sum += x * x; }
+  double Result() const { return sum; }
+  double sum = 0;
+};
+
+// Window function concatenating the text in its frame.
+struct Joined {
+  void Step(std::optional<sqlite::TextView> s) {
+    parts.emplace_back(s.has_value() ? *s : "-");
+  }
+  void Inverse(std::optional<sqlite::TextView> s) {
+    parts.erase(parts.begin());
+  }
+  sqlite::Text Result() const {
+    sqlite::Text joined;
+    for (const auto& part : parts) joined += part;
+    return joined;
+  }
+  std::vector<std::string> parts;
+};
+
+// Aggregate whose Result() throws, counting its live states.
+struct Throwing {
+  static inline int live = 0;
+  Throwing() { ++live; }
+  ~Throwing() { --live; }
+  void Step(double) {}
+  double Result() const { throw std::runtime_error("no result"); }
+};
+
+constexpr char kTypedSelect[] = "SELECT x, y, z FROM a WHERE x >= ? ORDER BY x;";
+constexpr char kTypedUpsert[] = R"sql(
+  INSERT INTO a(x, z) VALUES (:x, :z)
+  ON CONFLICT(x) DO UPDATE SET z = :z || ' (again)';
+)sql";
+constexpr char kTypedMismatch[] = "SELECT z FROM a;";
+constexpr char kTypedAggregate[] =
+    "SELECT count(*), sum(y / 2.0), upper(max(z)) FROM a;";
+
+// A row of table a, mapped to its columns with RowFields.
+struct ARow {
+  sqlite::int64 x = 0;
+  std::optional<int> y;
+  std::optional<std::string> z;
+};
+
+static_assert(sqlite::detail::CountParams("SELECT 1;") == 0);
+static_assert(sqlite::detail::CountParams("SELECT ?, ?, ?5, ?;") == 6);
+static_assert(sqlite::detail::CountParams("SELECT :a, @b, $c, :a;") == 3);
+static_assert(sqlite::detail::CountParams(
+                  "SELECT '?', \"?\", [?], `?`, a$b -- ?\n /* ? */ ;") == 0);
+
+using IntRows = decltype(std::declval<sqlite::Statement&>().Rows<int>());
+using IntRowIterator = decltype(std::declval<IntRows&>().begin());
+using IntChunks = decltype(std::declval<sqlite::Statement&>().Chunks<int>(1));
+static_assert(
+    std::is_same_v<std::iterator_traits<IntRowIterator>::iterator_category,
+                   std::input_iterator_tag>);
+#if __cplusplus >= 202002L
+static_assert(std::input_iterator<IntRowIterator>);
+static_assert(std::sentinel_for<sqlite::RowSentinel, IntRowIterator>);
+static_assert(std::ranges::input_range<IntRows>);
+static_assert(std::ranges::input_range<IntChunks>);
+#endif
+
+}  // namespace
+
+template <>
+struct sqlite::RowFields<ARow> {
+  static constexpr auto kFields = std::make_tuple(&ARow::x, &ARow::y, &ARow::z);
+};
 
 int main(int argc, char* argv[]) {
+  // Global memory can only be configured before sqlite is first used.
+  assert(sqlite::ConfigureGlobalMemory({/*page_cache_pages=*/64,
+                                        /*page_size=*/4096,
+                                        /*lookaside_slot_size=*/128,
+                                        /*lookaside_slots=*/64}) == SQLITE_OK);
   sqlite3* db;
   if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
     std::cout << sqlite3_errmsg(db) << std::endl;
@@ -150,6 +291,1194 @@ int main(int argc, char* argv[]) {
     d = std::move(d);
   }
 
+  {
+    // Cached statements are reused and come back reset with no bindings.
+    sqlite::StatementCache cache(db, 2);
+    {
+      auto stmt = cache.Get("SELECT y FROM a WHERE x = ?;");
+      assert(stmt->ok());
+      stmt->Bind(1);
+      auto row = stmt->GetRow<int>();
+      assert(row.has_value() && std::get<0>(*row) == 4);
+    }
+    assert(cache.misses() == 1 && cache.hits() == 0);
+    {
+      auto stmt = cache.Get("SELECT y FROM a WHERE x = ?;");
+      assert(cache.hits() == 1);
+      // Bindings were cleared, so x = NULL matches nothing.
+      assert(!stmt->GetRow<int>().has_value());
+      assert(stmt->done());
+      // Leasing the same sql while it is outstanding gets a second statement.
+      auto again = cache.Get("SELECT y FROM a WHERE x = ?;");
+      assert(again.get() != stmt.get());
+      assert(cache.misses() == 2);
+    }
+    assert(cache.size() == 1);
+    // Statements that don't compile are handed out but never cached.
+    assert(!cache.Get("SELECT 1; SELECT 2;")->ok());
+    assert(cache.size() == 1);
+    // The least recently used statement is evicted.
+    cache.Get("SELECT 1;");
+    cache.Get("SELECT 2;");
+    assert(cache.evictions() == 1);
+    assert(cache.size() == 2);
+    cache.Get("SELECT 2;");
+    assert(cache.hits() == 2);
+    cache.Get("SELECT y FROM a WHERE x = ?;");
+    assert(cache.hits() == 2);
+    assert(cache.evictions() == 2);
+  }
+
+  {
+    // Batched sinks commit every batch_size rows and report how many rows
+    // made it when one fails.
+    assert(sqlite::Exec(db, "CREATE TABLE b (k INTEGER PRIMARY KEY, v TEXT);"));
+    sqlite::Statement stmt(db, "INSERT INTO b(k, v) VALUES (?, ?);");
+    std::vector<std::tuple<int, std::string>> rows;
+    for (int i = 0; i < 10; ++i) rows.emplace_back(i, std::to_string(i));
+    {
+      auto batch = stmt.BatchSink(4);
+      std::copy(rows.begin(), rows.end(), batch.Sink());
+      assert(batch.committed() == 8);
+      assert(batch.pending() == 2);
+      assert(batch.Finish());
+      assert(batch.committed() == 10);
+    }
+    {
+      // The last two rows were rolled back when the writer was destroyed.
+      auto batch = stmt.BatchSink(4);
+      batch.Write(std::make_tuple(10, sqlite::TextView("ten")));
+      batch.Write(std::make_tuple(11, sqlite::TextView("eleven")));
+    }
+    {
+      // A duplicate key in the third batch rolls back only that batch.
+      rows.clear();
+      for (int i = 10; i < 20; ++i) rows.emplace_back(i, "");
+      rows.emplace_back(0, "duplicate");
+      auto batch = stmt.BatchSink(4);
+      int64_t committed = -1;
+      try {
+        std::copy(rows.begin(), rows.end(), batch.Sink());
+      } catch (const sqlite::BatchSinkException& e) {
+        committed = e.rows_committed;
+      }
+      assert(committed == 8);
+      assert(batch.rc() == SQLITE_CONSTRAINT);
+    }
+    sqlite::Statement count(db, "SELECT count(*) FROM b;");
+    assert(std::get<0>(*count.GetRow<int>()) == 18);
+    count.Reset();
+    assert(sqlite::Exec(db, "DROP TABLE b;"));
+  }
+
+  {
+    // Transactions roll back unless committed, and nest with savepoints.
+    sqlite::StatementCache cache(db);
+    sqlite::Statement count(db, "SELECT count(*) FROM a;");
+    auto rows = [&count] {
+      auto row = count.GetRow<int>();
+      count.Reset();
+      return std::get<0>(*row);
+    };
+    assert(rows() == 8);
+    {
+      sqlite::Transaction txn(cache, sqlite::TransactionMode::kImmediate);
+      assert(txn.ok() && txn.active());
+      assert(sqlite::Exec(db, "INSERT INTO a(x) VALUES (1000);"));
+      {
+        // A second transaction can't begin inside the first, and doesn't
+        // roll the first one back when it goes away.
+        sqlite::Transaction nested(cache);
+        assert(!nested.ok() && !nested.active());
+      }
+      assert(rows() == 9);
+    }
+    assert(rows() == 8);
+    {
+      sqlite::Transaction txn(cache, sqlite::TransactionMode::kExclusive);
+      assert(sqlite::Exec(db, "INSERT INTO a(x) VALUES (1000);"));
+      {
+        sqlite::Savepoint keep(cache);
+        assert(sqlite::Exec(db, "INSERT INTO a(x) VALUES (1001);"));
+        {
+          sqlite::Savepoint discard(cache);
+          assert(sqlite::Exec(db, "INSERT INTO a(x) VALUES (1002);"));
+          assert(rows() == 11);
+        }
+        assert(rows() == 10);
+        assert(keep.Release());
+        assert(!keep.active());
+      }
+      assert(txn.Commit());
+      assert(!txn.active());
+    }
+    assert(rows() == 10);
+    {
+      // Savepoints outside a transaction start one.
+      sqlite::Savepoint sp(cache);
+      assert(sqlite::Exec(db, "DELETE FROM a WHERE x >= 1000;"));
+      assert(sp.Rollback());
+      assert(!sp.active());
+      assert(sqlite3_get_autocommit(db));
+    }
+    assert(rows() == 10);
+    assert(sqlite::Exec(db, "DELETE FROM a WHERE x >= 1000;"));
+    // Every control statement was only prepared once.
+    assert(cache.size() == 8);
+    assert(cache.misses() == 8);
+  }
+
+  {
+    // Waits for shared-cache locks give up at their deadline.
+    const char* uri = "file:sqlite_cpp_test_shared?mode=memory&cache=shared";
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI;
+    sqlite3* writer;
+    sqlite3* reader;
+    assert(sqlite3_open_v2(uri, &writer, flags, nullptr) == SQLITE_OK);
+    assert(sqlite3_open_v2(uri, &reader, flags, nullptr) == SQLITE_OK);
+    assert(sqlite::Exec(writer, "CREATE TABLE t (k INTEGER PRIMARY KEY);"));
+    assert(sqlite::Exec(writer, "BEGIN; INSERT INTO t VALUES (1);"));
+    sqlite3_blocking_unlock_stats before;
+    sqlite3_blocking_get_unlock_stats(&before);
+    sqlite3_blocking_unlock_stats thread_before;
+    sqlite3_blocking_get_thread_unlock_stats(&thread_before);
+    sqlite3_int64 histogram_before[SQLITE_BLOCKING_HISTOGRAM_BUCKETS];
+    sqlite3_blocking_get_unlock_histogram(histogram_before);
+    WaitLog log;
+    sqlite3_blocking_set_wait_hook(LogWait, &log);
+    {
+      sqlite::Statement stmt(reader, "SELECT count(*) FROM t;");
+      assert(stmt.ok());
+      auto start = sqlite::Clock::now();
+      auto timeout = std::chrono::milliseconds(50);
+      assert(!stmt.GetRow<int>(start + timeout).has_value());
+      assert(stmt.rc() == SQLITE_BUSY);
+      assert(sqlite::Clock::now() - start >= timeout);
+      // The C API behaves the same way.
+      assert(sqlite3_blocking_exec_until(reader, "SELECT * FROM t;", nullptr,
+                                         nullptr, nullptr,
+                                         sqlite3_blocking_now() + 1000) ==
+             SQLITE_BUSY);
+      // With a distant deadline the wait ends when the lock is released.
+      std::thread commit([writer] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        assert(sqlite::Exec(writer, "COMMIT;"));
+      });
+      stmt.Reset();
+      auto row = stmt.GetRow<int>(sqlite::Clock::now() + std::chrono::hours(1));
+      commit.join();
+      assert(row.has_value() && std::get<0>(*row) == 1);
+    }
+    sqlite3_blocking_unlock_stats after;
+    sqlite3_blocking_get_unlock_stats(&after);
+    assert(after.nWait == before.nWait + 3);
+    assert(after.nTimeout == before.nTimeout + 2);
+    assert(after.nDeadlock == before.nDeadlock);
+    assert(after.waitUs - before.waitUs >= 50000);
+    // The waits all happened on this thread.
+    sqlite3_blocking_unlock_stats thread_after;
+    sqlite3_blocking_get_thread_unlock_stats(&thread_after);
+    assert(thread_after.nWait == thread_before.nWait + 3);
+    assert(thread_after.nTimeout == thread_before.nTimeout + 2);
+    assert(thread_after.waitUs - thread_before.waitUs >= 50000);
+    sqlite3_int64 histogram_after[SQLITE_BLOCKING_HISTOGRAM_BUCKETS];
+    sqlite3_blocking_get_unlock_histogram(histogram_after);
+    sqlite3_int64 waits = 0;
+    for (int i = 0; i < SQLITE_BLOCKING_HISTOGRAM_BUCKETS; ++i) {
+      waits += histogram_after[i] - histogram_before[i];
+    }
+    assert(waits == 3);
+    // The 50ms wait is at least 2^15us long.
+    waits = 0;
+    for (int i = 16; i < SQLITE_BLOCKING_HISTOGRAM_BUCKETS; ++i) {
+      waits += histogram_after[i] - histogram_before[i];
+    }
+    assert(waits >= 1);
+    // The hook saw which statements were blocked, and how each wait ended.
+    assert(log.waits.size() == 3);
+    assert(log.waits[0] == std::make_pair(std::string("SELECT count(*) FROM t;"),
+                                          SQLITE_BUSY));
+    assert(log.waits[1] ==
+           std::make_pair(std::string("SELECT * FROM t;"), SQLITE_BUSY));
+    assert(log.waits[2] == std::make_pair(std::string("SELECT count(*) FROM t;"),
+                                          SQLITE_OK));
+    log.waits.clear();
+    {
+      // One unlock wakes every thread waiting for it.
+      assert(sqlite::Exec(writer, "BEGIN; INSERT INTO t VALUES (2);"));
+      std::vector<sqlite3*> readers(4);
+      std::vector<std::thread> threads;
+      std::vector<int> counts(readers.size());
+      for (size_t i = 0; i < readers.size(); ++i) {
+        assert(sqlite3_open_v2(uri, &readers[i], flags, nullptr) == SQLITE_OK);
+        threads.emplace_back([&, i] {
+          sqlite::Statement stmt(readers[i], "SELECT count(*) FROM t;");
+          auto row = stmt.GetRow<int>();
+          counts[i] = row.has_value() ? std::get<0>(*row) : -1;
+        });
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      assert(sqlite::Exec(writer, "COMMIT;"));
+      for (auto& thread : threads) thread.join();
+      for (size_t i = 0; i < readers.size(); ++i) {
+        assert(counts[i] == 2);
+        assert(sqlite3_close(readers[i]) == SQLITE_OK);
+      }
+    }
+    {
+      // Waits that would deadlock are refused and counted.
+      assert(sqlite::Exec(writer, R"sql(
+        CREATE TABLE u (k INTEGER PRIMARY KEY);
+        BEGIN;
+        INSERT INTO t VALUES (3);
+      )sql"));
+      assert(sqlite::Exec(reader, "BEGIN; SELECT * FROM u;"));
+      sqlite3_blocking_get_unlock_stats(&before);
+      sqlite3_blocking_get_thread_unlock_stats(&thread_before);
+      std::thread insert([writer] {
+        // Blocked by the reader's lock on u. Whichever connection starts
+        // waiting second is refused, so retry while the reader is waiting.
+        int rc;
+        while ((rc = sqlite3_blocking_exec(writer, "INSERT INTO u VALUES (1);",
+                                           nullptr, nullptr, nullptr)) ==
+               SQLITE_LOCKED) {
+        }
+        assert(rc == SQLITE_OK);
+      });
+      // Until the writer is waiting, the reader's wait times out instead.
+      int rc;
+      while ((rc = sqlite3_blocking_exec_until(
+                  reader, "SELECT * FROM t;", nullptr, nullptr, nullptr,
+                  sqlite3_blocking_now() + 1000)) == SQLITE_BUSY) {
+      }
+      assert(rc == SQLITE_LOCKED);
+      assert(sqlite::Exec(reader, "ROLLBACK;"));
+      insert.join();
+      assert(sqlite::Exec(writer, "COMMIT;"));
+      sqlite3_blocking_get_unlock_stats(&after);
+      sqlite3_blocking_get_thread_unlock_stats(&thread_after);
+      assert(after.nDeadlock >= before.nDeadlock + 1);
+      assert(thread_after.nDeadlock == thread_before.nDeadlock + 1);
+      std::lock_guard<std::mutex> lock(log.mutex);
+      assert(log.waits.back() ==
+             std::make_pair(std::string("INSERT INTO u VALUES (1);"),
+                            SQLITE_OK));
+      assert(std::count(log.waits.begin(), log.waits.end(),
+                        std::make_pair(std::string("SELECT * FROM t;"),
+                                       SQLITE_LOCKED)) == 1);
+    }
+    sqlite3_blocking_set_wait_hook(nullptr, nullptr);
+    assert(sqlite3_close(reader) == SQLITE_OK);
+    assert(sqlite3_close(writer) == SQLITE_OK);
+  }
+
+  {
+    // Busy database files are retried with backoff until the policy's limit.
+    const char* path = "sqlite_cpp_test.db";
+    std::remove(path);
+    sqlite3* holder;
+    sqlite3* waiter;
+    assert(sqlite3_open(path, &holder) == SQLITE_OK);
+    assert(sqlite3_open(path, &waiter) == SQLITE_OK);
+    sqlite3_blocking_backoff quick = {1000, 10000, 50000};
+    assert(sqlite3_blocking_busy_backoff(waiter, &quick) == SQLITE_OK);
+    assert(sqlite::Exec(holder, "CREATE TABLE t (k INTEGER PRIMARY KEY);"));
+    assert(sqlite::Exec(holder, "BEGIN IMMEDIATE;"));
+    sqlite3_blocking_busy_stats before;
+    sqlite3_blocking_get_busy_stats(&before);
+    auto start = sqlite::Clock::now();
+    assert(sqlite::ExecRC(waiter, "BEGIN IMMEDIATE;") == SQLITE_BUSY);
+    assert(sqlite::Clock::now() - start >= std::chrono::milliseconds(50));
+    sqlite3_blocking_busy_stats after;
+    sqlite3_blocking_get_busy_stats(&after);
+    assert(after.nBusy == before.nBusy + 1);
+    assert(after.nRetry > before.nRetry);
+    assert(after.nTimeout == before.nTimeout + 1);
+    assert(after.waitUs > before.waitUs);
+    // A deadline cuts the backoff short.
+    assert(sqlite3_blocking_busy_backoff(waiter, &sqlite::kDefaultBusyBackoff) ==
+           SQLITE_OK);
+    start = sqlite::Clock::now();
+    {
+      sqlite::Statement begin(waiter, "BEGIN IMMEDIATE;");
+      assert(!begin.GetRow<int>(start + std::chrono::milliseconds(20)));
+      assert(begin.rc() == SQLITE_BUSY);
+    }
+    assert(sqlite::Clock::now() - start < std::chrono::seconds(1));
+    // Once the lock is released the retry succeeds.
+    std::thread commit([holder] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      assert(sqlite::Exec(holder, "COMMIT;"));
+    });
+    assert(sqlite::Exec(waiter, "BEGIN IMMEDIATE; INSERT INTO t VALUES (1);"));
+    commit.join();
+    assert(sqlite::Exec(waiter, "COMMIT;"));
+    assert(sqlite3_close(waiter) == SQLITE_OK);
+    assert(sqlite3_close(holder) == SQLITE_OK);
+    std::remove(path);
+  }
+
+  {
+    // Queries interrupted by a lock after yielding rows are not restarted.
+    sqlite3_int64 fail_at;
+    assert(sqlite3_create_function(db, "flaky", 1, SQLITE_UTF8, &fail_at,
+                                   Flaky, nullptr, nullptr) == SQLITE_OK);
+    sqlite::Statement stmt(db, R"sql(
+      SELECT x, flaky(x) FROM a WHERE x > ? ORDER BY x;
+    )sql");
+    stmt.Bind(0);
+    fail_at = 6;
+    std::vector<int> seen;
+    for (const auto& [x, _] : stmt.Rows<int, int>()) seen.push_back(x);
+    assert(stmt.rc() == SQLITE_LOCKED);
+    assert((seen == std::vector<int>{1, 2, 3, 4}));
+    // Resumable scans pick up after the last row they yielded.
+    seen.clear();
+    fail_at = 6;
+    auto rows = stmt.ResumableRows<int, int>(0, 1);
+    for (const auto& [x, _] : rows) seen.push_back(x);
+    assert(stmt.done());
+    assert(rows.resumes() == 1);
+    assert((seen == std::vector<int>{1, 2, 3, 4, 6, 7, 55, 100}));
+    // Iterating again starts a new pass, without the last pass's key.
+    seen.clear();
+    stmt.Bind(0);
+    fail_at = 1;
+    for (const auto& [x, _] : rows) seen.push_back(x);
+    assert(stmt.done());
+    assert(rows.resumes() == 0);
+    assert((seen == std::vector<int>{1, 2, 3, 4, 6, 7, 55, 100}));
+    // Non-integer keys work too.
+    assert(sqlite::Exec(db, "CREATE INDEX a_z ON a(z);"));
+    stmt = sqlite::Statement(db, R"sql(
+      SELECT z, flaky(x) FROM a WHERE z > ? ORDER BY z;
+    )sql");
+    stmt.Bind(sqlite::TextView(""));
+    fail_at = 2;
+    std::vector<std::string> zs;
+    auto z_rows = stmt.ResumableRows<std::string, int>(0, 1);
+    for (const auto& [z, _] : z_rows) zs.push_back(z);
+    assert(stmt.done());
+    assert(z_rows.resumes() == 1);
+    // (The '300' was bound as a blob, which sorts after text.)
+    assert((zs == std::vector<std::string>{"asdf", "here's another one",
+                                           "stuff goes here", "test", "wabl",
+                                           "300"}));
+    stmt.Reset();
+    assert(sqlite::Exec(db, "DROP INDEX a_z;"));
+  }
+
+  {
+    // Resumable scans stop when waiting for the lock would deadlock.
+    const char* uri = "file:sqlite_cpp_test_resume?mode=memory&cache=shared";
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI;
+    sqlite3* writer;
+    sqlite3* reader;
+    assert(sqlite3_open_v2(uri, &writer, flags, nullptr) == SQLITE_OK);
+    assert(sqlite3_open_v2(uri, &reader, flags, nullptr) == SQLITE_OK);
+    sqlite3_int64 fail_at = 3;
+    assert(sqlite3_create_function(reader, "reads_t", 1, SQLITE_UTF8, &fail_at,
+                                   ReadsT, nullptr, nullptr) == SQLITE_OK);
+    assert(sqlite::Exec(writer, R"sql(
+      CREATE TABLE t (k INTEGER PRIMARY KEY);
+      CREATE TABLE u (k INTEGER PRIMARY KEY);
+      INSERT INTO u VALUES (1), (2), (3), (4);
+      BEGIN;
+      INSERT INTO t VALUES (1);
+    )sql"));
+    assert(sqlite::Exec(reader, "BEGIN; SELECT * FROM u;"));
+    // The writer waits for the reader's lock on u...
+    std::thread insert([writer] {
+      assert(sqlite::Exec(writer, "INSERT INTO u VALUES (5);"));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    {
+      // ...so the reader can't wait for the writer's lock on t.
+      sqlite::Statement stmt(reader, R"sql(
+        SELECT k, reads_t(k) FROM u WHERE k > ? ORDER BY k;
+      )sql");
+      stmt.Bind(0);
+      std::vector<int> seen;
+      auto rows = stmt.ResumableRows<int, int>(0, 1);
+      for (const auto& [k, _] : rows) seen.push_back(k);
+      assert(stmt.rc() == SQLITE_LOCKED);
+      assert(rows.resumes() == 0);
+      assert((seen == std::vector<int>{1, 2}));
+    }
+    assert(sqlite::Exec(reader, "ROLLBACK;"));
+    insert.join();
+    assert(sqlite::Exec(writer, "COMMIT;"));
+    assert(sqlite3_close(reader) == SQLITE_OK);
+    assert(sqlite3_close(writer) == SQLITE_OK);
+  }
+
+  {
+    // Batches of rows are read into column buffers.
+    sqlite::Statement stmt(db, "SELECT x, y, y / 2.0, z FROM a ORDER BY x;");
+    sqlite::ColumnBatch<sqlite::int64, std::optional<int>, double,
+                        std::optional<sqlite::Text>>
+        batch;
+    assert(stmt.FetchBatch(batch, 5) == 5);
+    assert(batch.size() == 5);
+    const sqlite::int64* xs = batch.column<0>().data();
+    assert(xs[0] == 1 && xs[4] == 6);
+    const auto& ys = batch.column<1>();
+    assert(ys.valid(0) && !ys.valid(2) && ys.valid(3));
+    assert(ys.values()[3] == -1);
+    assert(ys.validity()[0] == 0b11011);
+    assert(batch.column<2>()[0] == 2.0);
+    const auto& zs = batch.column<3>();
+    assert(zs.values()[1] == "wabl");
+    assert(!zs.valid(3) && zs.values()[3].empty());
+    assert(zs.valid(4) && zs.values()[4].empty());
+    assert(zs.values().arena() == "asdfwabltest");
+    // The next batch replaces the first, and is short because the rows ran
+    // out.
+    assert(stmt.FetchBatch(batch, 5) == 3);
+    assert(stmt.done());
+    assert(batch.column<0>()[2] == 100);
+    assert(batch.column<3>().values()[2] == "300");
+    // FetchBatch on a done statement returns 0 rather than starting over.
+    assert(stmt.FetchBatch(batch, 5) == 0);
+    assert(batch.size() == 0);
+    assert(stmt.done());
+  }
+
+  {
+    // Strings read through an arena outlive their rows.
+    sqlite::Statement stmt(db, "SELECT x, z, CAST(z AS BLOB) FROM a ORDER BY x;");
+    sqlite::RowArena arena(16);
+    std::vector<std::tuple<int, std::optional<sqlite::TextView>,
+                           std::optional<std::string_view>>>
+        rows;
+    for (const auto& row :
+         stmt.Rows<int, std::optional<sqlite::TextView>,
+                   std::optional<std::string_view>>(arena)) {
+      rows.push_back(row);
+    }
+    assert(stmt.done());
+    assert(rows.size() == 8);
+    assert(*std::get<1>(rows[0]) == "asdf");
+    assert(*std::get<2>(rows[1]) == "wabl");
+    assert(!std::get<1>(rows[3]).has_value());
+    assert(std::get<1>(rows[4])->empty());
+    assert(*std::get<1>(rows[5]) == "here's another one");
+    assert(*std::get<2>(rows[7]) == "300");
+    size_t capacity = arena.capacity();
+    // Iterating again reuses the arena's memory.
+    rows.clear();
+    for (const auto& row :
+         stmt.Rows<int, std::optional<sqlite::TextView>,
+                   std::optional<std::string_view>>(arena)) {
+      rows.push_back(row);
+    }
+    assert(arena.capacity() == capacity);
+    assert(*std::get<1>(rows[6]) == "stuff goes here");
+    // With pages, each page's values are valid until the next page starts.
+    std::vector<std::string> pages;
+    std::vector<sqlite::TextView> page;
+    for (const auto& [x, z, _] :
+         stmt.Rows<int, std::optional<sqlite::TextView>,
+                   std::optional<std::string_view>>(arena, 3)) {
+      page.push_back(z.value_or(sqlite::TextView("-")));
+      if (page.size() == 3) {
+        pages.emplace_back();
+        for (auto value : page) pages.back() += std::string(value) + ",";
+        page.clear();
+      }
+    }
+    assert((pages == std::vector<std::string>{"asdf,wabl,test,",
+                                              "-,,here's another one,"}));
+    assert(arena.capacity() == capacity);
+  }
+
+  {
+    // Typed statements bind by position and check their columns once.
+    sqlite::TypedStatement<kTypedUpsert, sqlite::Params<int, sqlite::TextView>,
+                           sqlite::Cols<>>
+        upsert(db);
+    assert(upsert.ok());
+    assert(upsert.Bind(200, "typed"));
+    assert(upsert.Run());
+    assert(upsert.Bind(200, "typed"));
+    assert(upsert.Run());
+    sqlite::TypedStatement<kTypedSelect, sqlite::Params<int>,
+                           sqlite::Cols<sqlite::int64, std::optional<int>,
+                                        std::optional<sqlite::Text>>>
+        select(db);
+    assert(select.ok());
+    assert(select.Bind(100));
+    std::vector<sqlite::int64> xs;
+    for (const auto& [x, y, z] : select.Rows()) {
+      xs.push_back(x);
+      if (x == 200) assert(*z == "typed (again)");
+    }
+    assert(select.done());
+    assert((xs == std::vector<sqlite::int64>{100, 200}));
+    sqlite::TypedStatement<kTypedMismatch, sqlite::Params<>, sqlite::Cols<int>>
+        mismatch(db);
+    assert(mismatch.rc() == SQLITE_MISMATCH);
+    // Aggregates and function calls have no declared type, so any type reads
+    // them.
+    sqlite::TypedStatement<kTypedAggregate, sqlite::Params<>,
+                           sqlite::Cols<sqlite::int64, double, sqlite::Text>>
+        aggregate(db);
+    assert(aggregate.ok());
+    auto totals = aggregate.GetRow();
+    assert(totals);
+    sqlite::Statement untyped(db, kTypedAggregate);
+    auto expected = untyped.GetRow<sqlite::int64, double, std::string>();
+    assert(std::get<0>(*totals) == 9 && std::get<0>(*expected) == 9);
+    assert(std::get<1>(*totals) == std::get<1>(*expected));
+    assert(std::get<2>(*totals) == std::get<2>(*expected));
+    sqlite::Statement named(db, kTypedUpsert);
+    assert(named.ParamIndex(":z") == 2);
+    assert(named.ParamIndex(":missing") == 0);
+    assert(sqlite::Exec(db, "DELETE FROM a WHERE x = 200;"));
+  }
+
+  {
+    // Mapped structs are read and bound as whole rows.
+    sqlite::Statement select(db, "SELECT x, y, z FROM a ORDER BY x;");
+    std::vector<ARow> rows;
+    for (const ARow& row : select.Rows<ARow>()) rows.push_back(row);
+    assert(select.done());
+    assert(rows.size() == 8);
+    assert(rows[0].x == 1 && *rows[0].y == 4 && *rows[0].z == "asdf");
+    assert(!rows[2].y.has_value());
+    assert(!rows[3].z.has_value());
+    auto first = select.Rows<ARow>().begin();
+    assert((*first).z == "asdf");
+    select.Reset();
+    ARow row;
+    assert(select.ReadInto(row));
+    assert(select.ReadInto(row));
+    assert(row.x == 2 && *row.z == "wabl");
+    sqlite::Statement insert(db, "INSERT INTO a(x, y, z) VALUES (?, ?, ?);");
+    std::vector<ARow> more = {{300, 1, "three hundred"}, {301, {}, {}}};
+    std::copy(more.begin(), more.end(), insert.Sink());
+    sqlite::Statement check(db, "SELECT x, y, z FROM a WHERE x >= 300;");
+    auto added = check.GetRow<ARow>();
+    assert(added && added->x == 300 && *added->z == "three hundred");
+    assert(check.ReadInto(*added));
+    assert(added->x == 301 && !added->y && !added->z);
+    assert(!check.ReadInto(*added));
+    assert(check.done());
+    assert(sqlite::Exec(db, "DELETE FROM a WHERE x >= 300;"));
+  }
+
+  {
+    // Reading into existing storage reuses string capacity.
+    sqlite::Statement stmt(db, "SELECT x, z FROM a ORDER BY x;");
+    std::tuple<int, std::optional<std::string>> row;
+    std::get<1>(row).emplace().reserve(64);
+    const char* data = std::get<1>(row)->data();
+    std::vector<int> xs;
+    for (const auto& [x, z] : stmt.RowsInto(row)) {
+      xs.push_back(x);
+      if (x == 1) assert(*z == "asdf");
+      if (x == 4) assert(!z.has_value());
+      if (x == 1 || x == 3) assert(z->data() == data);
+    }
+    assert(stmt.done());
+    assert((xs == std::vector<int>{1, 2, 3, 4, 6, 7, 55, 100}));
+    stmt.Reset();
+    assert(stmt.ReadInto(row));
+    assert(std::get<0>(row) == 1);
+    // The null in row 4 released the old string.
+    data = std::get<1>(row)->data();
+    assert(stmt.ReadInto(row));
+    assert(*std::get<1>(row) == "wabl" && std::get<1>(row)->data() == data);
+  }
+
+  {
+    // Prepared scripts are compiled once and run repeatedly.
+    sqlite::PreparedScript script(db, R"sql(
+      CREATE TABLE IF NOT EXISTS s (k INTEGER PRIMARY KEY, v INTEGER);
+      INSERT INTO s(v) VALUES (?);
+      -- Statements may use tables created earlier in the script.
+      UPDATE s SET v = v + 1;
+      SELECT * FROM s;
+    )sql");
+    assert(script.size() == 0);
+    assert(script.Run());
+    assert(script.size() == 4);
+    assert(script.statement(1).Bind(10));
+    assert(script.Run());
+    assert(script.Run());
+    sqlite::Statement sum(db, "SELECT count(*), sum(v) FROM s;");
+    auto row = sum.GetRow<int, int>();
+    // Rows: null, 10 + 1 + 1 and 10 + 1.
+    assert(row && std::get<0>(*row) == 3 && std::get<1>(*row) == 23);
+    sum.Reset();
+    sqlite::PreparedScript broken(db, "DELETE FROM s; SELECT nonsense FROM s;");
+    assert(!broken.Prepare());
+    assert(broken.size() == 1);
+    assert(broken.rc() == SQLITE_ERROR);
+    assert(!broken.Run());
+    assert(sqlite::Exec(db, "DROP TABLE s;"));
+  }
+
+  {
+    // Columns of values are inserted in one transaction.
+    assert(sqlite::Exec(
+        db, "CREATE TABLE m (k INTEGER PRIMARY KEY, d REAL, s TEXT, o INTEGER);"));
+    sqlite::Statement insert(db, "INSERT INTO m(k, d, s, o) VALUES (?, ?, ?, ?);");
+    std::vector<sqlite::int64> ks = {1, 2, 3};
+    std::vector<double> ds = {0.5, 1.5, 2.5};
+    std::vector<std::string> strings = {"one", "two", "three"};
+    std::vector<sqlite::TextView> ss(strings.begin(), strings.end());
+    std::vector<std::optional<int>> os = {7, std::nullopt, 9};
+    assert(insert.ExecuteMany(ks, ds, ss, os));
+    assert(insert.done());
+    sqlite::Statement check(db, "SELECT count(*), sum(d), group_concat(s), "
+                                "count(o) FROM m;");
+    auto row = check.GetRow<int, double, std::string, int>();
+    assert(row && std::get<0>(*row) == 3 && std::get<1>(*row) == 4.5);
+    assert(std::get<2>(*row) == "one,two,three" && std::get<3>(*row) == 2);
+    check.Reset();
+    // Columns of different lengths are refused.
+    ks = {4, 5};
+    assert(!insert.ExecuteMany(ks, ds, ss, os));
+    assert(insert.rc() == SQLITE_RANGE);
+    // A failing row rolls back the rows before it.
+    ks = {4, 1, 5};
+    assert(!insert.ExecuteMany(ks, ds, ss, os));
+    assert(insert.rc() == SQLITE_CONSTRAINT);
+    assert(sqlite3_get_autocommit(db));
+    row = check.GetRow<int, double, std::string, int>();
+    assert(row && std::get<0>(*row) == 3);
+    check.Reset();
+    // Inside a caller's transaction, no transaction of its own is made.
+    assert(sqlite::Exec(db, "BEGIN;"));
+    ks = {4, 5, 6};
+    assert(insert.ExecuteMany(ks, ds, ss, os));
+    assert(!sqlite3_get_autocommit(db));
+    assert(sqlite::Exec(db, "ROLLBACK;"));
+    row = check.GetRow<int, double, std::string, int>();
+    assert(row && std::get<0>(*row) == 3);
+    check.Reset();
+    // The transaction control statements are prepared once and kept.
+    auto statements = [db] {
+      int n = 0;
+      for (sqlite3_stmt* s = sqlite3_next_stmt(db, nullptr); s != nullptr;
+           s = sqlite3_next_stmt(db, s)) {
+        ++n;
+      }
+      return n;
+    };
+    int prepared = statements();
+    ks = {7, 8, 9};
+    assert(insert.ExecuteMany(ks, ds, ss, os));
+    assert(statements() == prepared);
+    // No bindings are left pointing into the columns.
+    assert(insert.Run());
+    sqlite::Statement unbound(db, "SELECT count(*) FROM m WHERE d IS NULL AND "
+                                  "s IS NULL AND o IS NULL;");
+    auto count = unbound.GetRow<int>();
+    assert(count && std::get<0>(*count) == 1);
+    unbound.Reset();
+    insert.Reset();
+    assert(sqlite::Exec(db, "DROP TABLE m;"));
+  }
+
+  {
+    // One statement serves IN lists of any length.
+    assert(sqlite::RegisterArrayFunction(db) == SQLITE_OK);
+    sqlite::Statement in(db, "SELECT x FROM a WHERE x IN cpp_array(?) ORDER BY x;");
+    assert(in.ok());
+    std::vector<sqlite::int64> ids = {55, 2, 9999, 7};
+    std::vector<int> found;
+    assert(in.Bind(sqlite::ArrayParam(ids)));
+    for (const auto& [x] : in.Rows<int>()) found.push_back(x);
+    assert(in.done());
+    assert((found == std::vector<int>{2, 7, 55}));
+    ids = {1};
+    assert(in.Bind(sqlite::ArrayParam(ids)));
+    found.clear();
+    for (const auto& [x] : in.Rows<int>()) found.push_back(x);
+    assert((found == std::vector<int>{1}));
+    // Copied arrays don't depend on the original values.
+    {
+      std::vector<std::string> strings = {"test", "stuff goes here", "nope"};
+      std::vector<sqlite::TextView> texts(strings.begin(), strings.end());
+      sqlite::Statement by_text(
+          db, "SELECT x FROM a WHERE z IN cpp_array(?) ORDER BY x;");
+      assert(by_text.BindCopy(sqlite::ArrayParam(texts)));
+      strings.clear();
+      texts.clear();
+      found.clear();
+      for (const auto& [x] : by_text.Rows<int>()) found.push_back(x);
+      assert((found == std::vector<int>{3, 55}));
+    }
+    // Values can be joined against as a table too.
+    double doubles[] = {1.5, 2.5};
+    sqlite::Statement sum(db, "SELECT sum(value) FROM cpp_array(?);");
+    assert(sum.Bind(sqlite::ArrayParam<double>(doubles, 2)));
+    auto total = sum.GetRow<double>();
+    assert(total && std::get<0>(*total) == 4.0);
+    sum.Reset();
+    // Strings are read back as bound, with or without copying.
+    std::vector<sqlite::TextView> words = {
+        sqlite::TextView("one"), sqlite::TextView(""), sqlite::TextView("3")};
+    sqlite::Statement values(db, "SELECT value FROM cpp_array(?);");
+    for (bool copy : {false, true}) {
+      assert(copy ? values.BindCopy(sqlite::ArrayParam(words))
+                  : values.Bind(sqlite::ArrayParam(words)));
+      std::vector<std::string> read;
+      for (const auto& [value] : values.Rows<std::string>()) {
+        read.push_back(value);
+      }
+      assert((read == std::vector<std::string>{"one", "", "3"}));
+    }
+    // Without an array there are no values.
+    sqlite::Statement empty(db, "SELECT count(*) FROM cpp_array(?);");
+    auto count = empty.GetRow<int>();
+    assert(count && std::get<0>(*count) == 0);
+  }
+
+  {
+    // Parameter packs own their values and bind them later.
+    sqlite::Statement types(
+        db, "SELECT typeof(?1), ?1, ?2, typeof(?3), ?3, typeof(?4), ?4, "
+            "typeof(?5), typeof(?6), length(?6);");
+    std::optional<sqlite::ParamPack> pack;
+    {
+      std::string text = "text";
+      std::string blob = "blob";
+      sqlite::ParamPack original(7, 2.5, sqlite::TextView(text),
+                                 std::string_view(blob),
+                                 std::optional<int>(), sqlite::ZeroBlob{3});
+      assert(original.size() == 6);
+      assert(original.bytes() <= sqlite::ParamPack::kInlineCapacity);
+      pack = original;
+      text = "gone";
+      blob = "gone";
+    }
+    assert(types.Bind(*pack));
+    auto row = types.GetRow<std::string, int, double, std::string, std::string,
+                            std::string, std::string, std::string,
+                            std::string, int>();
+    assert(row);
+    assert((*row == std::make_tuple(std::string("integer"), 7, 2.5,
+                                    std::string("text"), std::string("text"),
+                                    std::string("blob"), std::string("blob"),
+                                    std::string("null"), std::string("blob"),
+                                    3)));
+    types.Reset();
+    // Large packs spill into one heap allocation, and are moved cheaply.
+    std::string big(1000, 'x');
+    sqlite::ParamPack spilled;
+    for (int i = 0; i < 6; ++i) spilled.Add(sqlite::TextView(big));
+    assert(spilled.bytes() > sqlite::ParamPack::kInlineCapacity);
+    sqlite::ParamPack moved(std::move(spilled));
+    assert(spilled.empty());
+    assert(moved.size() == 6);
+    sqlite::Statement lengths(db, "SELECT length(?) + length(?);");
+    // Too many values for the statement's parameters.
+    assert(!lengths.Bind(moved));
+    assert(lengths.rc() == SQLITE_RANGE);
+    moved.Clear();
+    moved.Add(sqlite::TextView(big)).Add(std::string_view(big));
+    assert(lengths.BindCopy(moved));
+    moved = sqlite::ParamPack();
+    auto length = lengths.GetRow<int>();
+    assert(length && std::get<0>(*length) == 2000);
+    lengths.Reset();
+    // C strings and string literals are packed as text, as Bind() binds them.
+    const char* c_string = "c string";
+    sqlite::Statement texts(db, "SELECT typeof(?1), ?1, typeof(?2), ?2;");
+    sqlite::ParamPack c_strings("literal", c_string);
+    assert(texts.Bind(c_strings));
+    auto texts_row =
+        texts.GetRow<std::string, std::string, std::string, std::string>();
+    assert((texts_row == std::make_tuple(std::string("text"),
+                                         std::string("literal"),
+                                         std::string("text"),
+                                         std::string("c string"))));
+    texts.Reset();
+  }
+
+  {
+    // Rows work with standard algorithms, and with ranges in C++20.
+    assert(sqlite::Exec(db, R"sql(
+      CREATE TABLE r (k INTEGER PRIMARY KEY);
+      WITH RECURSIVE n(k) AS (SELECT 1 UNION ALL SELECT k + 1 FROM n WHERE k < 10)
+      INSERT INTO r(k) SELECT k FROM n;
+    )sql"));
+    sqlite::Statement select(db, "SELECT k FROM r ORDER BY k;");
+    auto rows = select.Rows<int>();
+    auto found = std::find_if(rows.begin(), rows.end(), [](const auto& row) {
+      return std::get<0>(row) > 4;
+    });
+    assert(found != rows.end() && found != sqlite::RowSentinel());
+    assert(std::get<0>(*found) == 5);
+    found++;
+    assert(std::get<0>(*found) == 6);
+    // *it++ yields the row stepped past, as C++17 input iterators require.
+    auto passed = *found++;
+    assert(std::get<0>(passed) == 6 && std::get<0>(*found) == 7);
+    select.Reset();
+#if __cplusplus >= 202002L
+    int sum = 0;
+    for (int k : select.Rows<int>() |
+                     std::views::transform([](auto row) {
+                       return std::get<0>(row);
+                     }) |
+                     std::views::filter([](int k) { return k % 2 == 0; })) {
+      sum += k;
+    }
+    assert(select.done());
+    assert(sum == 2 + 4 + 6 + 8 + 10);
+#endif
+    // Chunks hold up to the requested number of rows; the last may be short.
+    std::vector<size_t> sizes;
+    int total = 0;
+    for (const auto& chunk : select.Chunks<int>(4)) {
+      sizes.push_back(chunk.size());
+      for (const auto& [k] : chunk) total += k;
+    }
+    assert(select.done());
+    assert((sizes == std::vector<size_t>{4, 4, 2}));
+    assert(total == 55);
+    // An empty result has no chunks.
+    sqlite::Statement none(db, "SELECT k FROM r WHERE k > 10;");
+    auto chunks = none.Chunks<int>(4);
+    assert(!(chunks.begin() != chunks.end()));
+    assert(none.done());
+    assert(sqlite::Exec(db, "DROP TABLE r;"));
+  }
+
+  {
+    // Connections are opened with tuning profiles applied.
+    int current = 0;
+    int highwater = 0;
+    assert(sqlite3_status(SQLITE_STATUS_PAGECACHE_USED, &current, &highwater,
+                          0) == SQLITE_OK);
+    assert(highwater > 0);
+    assert(sqlite::ConfigureGlobalMemory({0, 0, 128, 64}) == SQLITE_MISUSE);
+    sqlite::Database scratch(":memory:", sqlite::kScratchProfile);
+    assert(scratch.ok());
+    assert(scratch.tuning().journal_mode == "memory");
+    assert(scratch.tuning().synchronous == 0);
+    assert(scratch.tuning().cache_size == -(16 << 10));
+    assert(scratch.tuning().temp_store == 2);
+    assert(sqlite::Exec(scratch.db(), "CREATE TABLE t (x); BEGIN; "
+                                      "INSERT INTO t VALUES (1); ROLLBACK;"));
+    // The in-memory database can't use WAL, which the report shows.
+    sqlite::Database memory(":memory:", sqlite::kReadHeavyProfile);
+    assert(memory.ok());
+    assert(memory.tuning().journal_mode == "memory");
+    const char* path = "sqlite_cpp_test.db";
+    std::remove(path);
+    {
+      sqlite::TuningProfile profile = sqlite::kReadHeavyProfile;
+      profile.page_size = 8192;
+      sqlite::Database file(path, profile);
+      assert(file.ok());
+      assert(file.tuning().page_size == 8192);
+      assert(file.tuning().journal_mode == "wal");
+      assert(file.tuning().cache_size == -(64 << 10));
+      assert(file.tuning().mmap_size <= sqlite::int64{1} << 30);
+      sqlite::Database moved(std::move(file));
+      assert(file.db() == nullptr);
+      assert(sqlite::Exec(moved.db(), "CREATE TABLE t (x);"));
+    }
+    {
+      // Reopening keeps the page size, and the database stays in WAL mode.
+      sqlite::Database file(path);
+      assert(file.ok());
+      assert(file.tuning().page_size == 8192);
+      assert(file.tuning().journal_mode == "wal");
+    }
+    std::remove(path);
+    std::remove((std::string(path) + "-wal").c_str());
+    std::remove((std::string(path) + "-shm").c_str());
+    sqlite::Database missing("no/such/dir/db", sqlite::kDefaultProfile);
+    assert(!missing.ok() && missing.db() == nullptr);
+    assert(missing.rc() == SQLITE_CANTOPEN);
+  }
+
+  {
+    // Query plans are inspected when statements are prepared.
+    sqlite3* pdb;
+    assert(sqlite3_open(":memory:", &pdb) == SQLITE_OK);
+    assert(sqlite::Exec(pdb, R"sql(
+      CREATE TABLE big (k INTEGER PRIMARY KEY, v INTEGER);
+      CREATE TABLE small (x INTEGER);
+      WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n
+                              WHERE i < 2000)
+      INSERT INTO big SELECT i, i % 7 FROM n;
+      INSERT INTO small SELECT k FROM big LIMIT 10;
+    )sql"));
+    {
+      sqlite::Statement stmt(pdb, R"sql(
+        SELECT * FROM small WHERE x IN (SELECT k FROM big WHERE v = 3);
+      )sql");
+      std::vector<sqlite::PlanNode> plan;
+      assert(stmt.ExplainQueryPlan(&plan) == SQLITE_OK);
+      assert(plan.size() == 2);
+      assert(plan[0].detail == "SCAN small");
+      assert(plan[0].IsFullScan() && plan[0].scanned() == "small");
+      // The subquery's steps are nested within it.
+      assert(plan[1].detail.find("SUBQUERY") != std::string::npos);
+      assert(!plan[1].IsFullScan());
+      assert(plan[1].children.size() == 1);
+      assert(plan[1].children[0].detail == "SCAN big");
+      // The statement still runs.
+      assert((stmt.GetRow<int, int>().has_value()));
+      sqlite::Statement search(pdb, "SELECT v FROM big WHERE k = ?;");
+      assert(search.ExplainQueryPlan(&plan) == SQLITE_OK);
+      assert(plan.size() == 1 && !plan[0].IsFullScan());
+      assert(plan[0].detail.rfind("SEARCH big", 0) == 0);
+    }
+    {
+      // Full scans of big tables are reported once per sql.
+      std::vector<std::pair<std::string, std::string>> scans;
+      sqlite::StatementCache cache(pdb);
+      sqlite::ScanGuard guard;
+      guard.report = [&scans](sqlite::string_view sql,
+                              sqlite::string_view table,
+                              const sqlite::PlanNode& scan) {
+        scans.emplace_back(std::string(sql), std::string(table));
+      };
+      cache.set_scan_guard(guard);
+      const char* scan_big = "SELECT count(*) FROM main.big b WHERE b.v = 1;";
+      for (int i = 0; i < 3; ++i) {
+        auto stmt = cache.Get(scan_big);
+        assert(std::get<0>(*stmt->GetRow<int>()) == 286);
+      }
+      assert(scans.size() == 1);
+      assert(scans[0] == std::make_pair(std::string(scan_big),
+                                        std::string("big")));
+      assert(cache.Get("SELECT * FROM small;")->ok());
+      assert(cache.Get("SELECT v FROM big WHERE k = 5;")->ok());
+      assert(cache.Get("SELECT 1;")->ok());
+      assert(scans.size() == 1);
+      // Rejected statements fail every time, but are checked and reported
+      // only the first.
+      guard.reject = true;
+      cache.set_scan_guard(guard);
+      const char* scan_x = "SELECT * FROM big AS x WHERE v = 2;";
+      for (int i = 0; i < 3; ++i) {
+        auto stmt = cache.Get(scan_x);
+        assert(stmt->rc() == SQLITE_AUTH);
+        stmt->Reset();
+        assert((!stmt->ok() && !stmt->GetRow<int, int>().has_value()));
+      }
+      assert(scans.size() == 2 && scans[1].second == "big");
+      // Statements checked before are not checked again.
+      assert(cache.Get(scan_big)->ok());
+      // Until the schema changes: refused sql is checked again at once...
+      assert(sqlite::Exec(pdb, "CREATE INDEX big_v ON big(v);"));
+      assert(cache.Get(scan_x)->ok());
+      assert(scans.size() == 2);
+      // ...and cached statements once sqlite has reprepared them.
+      assert(sqlite::Exec(pdb, "DROP INDEX big_v;"));
+      assert((cache.Get(scan_x)->GetRow<int, int>().has_value()));
+      assert(cache.Get(scan_x)->rc() == SQLITE_AUTH);
+      assert(scans.size() == 3);
+      {
+        // Verdicts are kept even when reporting throws, and are evicted with
+        // the statements.
+        sqlite::StatementCache small_cache(pdb, 2);
+        int reports = 0;
+        sqlite::ScanGuard throwing;
+        throwing.reject = true;
+        throwing.report = [&reports](sqlite::string_view,
+                                     sqlite::string_view,
+                                     const sqlite::PlanNode&) {
+          ++reports;
+          throw std::runtime_error("full scan");
+        };
+        small_cache.set_scan_guard(throwing);
+        bool thrown = false;
+        try {
+          small_cache.Get(scan_x);
+        } catch (const std::runtime_error&) {
+          thrown = true;
+        }
+        assert(thrown && reports == 1);
+        assert(small_cache.Get(scan_x)->rc() == SQLITE_AUTH);
+        assert(reports == 1);
+        for (int v = 0; v < 5; ++v) {
+          std::string sql = "SELECT * FROM big WHERE v = " +
+                            std::to_string(v) + ";";
+          try {
+            small_cache.Get(sql);
+          } catch (const std::runtime_error&) {
+          }
+        }
+        assert(reports == 6);
+        assert(small_cache.size() == 2);
+      }
+      // No table is too big for the largest limit.
+      guard.max_rows = std::numeric_limits<sqlite::int64>::max();
+      cache.set_scan_guard(guard);
+      assert(cache.Get(scan_x)->ok());
+      cache.set_scan_guard(std::nullopt);
+      assert(cache.Get("SELECT * FROM big WHERE v = 2;")->ok());
+      assert(scans.size() == 3);
+    }
+    assert(sqlite3_close(pdb) == SQLITE_OK);
+  }
+
+  {
+    // SQL functions are registered from typed C++ callables.
+    sqlite3* fdb;
+    assert(sqlite3_open(":memory:", &fdb) == SQLITE_OK);
+    assert(sqlite::Exec(fdb, R"sql(
+      CREATE TABLE p (k INTEGER PRIMARY KEY, x REAL, s TEXT);
+      INSERT INTO p VALUES (1, 1.0, 'a'), (2, 2.0, NULL), (3, 3.0, 'c'),
+                           (4, 4.0, 'd');
+    )sql"));
+    int calls = 0;
+    int rc = sqlite::RegisterFunction(fdb, "within", sqlite::kPureFunction,
+                                      [&calls](double x, double limit) {
+                                        ++calls;
+                                        return x * x < limit;
+                                      });
+    assert(rc == SQLITE_OK);
+    {
+      sqlite::Statement stmt(fdb, "SELECT k FROM p WHERE within(x, 10);");
+      std::vector<int> keys;
+      for (auto [k] : stmt.Rows<int>()) keys.push_back(k);
+      assert((keys == std::vector<int>{1, 2, 3}));
+      assert(calls == 4);
+    }
+    // A deterministic call on constants is made once per statement.
+    calls = 0;
+    {
+      sqlite::Statement stmt(fdb, "SELECT k FROM p WHERE within(2, 10);");
+      assert(std::distance(stmt.Rows<int>().begin(), stmt.Rows<int>().end()) ==
+             4);
+      assert(calls == 1);
+    }
+    // Pure functions can be used in indexes.
+    assert(sqlite::Exec(fdb, "CREATE INDEX p_small ON p(within(x, 5));"));
+    // Text, blobs and nulls.
+    rc = sqlite::RegisterFunction(
+        fdb, "shout", sqlite::kPureFunction,
+        [](std::optional<sqlite::TextView> s) -> std::optional<sqlite::Text> {
+          if (!s.has_value()) return std::nullopt;
+          sqlite::Text loud(*s);
+          for (char& c : loud) c = static_cast<char>(std::toupper(c));
+          return loud;
+        });
+    assert(rc == SQLITE_OK);
+    rc = sqlite::RegisterFunction(fdb, "size", sqlite::kPureFunction,
+                                  [](sqlite::string_view b) {
+                                    return static_cast<sqlite::int64>(b.size());
+                                  });
+    assert(rc == SQLITE_OK);
+    {
+      sqlite::Statement stmt(
+          fdb, "SELECT shout(s), size(x'0102'), shout('') FROM p ORDER BY k;");
+      auto rows = stmt.Rows<std::optional<std::string>, int, std::string>();
+      std::vector<std::optional<std::string>> shouted;
+      for (auto [loud, size, empty] : rows) {
+        shouted.push_back(loud);
+        assert(size == 2 && empty.empty());
+      }
+      assert((shouted == std::vector<std::optional<std::string>>{
+                             "A", std::nullopt, "C", "D"}));
+    }
+    // Parameters and results take the same types: C strings are text and
+    // predicates are 0 or 1.
+    {
+      sqlite::Statement stmt(fdb, "SELECT typeof(?1), within(?2, 10);");
+      assert(stmt.Bind("text", 2.0));
+      auto row = stmt.GetRow<std::string, int>();
+      assert(row.has_value());
+      assert(std::get<0>(*row) == "text" && std::get<1>(*row) == 1);
+    }
+    // The wrong number of arguments is an error when preparing.
+    {
+      sqlite::Statement stmt(fdb, "SELECT within(1);");
+      assert(!stmt.ok());
+    }
+    // Raw values and contexts, for any number of arguments and errors.
+    rc = sqlite::RegisterFunction(
+        fdb, "first_int", sqlite::kPureFunction,
+        [](sqlite3_context* ctx, sqlite::FunctionArgs args) {
+          for (int i = 0; i < args.size; ++i) {
+            if (sqlite3_value_type(args[i]) == SQLITE_INTEGER) {
+              sqlite3_result_value(ctx, args[i]);
+              return;
+            }
+          }
+          sqlite3_result_error(ctx, "no integer", -1);
+        });
+    assert(rc == SQLITE_OK);
+    rc = sqlite::RegisterFunction(
+        fdb, "half", sqlite::kPureFunction,
+        [](sqlite3_value* v) { return sqlite3_value_double(v) / 2; });
+    assert(rc == SQLITE_OK);
+    {
+      sqlite::Statement stmt(fdb, "SELECT first_int('a', 2.5, 7, 8), half(3);");
+      auto row = stmt.GetRow<int, double>();
+      assert(row.has_value());
+      assert(std::get<0>(*row) == 7 && std::get<1>(*row) == 1.5);
+      sqlite::Statement fails(fdb, "SELECT first_int('a');");
+      assert(!fails.GetRow<int>().has_value());
+      assert(fails.rc() == SQLITE_ERROR);
+      assert(sqlite3_errmsg(fdb) == std::string("no integer"));
+    }
+    // Aggregates keep each group's state in sqlite's aggregate context.
+    rc = sqlite::RegisterAggregate<SumSquares>(fdb, "sum_squares",
+                                               sqlite::kPureFunction);
+    assert(rc == SQLITE_OK);
+    {
+      sqlite::Statement stmt(fdb, R"sql(
+        SELECT k % 2, sum_squares(x) FROM p GROUP BY k % 2 ORDER BY 1;
+      )sql");
+      std::vector<std::tuple<int, double>> sums;
+      for (auto row : stmt.Rows<int, double>()) sums.push_back(row);
+      assert((sums == std::vector<std::tuple<int, double>>{{0, 20.0},
+                                                           {1, 10.0}}));
+      sqlite::Statement none(fdb, "SELECT sum_squares(x) FROM p WHERE k > 9;");
+      assert(std::get<0>(*none.GetRow<double>()) == 0.0);
+      assert(SumSquares::live == 0);
+    }
+    // Aggregates with Inverse() are window functions too.
+    rc = sqlite::RegisterAggregate<Joined>(fdb, "joined",
+                                           sqlite::kPureFunction);
+    assert(rc == SQLITE_OK);
+    {
+      sqlite::Statement stmt(fdb, R"sql(
+        SELECT joined(s) OVER (ORDER BY k ROWS 1 PRECEDING) FROM p ORDER BY k;
+      )sql");
+      std::vector<std::string> frames;
+      for (auto [frame] : stmt.Rows<std::string>()) frames.push_back(frame);
+      assert((frames == std::vector<std::string>{"a", "a-", "-c", "cd"}));
+      sqlite::Statement whole(fdb, "SELECT joined(s) FROM p;");
+      assert(std::get<0>(*whole.GetRow<std::string>()) == "a-cd");
+    }
+    // Exceptions thrown by callbacks are the error results of their calls.
+    rc = sqlite::RegisterFunction(fdb, "fail", sqlite::kPureFunction,
+                                  [](double x) -> double {
+                                    if (x > 2) throw std::out_of_range("big");
+                                    return x;
+                                  });
+    assert(rc == SQLITE_OK);
+    rc = sqlite::RegisterAggregate<Throwing>(fdb, "throwing",
+                                             sqlite::kPureFunction);
+    assert(rc == SQLITE_OK);
+    {
+      sqlite::Statement stmt(fdb, "SELECT fail(x) FROM p ORDER BY k;");
+      auto rows = stmt.Rows<double>();
+      assert(std::distance(rows.begin(), rows.end()) == 2);
+      assert(stmt.rc() == SQLITE_ERROR);
+      assert(sqlite3_errmsg(fdb) == std::string("big"));
+      sqlite::Statement agg(fdb, "SELECT throwing(x) FROM p;");
+      assert(!agg.GetRow<double>().has_value());
+      assert(agg.rc() == SQLITE_ERROR);
+      assert(sqlite3_errmsg(fdb) == std::string("no result"));
+      assert(Throwing::live == 0);
+    }
+    assert(sqlite3_close(fdb) == SQLITE_OK);
+  }
+
   // We use sqlite3_close() instead of sqlite3_close_v2() so that we can
   // demonstrate that every prepared statement has been cleaned up upon
   // destruction.
@@ -0,0 +1,411 @@
+#ifndef THIRD_PARTY_SQLITE_SQLITE_FUNCTION_H_
+#define THIRD_PARTY_SQLITE_SQLITE_FUNCTION_H_
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace sqlite {
+
+// Flags for functions whose result depends only on their arguments and that
+// are safe to call from anywhere, including schema and triggers. sqlite can
+// then evaluate constant calls once per statement and use them in indexes.
+constexpr int kPureFunction = SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+
+// The arguments of a function that takes any number of them, when it is
+// declared as its only argument (after the context, if any).
+struct FunctionArgs {
+  int size;
+  sqlite3_value** values;
+
+  inline sqlite3_value* operator[](int i) const { return values[i]; }
+  // Reads argument i as one of the argument types below.
+  template <typename T>
+  T Get(int i) const;
+};
+
+namespace detail {
+
+// Reads a function argument, for SourceReader.
+struct ArgSource {
+  sqlite3_value* value;
+
+  int type() const { return sqlite3_value_type(value); }
+  int64 int64_value() const { return sqlite3_value_int64(value); }
+  int int_value() const { return sqlite3_value_int(value); }
+  double double_value() const { return sqlite3_value_double(value); }
+  const void* blob() const { return sqlite3_value_blob(value); }
+  const unsigned char* text() const { return sqlite3_value_text(value); }
+  int bytes() const { return sqlite3_value_bytes(value); }
+};
+
+// Reads function arguments, with the same types and conversions as
+// ColumnReader reads columns.
+template <typename Arg>
+struct ValueReader {
+  static Arg Read(sqlite3_value* value) {
+    return SourceReader<Arg>::Read(ArgSource{value});
+  }
+};
+
+template <>
+struct ValueReader<sqlite3_value*> {
+  static sqlite3_value* Read(sqlite3_value* value) { return value; }
+};
+
+template <typename Nullable>
+struct ValueReader<std::optional<Nullable>> {
+  static std::optional<Nullable> Read(sqlite3_value* value) {
+    if (sqlite3_value_type(value) == SQLITE_NULL) {
+      return std::nullopt;
+    } else {
+      return ValueReader<Nullable>::Read(value);
+    }
+  }
+};
+
+// Sets the result of a function call, for PutValue. sqlite copies strings and
+// blobs, since the values they view are gone once the function returns.
+struct ResultTarget {
+  sqlite3_context* ctx;
+
+  void SetInt64(int64 value) const { sqlite3_result_int64(ctx, value); }
+  void SetInt(int value) const { sqlite3_result_int(ctx, value); }
+  void SetDouble(double value) const { sqlite3_result_double(ctx, value); }
+  void SetBlob(const void* data, size_t size) const {
+    sqlite3_result_blob64(ctx, data, size, SQLITE_TRANSIENT);
+  }
+  void SetText(const char* data, size_t size) const {
+    sqlite3_result_text64(ctx, data, size, SQLITE_TRANSIENT, SQLITE_UTF8);
+  }
+  void SetZeroBlob(sqlite3_uint64 size) const {
+    sqlite3_result_zeroblob64(ctx, size);
+  }
+  void SetNull() const { sqlite3_result_null(ctx); }
+  void SetValue(sqlite3_value* value) const {
+    sqlite3_result_value(ctx, value);
+  }
+};
+
+// Sets the result of a function call, for the same types as BindParam binds.
+// Predicates are 0 or 1, as in SQL, since bool promotes to int.
+template <typename Result>
+void SetResult(sqlite3_context* ctx, const Result& result) {
+  PutValue(ResultTarget{ctx}, result);
+}
+
+// The return and argument types of a callable, with the arguments decayed to
+// the types they are read as.
+template <typename R, typename... A>
+struct Signature {
+  using Return = R;
+  using Args = std::tuple<std::decay_t<A>...>;
+};
+
+template <typename F>
+struct SignatureOf : SignatureOf<decltype(&F::operator())> {};
+
+template <typename R, typename... A>
+struct SignatureOf<R (*)(A...)> : Signature<R, A...> {};
+
+template <typename R, typename... A>
+struct SignatureOf<R(A...)> : Signature<R, A...> {};
+
+template <typename C, typename R, typename... A>
+struct SignatureOf<R (C::*)(A...)> : Signature<R, A...> {};
+
+template <typename C, typename R, typename... A>
+struct SignatureOf<R (C::*)(A...) const> : Signature<R, A...> {};
+
+// Whether a function's first argument is its sqlite3_context.
+template <typename Args>
+constexpr bool kTakesContext = false;
+
+template <typename... A>
+constexpr bool kTakesContext<std::tuple<sqlite3_context*, A...>> = true;
+
+// The number of SQL arguments a function takes, as sqlite3_create_function()
+// counts them: -1 for any number.
+template <typename Args>
+constexpr int Arity() {
+  constexpr size_t kSize =
+      std::tuple_size_v<Args> - (kTakesContext<Args> ? 1 : 0);
+  if constexpr (kSize == 1) {
+    using Last = std::tuple_element_t<std::tuple_size_v<Args> - 1, Args>;
+    if constexpr (std::is_same_v<Last, FunctionArgs>) return -1;
+  }
+  return static_cast<int>(kSize);
+}
+
+template <typename Arg>
+struct ArgReader {
+  static Arg Read(sqlite3_context*, int, sqlite3_value** argv, int index) {
+    return ValueReader<Arg>::Read(argv[index]);
+  }
+};
+
+template <>
+struct ArgReader<sqlite3_context*> {
+  static sqlite3_context* Read(sqlite3_context* ctx, int, sqlite3_value**,
+                               int) {
+    return ctx;
+  }
+};
+
+template <>
+struct ArgReader<FunctionArgs> {
+  static FunctionArgs Read(sqlite3_context*, int argc, sqlite3_value** argv,
+                           int) {
+    return FunctionArgs{/*size=*/argc, /*values=*/argv};
+  }
+};
+
+template <typename F, typename... Args, size_t... Pos>
+decltype(auto) DoInvoke(F&& f, sqlite3_context* ctx, int argc,
+                        sqlite3_value** argv, std::tuple<Args...>*,
+                        std::index_sequence<Pos...>) {
+  constexpr int kOffset = kTakesContext<std::tuple<Args...>> ? 1 : 0;
+  return f(ArgReader<Args>::Read(ctx, argc, argv,
+                                 static_cast<int>(Pos) - kOffset)...);
+}
+
+// Calls f with the arguments read as the types of Args.
+template <typename Args, typename F>
+decltype(auto) Invoke(F&& f, sqlite3_context* ctx, int argc,
+                      sqlite3_value** argv) {
+  return DoInvoke(std::forward<F>(f), ctx, argc, argv,
+                  static_cast<Args*>(nullptr),
+                  std::make_index_sequence<std::tuple_size_v<Args>>());
+}
+
+// Runs body, turning any exception it throws into the error result of the
+// call, since exceptions must not unwind through sqlite.
+template <typename Body>
+void CallGuarded(sqlite3_context* ctx, Body&& body) {
+  try {
+    body();
+  } catch (const std::bad_alloc&) {
+    sqlite3_result_error_nomem(ctx);
+  } catch (const std::exception& e) {
+    sqlite3_result_error(ctx, e.what(), -1);
+  } catch (...) {
+    sqlite3_result_error(ctx, "unknown exception", -1);
+  }
+}
+
+// Callbacks for a scalar function F, which is the user data.
+template <typename F>
+struct ScalarFunction {
+  using Sig = SignatureOf<F>;
+
+  static void Call(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    F& f = *static_cast<F*>(sqlite3_user_data(ctx));
+    CallGuarded(ctx, [&] {
+      if constexpr (std::is_void_v<typename Sig::Return>) {
+        Invoke<typename Sig::Args>(f, ctx, argc, argv);
+      } else {
+        SetResult(ctx, Invoke<typename Sig::Args>(f, ctx, argc, argv));
+      }
+    });
+  }
+
+  static void Destroy(void* f) { delete static_cast<F*>(f); }
+};
+
+template <typename Agg, typename = void>
+struct IsWindow : std::false_type {};
+
+template <typename Agg>
+struct IsWindow<Agg, std::void_t<decltype(&Agg::Inverse)>> : std::true_type {};
+
+// Callbacks for an aggregate (or window) function Agg. Each group's Agg is
+// constructed in sqlite's aggregate context on its first row, so calls
+// allocate nothing of their own.
+template <typename Agg>
+struct AggregateFunction {
+  using Sig = SignatureOf<decltype(&Agg::Step)>;
+
+  // sqlite3_aggregate_context() zeroes the memory it allocates.
+  struct State {
+    bool constructed;
+    alignas(Agg) unsigned char storage[sizeof(Agg)];
+  };
+  // sqlite only promises 8-byte alignment.
+  static_assert(alignof(Agg) <= 8, "aggregates must be at most 8-aligned");
+
+  static Agg* Get(sqlite3_context* ctx) {
+    auto* state = static_cast<State*>(
+        sqlite3_aggregate_context(ctx, static_cast<int>(sizeof(State))));
+    if (state == nullptr) return nullptr;
+    if (!state->constructed) {
+      new (state->storage) Agg();
+      state->constructed = true;
+    }
+    return std::launder(reinterpret_cast<Agg*>(state->storage));
+  }
+
+  static void Step(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    CallGuarded(ctx, [&] {
+      Agg* agg = Get(ctx);
+      if (agg == nullptr) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+      }
+      Invoke<typename Sig::Args>(
+          [agg](auto&&... args) {
+            agg->Step(std::forward<decltype(args)>(args)...);
+          },
+          ctx, argc, argv);
+    });
+  }
+
+  static void Inverse(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    CallGuarded(ctx, [&] {
+      Agg* agg = Get(ctx);
+      if (agg == nullptr) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+      }
+      Invoke<typename Sig::Args>(
+          [agg](auto&&... args) {
+            agg->Inverse(std::forward<decltype(args)>(args)...);
+          },
+          ctx, argc, argv);
+    });
+  }
+
+  static void Value(sqlite3_context* ctx) {
+    CallGuarded(ctx, [&] {
+      Agg* agg = Get(ctx);
+      if (agg == nullptr) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+      }
+      SetResult(ctx, agg->Result());
+    });
+  }
+
+  static void Final(sqlite3_context* ctx) {
+    // Asking for no memory only finds the state if a row was stepped.
+    auto* state = static_cast<State*>(sqlite3_aggregate_context(ctx, 0));
+    if (state == nullptr || !state->constructed) {
+      // An aggregate over no rows.
+      CallGuarded(ctx, [&] { SetResult(ctx, Agg().Result()); });
+      return;
+    }
+    Agg* agg = std::launder(reinterpret_cast<Agg*>(state->storage));
+    CallGuarded(ctx, [&] { SetResult(ctx, agg->Result()); });
+    // The state is destroyed even if Result() threw.
+    agg->~Agg();
+  }
+};
+
+}  // namespace detail
+
+template <typename T>
+T FunctionArgs::Get(int i) const {
+  return detail::ValueReader<T>::Read(values[i]);
+}
+
+// Registers f as the scalar SQL function name on db. f is a function pointer
+// or functor, which is copied, taking arguments of any type that a column can
+// be read as (int64, double, string_view, TextView, optional<>, ...) or the
+// raw sqlite3_value*, and returning any type that can be bound as a parameter
+// (or bool), which becomes its result. Text and blob arguments are views that
+// are only valid during the call. The number of arguments is checked by
+// sqlite: a call with the wrong number fails to prepare.
+//
+// A function whose first argument is sqlite3_context* is also given the
+// context, and one that returns void must set its result itself with
+// sqlite3_result_*() (or leave it NULL). That is the way to report errors,
+// with sqlite3_result_error(). A function whose only other argument is
+// FunctionArgs takes any number of arguments.
+//
+// flags are added to SQLITE_UTF8; pass kPureFunction (or either of its flags)
+// when it applies, so sqlite can factor calls out of loops and allow the
+// function in indexes. Returns the sqlite return code (rc).
+//
+// Example:
+//
+// RegisterFunction(db, "within", kPureFunction, [r](double x, double y) {
+//   return x * x + y * y < r * r;
+// });
+// Statement stmt(db, "SELECT id FROM points WHERE within(x, y);");
+template <typename F>
+int RegisterFunction(sqlite3* db, const char* name, int flags, F&& f) {
+  using Fn = std::decay_t<F>;
+  using Callbacks = detail::ScalarFunction<Fn>;
+  // sqlite calls Destroy on failure too.
+  return sqlite3_create_function_v2(
+      db, name, detail::Arity<typename Callbacks::Sig::Args>(),
+      SQLITE_UTF8 | flags, new Fn(std::forward<F>(f)), &Callbacks::Call,
+      nullptr, nullptr, &Callbacks::Destroy);
+}
+
+// Registers the aggregate SQL function name on db with Agg holding the state
+// of each group. Agg is default constructible and has
+//
+//   void Step(Args...);  // Adds a row's arguments, typed as for
+//                        // RegisterFunction().
+//   R Result();          // Returns the result for the rows added so far.
+//
+// If Agg also has
+//
+//   void Inverse(Args...);  // Removes the oldest row added.
+//
+// it is registered as an aggregate window function too, so sqlite can slide
+// the window frame rather than start every row again. Result() is then called
+// once per row. A group with no rows gets the Result() of a new Agg. flags
+// are as for RegisterFunction(). Returns the sqlite return code (rc).
+//
+// Example:
+//
+// struct SumSquares {
+//   void Step(double x) { sum += x * x; }
+//   void Inverse(double x) { sum -= x * x; }
+//   double Result() const { return sum; }
+//   double sum = 0;
+// };
+// RegisterAggregate<SumSquares>(db, "sum_squares", kPureFunction);
+// Statement stmt(db, R"sql(
+//   SELECT sum_squares(v) OVER (ORDER BY t ROWS 9 PRECEDING) FROM samples;
+// )sql");
+template <typename Agg>
+int RegisterAggregate(sqlite3* db, const char* name, int flags) {
+  using Callbacks = detail::AggregateFunction<Agg>;
+  int arity = detail::Arity<typename Callbacks::Sig::Args>();
+  if constexpr (detail::IsWindow<Agg>::value) {
+    static_assert(
+        std::is_same_v<typename Callbacks::Sig::Args,
+                       typename detail::SignatureOf<decltype(
+                           &Agg::Inverse)>::Args>,
+        "Inverse must take the same arguments as Step");
+    return sqlite3_create_window_function(
+        db, name, arity, SQLITE_UTF8 | flags, nullptr, &Callbacks::Step,
+        &Callbacks::Final, &Callbacks::Value, &Callbacks::Inverse, nullptr);
+  } else {
+    return sqlite3_create_function_v2(db, name, arity, SQLITE_UTF8 | flags,
+                                      nullptr, nullptr, &Callbacks::Step,
+                                      &Callbacks::Final, nullptr);
+  }
+}
+
+}  // namespace sqlite
+
+#endif  // THIRD_PARTY_SQLITE_SQLITE_FUNCTION_H_
@@ -0,0 +1,211 @@
+#include "sqlite_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+namespace sqlite {
+
+PooledConnection::~PooledConnection() {
+  // Statements must be finalized before the connection can close.
+  cache_.Clear();
+  sqlite3_close(db_);
+}
+
+ConnectionPool::Lease::Lease(Lease&& move_from) noexcept
+    : pool_(move_from.pool_), conn_(move_from.conn_) {
+  move_from.pool_ = nullptr;
+}
+
+ConnectionPool::Lease& ConnectionPool::Lease::operator=(
+    Lease&& move_from) noexcept {
+  if (this != &move_from) {
+    if (pool_ != nullptr) pool_->Return(conn_);
+    pool_ = move_from.pool_;
+    conn_ = move_from.conn_;
+    move_from.pool_ = nullptr;
+  }
+  return *this;
+}
+
+ConnectionPool::Lease::~Lease() {
+  if (pool_ != nullptr) pool_->Return(conn_);
+}
+
+ConnectionPool::ConnectionPool(const string& path, int num_readers,
+                               size_t cache_capacity) {
+  // The writer is opened first so that the database exists and is in WAL mode
+  // before any reader looks at it.
+  writer_ = Open(path,
+                 SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                     SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_URI,
+                 cache_capacity);
+  if (!ok()) return;
+  {
+    Statement wal(writer_->db(), "PRAGMA journal_mode=WAL;");
+    auto mode = wal.GetRow<string>();
+    if (!mode.has_value()) {
+      rc_ = wal.rc();
+    } else if (std::get<0>(*mode) != "wal") {
+      // In-memory and some VFS databases cannot use WAL.
+      rc_ = SQLITE_CANTOPEN;
+    }
+  }
+  for (int i = 0; ok() && i < num_readers; ++i) {
+    readers_.push_back(Open(path,
+                            SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX |
+                                SQLITE_OPEN_URI,
+                            cache_capacity));
+  }
+  if (!ok()) {
+    readers_.clear();
+    writer_.reset();
+    return;
+  }
+  for (auto& reader : readers_) idle_readers_.push_back(reader.get());
+}
+
+ConnectionPool::~ConnectionPool() = default;
+
+std::unique_ptr<PooledConnection> ConnectionPool::Open(const string& path,
+                                                       int flags,
+                                                       size_t cache_capacity) {
+  sqlite3* db = nullptr;
+  rc_ = sqlite3_open_v2(path.c_str(), &db, flags, nullptr);
+  if (rc_ != SQLITE_OK) {
+    // A handle is usually allocated even when opening fails.
+    sqlite3_close(db);
+    return nullptr;
+  }
+  // Other processes may be using the database too, so back off and retry
+  // when it's busy rather than failing straight away.
+  sqlite3_blocking_busy_backoff(db, &kDefaultBusyBackoff);
+  RegisterArrayFunction(db);
+  return std::make_unique<PooledConnection>(db, cache_capacity);
+}
+
+ConnectionPool::Lease ConnectionPool::Reader() {
+  if (readers_.empty()) return Writer();
+  auto lock = std::unique_lock(mutex_);
+  returned_.wait(lock, [this] { return !idle_readers_.empty(); });
+  PooledConnection* conn = idle_readers_.back();
+  idle_readers_.pop_back();
+  return Lease(this, conn);
+}
+
+ConnectionPool::Lease ConnectionPool::Writer() {
+  auto lock = std::unique_lock(mutex_);
+  returned_.wait(lock, [this] { return writer_idle_; });
+  writer_idle_ = false;
+  return Lease(this, writer_.get());
+}
+
+void ConnectionPool::Return(PooledConnection* conn) {
+  {
+    auto _lock = std::lock_guard(mutex_);
+    if (conn == writer_.get()) {
+      writer_idle_ = true;
+    } else {
+      idle_readers_.push_back(conn);
+    }
+  }
+  // Waiters for readers and for the writer share the condition.
+  returned_.notify_all();
+}
+
+std::vector<KeyRange> SplitKeyRange(int64 lo, int64 hi, int num_shards) {
+  std::vector<KeyRange> ranges;
+  if (lo > hi || num_shards < 1) return ranges;
+  // Computed unsigned so that the full int64 span doesn't overflow.
+  uint64_t span = static_cast<uint64_t>(hi) - static_cast<uint64_t>(lo);
+  uint64_t width = span / num_shards + 1;
+  uint64_t start = static_cast<uint64_t>(lo);
+  for (int i = 0; i < num_shards; ++i) {
+    uint64_t remaining = static_cast<uint64_t>(hi) - start;
+    uint64_t end = remaining < width ? static_cast<uint64_t>(hi)
+                                     : start + (width - 1);
+    ranges.push_back({static_cast<int64>(start), static_cast<int64>(end)});
+    if (end == static_cast<uint64_t>(hi)) break;
+    start = end + 1;
+  }
+  return ranges;
+}
+
+int SplitKeyRange(sqlite3* db, string_view bounds_sql, int num_shards,
+                  std::vector<KeyRange>* ranges) {
+  Statement bounds(db, bounds_sql);
+  auto row = bounds.GetRow<std::optional<int64>, std::optional<int64>>();
+  if (!row.has_value()) {
+    return bounds.done() ? SQLITE_MISMATCH : bounds.rc();
+  }
+  auto [lo, hi] = *row;
+  ranges->clear();
+  if (lo.has_value() && hi.has_value()) {
+    *ranges = SplitKeyRange(*lo, *hi, num_shards);
+  }
+  return SQLITE_OK;
+}
+
+namespace detail {
+
+int RunShards(ConnectionPool& pool, string_view sql,
+              const std::vector<KeyRange>& ranges,
+              const std::function<int(Statement& stmt, size_t i)>& scan) {
+  std::atomic<size_t> next{0};
+  std::atomic<int> first_error{SQLITE_OK};
+  // The first exception thrown by scan, rethrown once every worker is done.
+  std::mutex exception_mutex;
+  std::exception_ptr first_exception;
+  auto stop = [&](int rc) {
+    int expected = SQLITE_OK;
+    first_error.compare_exchange_strong(expected, rc);
+  };
+  // Each worker holds one connection and takes ranges until none are left,
+  // so that uneven ranges balance out.
+  auto work = [&] {
+    try {
+      auto conn = pool.Reader();
+      while (first_error.load() == SQLITE_OK) {
+        size_t i = next.fetch_add(1);
+        if (i >= ranges.size()) break;
+        auto stmt = conn.cache().Get(sql);
+        int rc = stmt->ok() && stmt->Set(":lo", ranges[i].lo) &&
+                         stmt->Set(":hi", ranges[i].hi)
+                     ? scan(*stmt, i)
+                     : stmt->rc();
+        stmt->Reset();
+        if (rc != SQLITE_OK) stop(rc);
+      }
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lock(exception_mutex);
+        if (!first_exception) first_exception = std::current_exception();
+      }
+      stop(SQLITE_ABORT);
+    }
+  };
+  size_t num_workers =
+      std::min(ranges.size(),
+               static_cast<size_t>(std::max(pool.num_readers(), 1)));
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < num_workers; ++i) workers.emplace_back(work);
+  if (num_workers > 0) work();
+  for (auto& worker : workers) worker.join();
+  if (first_exception) std::rethrow_exception(first_exception);
+  return first_error.load();
+}
+
+}  // namespace detail
+
+}  // namespace sqlite
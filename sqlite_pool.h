@@ -0,0 +1,243 @@
+#ifndef THIRD_PARTY_SQLITE_SQLITE_POOL_H_
+#define THIRD_PARTY_SQLITE_SQLITE_POOL_H_
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace sqlite {
+
+// A connection owned by a ConnectionPool, along with its statement cache.
+class PooledConnection {
+ public:
+  PooledConnection(sqlite3* db, size_t cache_capacity)
+      : db_(db), cache_(db, cache_capacity) {}
+  PooledConnection(const PooledConnection&) = delete;
+  PooledConnection& operator=(const PooledConnection&) = delete;
+  ~PooledConnection();
+
+  inline sqlite3* db() const { return db_; }
+  inline StatementCache& cache() { return cache_; }
+
+ private:
+  sqlite3* db_;
+  StatementCache cache_;
+};
+
+// A pool of connections to one on-disk database in WAL mode: a single writer
+// connection and any number of read-only connections, which can read
+// concurrently with each other and with the writer. Connections are handed out
+// as Leases that return them to the pool when destroyed. Each connection keeps
+// its own StatementCache, so the SQL used on it is prepared once. Every
+// connection retries busy locks with kDefaultBusyBackoff and has cpp_array()
+// registered.
+//
+// The pool is thread-safe; each lease is only to be used by one thread at a
+// time. All leases must be returned before the pool is destroyed.
+//
+// Example:
+//
+// ConnectionPool pool("data.db", 4);
+// if (!pool.ok()) cerr << "oh no! " << pool.errstr() << endl;
+// {
+//   auto conn = pool.Writer();
+//   auto stmt = conn.cache().Get("INSERT INTO users(name) VALUES (?);");
+//   stmt->Bind(name);
+//   stmt->Run();
+// }
+// {
+//   auto conn = pool.Reader();
+//   auto stmt = conn.cache().Get("SELECT count(*) FROM users;");
+//   auto row = stmt->GetRow<int64>();
+// }
+class ConnectionPool {
+ public:
+  class Lease {
+   public:
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    Lease(Lease&& move_from) noexcept;
+    Lease& operator=(Lease&& move_from) noexcept;
+    ~Lease();
+
+    inline sqlite3* db() const { return conn_->db(); }
+    inline StatementCache& cache() const { return conn_->cache(); }
+    inline PooledConnection* operator->() const { return conn_; }
+
+   private:
+    friend class ConnectionPool;
+    Lease(ConnectionPool* pool, PooledConnection* conn)
+        : pool_(pool), conn_(conn) {}
+
+    ConnectionPool* pool_;
+    PooledConnection* conn_;
+  };
+
+  // Opens (creating if necessary) the database at path, switches it to WAL
+  // mode and opens num_readers read-only connections to it. If anything
+  // fails, every connection is closed and the pool is left in an error state;
+  // connections must not be leased from a pool that is not ok().
+  ConnectionPool(const string& path, int num_readers,
+                 size_t cache_capacity = StatementCache::kDefaultCapacity);
+  ConnectionPool(const ConnectionPool&) = delete;
+  ConnectionPool& operator=(const ConnectionPool&) = delete;
+  ~ConnectionPool();
+
+  // Leases a read-only connection, blocking until one is available. If the
+  // pool has no readers, this leases the writer instead.
+  Lease Reader();
+  // Leases the writer connection, blocking until it is available.
+  Lease Writer();
+
+  inline int num_readers() const { return static_cast<int>(readers_.size()); }
+  inline bool ok() const { return rc_ == SQLITE_OK; }
+  inline int rc() const { return rc_; }
+  inline string_view errstr() const { return sqlite3_errstr(rc_); }
+
+ private:
+  void Return(PooledConnection* conn);
+  // Opens one connection with the given flags, setting rc_ on failure.
+  std::unique_ptr<PooledConnection> Open(const string& path, int flags,
+                                         size_t cache_capacity);
+
+  std::unique_ptr<PooledConnection> writer_;
+  std::vector<std::unique_ptr<PooledConnection>> readers_;
+  int rc_ = SQLITE_OK;
+
+  std::mutex mutex_;
+  std::condition_variable returned_;
+  // Guarded by mutex_.
+  std::vector<PooledConnection*> idle_readers_;
+  bool writer_idle_ = true;
+};
+
+// An inclusive range of integer keys, such as rowids, scanned by one shard of
+// a parallel scan.
+struct KeyRange {
+  int64 lo;
+  int64 hi;
+};
+
+// Splits the keys from lo to hi inclusive into at most num_shards contiguous
+// ranges of roughly equal width, in ascending order.
+std::vector<KeyRange> SplitKeyRange(int64 lo, int64 hi, int num_shards);
+
+// Runs bounds_sql, which must return the lowest and highest key as one row
+// (such as "SELECT min(rowid), max(rowid) FROM t;"), and splits that span
+// into *ranges with SplitKeyRange(). An empty table gives no ranges. Returns
+// the sqlite return code (rc).
+int SplitKeyRange(sqlite3* db, string_view bounds_sql, int num_shards,
+                  std::vector<KeyRange>* ranges);
+
+namespace detail {
+
+// Calls scan(stmt, i) for each range i, concurrently on up to num_readers()
+// of the pool's connections, with stmt prepared from sql and its :lo and :hi
+// parameters bound to the range. Stops starting shards after the first one
+// that returns an error, and returns that error. If scan throws, stops
+// starting shards too, and rethrows the first exception once every shard that
+// started has finished.
+int RunShards(ConnectionPool& pool, string_view sql,
+              const std::vector<KeyRange>& ranges,
+              const std::function<int(Statement& stmt, size_t i)>& scan);
+
+}  // namespace detail
+
+// Scans sql in parallel over the pool's readers, once per range, and reduces
+// the rows. sql must restrict itself to the range with parameters named :lo
+// and :hi, for example "... WHERE rowid BETWEEN :lo AND :hi". Each shard
+// starts a copy of init and calls fold(acc, row) on every row it reads; the
+// shards' results are then combined in range order with merge(acc, partial),
+// starting from the first, and stored in *result. init should be an identity
+// of merge, such as zero for a sum.
+//
+// fold is called concurrently from several threads, on different
+// accumulators. If fold throws, no more shards are started, and the first
+// exception is rethrown from the calling thread once the running shards have
+// finished. The calling thread must not hold a lease on a reader, which the
+// scan may wait for forever. Returns the sqlite return code (rc); *result is
+// only set on success.
+//
+// The result is not a consistent snapshot of the database. Each shard reads
+// in a transaction of its own, started when a reader picks up its range, so
+// a write committed while the scan runs is seen by the shards that start
+// after it and not by those before: a row moved between ranges can be counted
+// twice or missed. Scan while writes are held off if that matters.
+//
+// Example:
+//
+// std::vector<KeyRange> ranges;
+// SplitKeyRange(pool.Reader().db(), "SELECT min(rowid), max(rowid) FROM t;",
+//               pool.num_readers() * 4, &ranges);
+// int64 total;
+// int rc = ParallelReduce<int64>(
+//     pool, "SELECT v FROM t WHERE rowid BETWEEN :lo AND :hi;", ranges,
+//     int64{0}, [](int64& acc, const auto& row) { acc += std::get<0>(row); },
+//     [](int64& acc, int64 partial) { acc += partial; }, &total);
+template <typename... Cols, typename Acc, typename Fold, typename Merge>
+int ParallelReduce(ConnectionPool& pool, string_view sql,
+                   const std::vector<KeyRange>& ranges, const Acc& init,
+                   Fold fold, Merge merge, Acc* result) {
+  std::vector<Acc> partials(ranges.size(), init);
+  int rc = detail::RunShards(
+      pool, sql, ranges, [&](Statement& stmt, size_t i) {
+        Acc& acc = partials[i];
+        for (auto&& row : stmt.Rows<Cols...>()) fold(acc, row);
+        return stmt.done() ? SQLITE_OK : stmt.rc();
+      });
+  if (rc != SQLITE_OK) return rc;
+  if (partials.empty()) {
+    *result = init;
+    return SQLITE_OK;
+  }
+  Acc acc = std::move(partials[0]);
+  for (size_t i = 1; i < partials.size(); ++i) {
+    merge(acc, std::move(partials[i]));
+  }
+  *result = std::move(acc);
+  return SQLITE_OK;
+}
+
+// Scans sql in parallel as ParallelReduce() does, and like it not as one
+// snapshot, collecting every row into *rows in range order. If sql orders each
+// shard by the key the ranges split, the result is in key order. Returns the
+// sqlite return code (rc).
+//
+// Example:
+//
+// std::vector<std::tuple<int64, string>> rows;
+// ParallelCollect<int64, string>(
+//     pool, "SELECT k, v FROM t WHERE k BETWEEN :lo AND :hi ORDER BY k;",
+//     ranges, &rows);
+template <typename... Cols>
+int ParallelCollect(ConnectionPool& pool, string_view sql,
+                    const std::vector<KeyRange>& ranges,
+                    std::vector<detail::RowOf<Cols...>>* rows) {
+  using Rows = std::vector<detail::RowOf<Cols...>>;
+  return ParallelReduce<Cols...>(
+      pool, sql, ranges, Rows(),
+      [](Rows& acc, auto&& row) { acc.push_back(std::move(row)); },
+      [](Rows& acc, Rows&& partial) {
+        acc.insert(acc.end(), std::make_move_iterator(partial.begin()),
+                   std::make_move_iterator(partial.end()));
+      },
+      rows);
+}
+
+}  // namespace sqlite
+
+#endif  // THIRD_PARTY_SQLITE_SQLITE_POOL_H_
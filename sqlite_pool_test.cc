@@ -0,0 +1,154 @@
+#include "sqlite_pool.h"
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#undef NDEBUG  // always keep asserts
+
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace {
+
+const char kPath[] = "sqlite_pool_test.db";
+
+void RemoveDatabase() {
+  std::remove(kPath);
+  std::remove((std::string(kPath) + "-wal").c_str());
+  std::remove((std::string(kPath) + "-shm").c_str());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  RemoveDatabase();
+  {
+    sqlite::ConnectionPool pool(kPath, 3);
+    assert(pool.ok());
+    assert(pool.num_readers() == 3);
+    {
+      auto conn = pool.Writer();
+      assert(sqlite::Exec(conn.db(), R"sql(
+        CREATE TABLE t (k INTEGER PRIMARY KEY, v INTEGER);
+      )sql"));
+      auto stmt = conn.cache().Get("INSERT INTO t(k, v) VALUES (?, ?);");
+      auto batch = stmt->BatchSink(100);
+      for (int i = 0; i < 1000; ++i) batch.Write(std::make_tuple(i, i * 2));
+      assert(batch.Finish());
+    }
+    {
+      // Readers can't write.
+      auto conn = pool.Reader();
+      assert(sqlite::ExecRC(conn.db(), "DELETE FROM t;") == SQLITE_READONLY);
+    }
+    {
+      // A reader holding a read transaction open does not block the writer.
+      auto reader = pool.Reader();
+      auto scan = reader.cache().Get("SELECT v FROM t ORDER BY k;");
+      assert(scan->GetRow<int>().has_value());
+      auto writer = pool.Writer();
+      assert(sqlite::Exec(writer.db(), "INSERT INTO t(k, v) VALUES (-1, 0);"));
+    }
+    // Many threads share the readers, reusing each connection's statements.
+    std::vector<std::thread> threads;
+    std::vector<sqlite::int64> sums(8);
+    for (size_t i = 0; i < sums.size(); ++i) {
+      threads.emplace_back([&pool, &sums, i] {
+        for (int round = 0; round < 10; ++round) {
+          auto conn = pool.Reader();
+          auto stmt = conn.cache().Get("SELECT sum(v) FROM t WHERE k >= ?;");
+          stmt->Bind(0);
+          sums[i] += std::get<0>(*stmt->GetRow<sqlite::int64>());
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    for (auto sum : sums) assert(sum == 10 * 999 * 1000);
+    {
+      // Scans split into key ranges run on several readers at once.
+      std::vector<sqlite::KeyRange> ranges;
+      assert(sqlite::SplitKeyRange(pool.Reader().db(),
+                                   "SELECT min(k), max(k) FROM t;", 7,
+                                   &ranges) == SQLITE_OK);
+      assert(ranges.size() == 7);
+      assert(ranges.front().lo == -1 && ranges.back().hi == 999);
+      for (size_t i = 1; i < ranges.size(); ++i) {
+        assert(ranges[i].lo == ranges[i - 1].hi + 1);
+      }
+      sqlite::int64 total = -1;
+      assert(sqlite::ParallelReduce<sqlite::int64>(
+                 pool, "SELECT v FROM t WHERE k BETWEEN :lo AND :hi;", ranges,
+                 sqlite::int64{0},
+                 [](sqlite::int64& acc, const std::tuple<sqlite::int64>& row) {
+                   acc += std::get<0>(row);
+                 },
+                 [](sqlite::int64& acc, sqlite::int64 partial) {
+                   acc += partial;
+                 },
+                 &total) == SQLITE_OK);
+      assert(total == 999 * 1000);
+      std::vector<std::tuple<int, int>> rows;
+      int rc = sqlite::ParallelCollect<int, int>(
+          pool, "SELECT k, v FROM t WHERE k BETWEEN :lo AND :hi ORDER BY k;",
+          ranges, &rows);
+      assert(rc == SQLITE_OK);
+      assert(rows.size() == 1001);
+      for (size_t i = 0; i < rows.size(); ++i) {
+        assert(std::get<0>(rows[i]) == static_cast<int>(i) - 1);
+      }
+      // The shard's sql must have the range parameters.
+      rc = sqlite::ParallelCollect<int, int>(pool, "SELECT k, v FROM t;",
+                                             ranges, &rows);
+      assert(rc == SQLITE_RANGE);
+      // An exception thrown by fold on a worker reaches the caller, once every
+      // worker has stopped.
+      bool thrown = false;
+      try {
+        sqlite::ParallelReduce<int>(
+            pool, "SELECT k FROM t WHERE k BETWEEN :lo AND :hi;", ranges, 0,
+            [](int& acc, const std::tuple<int>& row) {
+              if (std::get<0>(row) == 500) throw std::runtime_error("500");
+              acc += std::get<0>(row);
+            },
+            [](int& acc, int partial) { acc += partial; }, &rc);
+      } catch (const std::runtime_error& e) {
+        thrown = std::string(e.what()) == "500";
+      }
+      assert(thrown);
+      assert(sqlite::SplitKeyRange(0, 2, 5).size() == 3);
+      assert(sqlite::SplitKeyRange(INT64_MIN, INT64_MAX, 2).size() == 2);
+    }
+    // Leases are returned to the pool, so later threads can reuse them.
+    auto a = pool.Reader();
+    auto b = pool.Reader();
+    auto c = pool.Reader();
+    assert(a.db() != b.db() && b.db() != c.db() && a.db() != c.db());
+    b = std::move(c);
+    auto d = pool.Reader();
+    assert(d.db() != a.db() && d.db() != b.db());
+  }
+  {
+    // In-memory databases can't be shared in WAL mode.
+    sqlite::ConnectionPool pool(":memory:", 2);
+    assert(!pool.ok());
+  }
+  RemoveDatabase();
+
+  std::cout << "Ok!" << std::endl;
+  return 0;
+}
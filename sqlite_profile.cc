@@ -0,0 +1,196 @@
+#include "sqlite_profile.h"
+
+#include <limits>
+#include <sstream>
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+namespace sqlite {
+
+namespace {
+
+// Reads and resets a statement status counter, so that each run reports only
+// its own work.
+int64 TakeStatus(sqlite3_stmt* stmt, int op) {
+  return sqlite3_stmt_status(stmt, op, 1);
+}
+
+// Escapes a Prometheus label value.
+string EscapeLabel(string_view value) {
+  string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    if (c == '\\') {
+      escaped += "\\\\";
+    } else if (c == '"') {
+      escaped += "\\\"";
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+}  // namespace
+
+int QueryProfiler::Attach(sqlite3* db, bool count_rows) {
+  unsigned mask = SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE;
+  if (count_rows) mask |= SQLITE_TRACE_ROW;
+  return sqlite3_trace_v2(db, mask, &QueryProfiler::Trace, this);
+}
+
+int QueryProfiler::Detach(sqlite3* db) {
+  return sqlite3_trace_v2(db, 0, nullptr, nullptr);
+}
+
+Statement QueryProfiler::Prepare(sqlite3* db, string_view sql,
+                                 bool must_compile_all) {
+  auto start = Clock::now();
+  Statement stmt(db, sql, must_compile_all);
+  int64 elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start)
+                      .count();
+  const char* text = stmt.ok() ? sqlite3_sql(stmt.stmt_) : nullptr;
+  if (text != nullptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    QueryStats& stats = StatsFor(text);
+    ++stats.prepares;
+    stats.prepare_ns += elapsed;
+  }
+  return stmt;
+}
+
+std::vector<QueryStats> QueryProfiler::Snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<QueryStats> snapshot;
+  snapshot.reserve(stats_.size());
+  for (const auto& [sql, stats] : stats_) snapshot.push_back(stats);
+  return snapshot;
+}
+
+void QueryProfiler::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.clear();
+}
+
+string QueryProfiler::PrometheusText() const {
+  // Counters are exact integers; only the times are fractional.
+  struct Metric {
+    const char* name;
+    const char* help;
+    int64 (*count)(const QueryStats&);
+    double (*seconds)(const QueryStats&);
+  };
+  static const Metric kMetrics[] = {
+      {"sqlite_query_prepares_total", "Times the query was prepared.",
+       [](const QueryStats& s) { return s.prepares; }, nullptr},
+      {"sqlite_query_prepare_seconds_total", "Time spent preparing the query.",
+       nullptr, [](const QueryStats& s) { return s.prepare_ns / 1e9; }},
+      {"sqlite_query_runs_total", "Times the query ran.",
+       [](const QueryStats& s) { return s.runs; }, nullptr},
+      {"sqlite_query_run_wall_seconds_total",
+       "Wall time from the first step of each run of the query to its end.",
+       nullptr, [](const QueryStats& s) { return s.run_wall_ns / 1e9; }},
+      {"sqlite_query_rows_total", "Rows returned by the query.",
+       [](const QueryStats& s) { return s.rows; }, nullptr},
+      {"sqlite_query_fullscan_steps_total",
+       "Steps through full table scans by the query.",
+       [](const QueryStats& s) { return s.fullscan_steps; }, nullptr},
+      {"sqlite_query_sorts_total", "Sorts done by the query.",
+       [](const QueryStats& s) { return s.sorts; }, nullptr},
+      {"sqlite_query_autoindexes_total",
+       "Automatic indexes built by the query.",
+       [](const QueryStats& s) { return s.autoindexes; }, nullptr},
+      {"sqlite_query_vm_steps_total",
+       "Virtual machine operations run by the query.",
+       [](const QueryStats& s) { return s.vm_steps; }, nullptr},
+      {"sqlite_query_lock_wait_seconds_total",
+       "Time the query spent waiting for locks.",
+       nullptr, [](const QueryStats& s) { return s.lock_wait_us / 1e6; }},
+  };
+  std::vector<QueryStats> snapshot = Snapshot();
+  std::ostringstream out;
+  // Enough digits that times read back exactly and never lose precision to
+  // scientific notation.
+  out.precision(std::numeric_limits<double>::max_digits10);
+  for (const Metric& metric : kMetrics) {
+    out << "# HELP " << metric.name << " " << metric.help << "\n";
+    out << "# TYPE " << metric.name << " counter\n";
+    for (const QueryStats& stats : snapshot) {
+      out << metric.name << "{sql=\"" << EscapeLabel(stats.sql) << "\"} ";
+      if (metric.count != nullptr) {
+        out << metric.count(stats);
+      } else {
+        out << metric.seconds(stats);
+      }
+      out << "\n";
+    }
+  }
+  return out.str();
+}
+
+int QueryProfiler::Trace(unsigned type, void* context, void* p, void* x) {
+  auto* profiler = static_cast<QueryProfiler*>(context);
+  auto* stmt = static_cast<sqlite3_stmt*>(p);
+  if (type == SQLITE_TRACE_STMT) {
+    // Triggers report their statements too, with the trigger's name in place
+    // of the statement's own text; only count top-level runs.
+    if (x != static_cast<const void*>(sqlite3_sql(stmt))) return 0;
+    Run run;
+    run.start = Clock::now();
+    run.wait_us_at_start = sqlite3_blocking_thread_wait_us();
+    std::lock_guard<std::mutex> lock(profiler->mutex_);
+    profiler->running_[stmt] = run;
+  } else if (type == SQLITE_TRACE_ROW) {
+    std::lock_guard<std::mutex> lock(profiler->mutex_);
+    auto it = profiler->running_.find(stmt);
+    if (it != profiler->running_.end()) ++it->second.rows;
+  } else if (type == SQLITE_TRACE_PROFILE) {
+    // sqlite's own measurement only has millisecond resolution on most
+    // platforms, so prefer timing the run here.
+    auto end = Clock::now();
+    int64 elapsed_ns = *static_cast<sqlite3_int64*>(x);
+    int64 fullscan_steps = TakeStatus(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP);
+    int64 sorts = TakeStatus(stmt, SQLITE_STMTSTATUS_SORT);
+    int64 autoindexes = TakeStatus(stmt, SQLITE_STMTSTATUS_AUTOINDEX);
+    int64 vm_steps = TakeStatus(stmt, SQLITE_STMTSTATUS_VM_STEP);
+    int64 wait_us = sqlite3_blocking_thread_wait_us();
+    const char* sql = sqlite3_sql(stmt);
+    if (sql == nullptr) return 0;
+    std::lock_guard<std::mutex> lock(profiler->mutex_);
+    QueryStats& stats = profiler->StatsFor(sql);
+    ++stats.runs;
+    stats.fullscan_steps += fullscan_steps;
+    stats.sorts += sorts;
+    stats.autoindexes += autoindexes;
+    stats.vm_steps += vm_steps;
+    auto it = profiler->running_.find(stmt);
+    if (it != profiler->running_.end()) {
+      elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       end - it->second.start)
+                       .count();
+      stats.rows += it->second.rows;
+      stats.lock_wait_us += wait_us - it->second.wait_us_at_start;
+      profiler->running_.erase(it);
+    }
+    stats.run_wall_ns += elapsed_ns;
+  }
+  return 0;
+}
+
+QueryStats& QueryProfiler::StatsFor(const char* sql) {
+  auto [it, inserted] = stats_.try_emplace(sql);
+  if (inserted) it->second.sql = it->first;
+  return it->second;
+}
+
+}  // namespace sqlite
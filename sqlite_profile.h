@@ -0,0 +1,115 @@
+#ifndef THIRD_PARTY_SQLITE_SQLITE_PROFILE_H_
+#define THIRD_PARTY_SQLITE_SQLITE_PROFILE_H_
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sqlite_blocking.h"
+#include "sqlite_cpp.h"
+
+namespace sqlite {
+
+// Counters accumulated for one SQL text by a QueryProfiler.
+struct QueryStats {
+  string sql;
+  // Times the statement was prepared through QueryProfiler::Prepare(), and
+  // the total time that took.
+  int64 prepares = 0;
+  int64 prepare_ns = 0;
+  // Times the statement ran to completion or was reset partway through, and
+  // the total wall time from its first step to then. sqlite doesn't report
+  // when each step starts, so this stands in for the time spent stepping, but
+  // it also counts the caller's time between steps: a query read by a slow
+  // consumer looks slower than it is.
+  int64 runs = 0;
+  int64 run_wall_ns = 0;
+  // Result rows produced, if the profiler was attached with count_rows.
+  int64 rows = 0;
+  // From sqlite3_stmt_status(): steps through full table scans, sorts,
+  // automatic indexes built, and virtual machine operations.
+  int64 fullscan_steps = 0;
+  int64 sorts = 0;
+  int64 autoindexes = 0;
+  int64 vm_steps = 0;
+  // Time the running thread spent waiting for locks during runs; see
+  // sqlite3_blocking_thread_wait_us(). Statements running interleaved on one
+  // thread are each charged for the waits of the other.
+  int64 lock_wait_us = 0;
+};
+
+// Opt-in registry of per-query statistics for the connections it is attached
+// to, keyed by SQL text across connections. Attaching installs a
+// sqlite3_trace_v2() callback that is invoked as each statement starts and
+// finishes (and, with count_rows, for every row), so it costs a mutex lock
+// per run; unattached connections pay nothing.
+//
+// Thread-safe. Connections must be detached or closed before the profiler is
+// destroyed.
+//
+// Example:
+//
+// QueryProfiler profiler;
+// profiler.Attach(db);
+// ...
+// // Find the queries doing full table scans.
+// for (const QueryStats& stats : profiler.Snapshot()) {
+//   if (stats.fullscan_steps > 0) cerr << stats.sql << endl;
+// }
+// // Or serve this for Prometheus to scrape:
+// string metrics = profiler.PrometheusText();
+class QueryProfiler {
+ public:
+  QueryProfiler() = default;
+  QueryProfiler(const QueryProfiler&) = delete;
+  QueryProfiler& operator=(const QueryProfiler&) = delete;
+
+  // Starts profiling db, replacing any trace callback it had. Returns the
+  // sqlite return code (rc).
+  int Attach(sqlite3* db, bool count_rows = true);
+  // Stops profiling db.
+  static int Detach(sqlite3* db);
+
+  // Prepares a Statement, recording how long preparing took.
+  Statement Prepare(sqlite3* db, string_view sql, bool must_compile_all = true);
+
+  // Returns a copy of the statistics of every query seen so far.
+  std::vector<QueryStats> Snapshot() const;
+  // Forgets all statistics.
+  void Clear();
+
+  // Renders the statistics in the Prometheus text exposition format, as
+  // counters named sqlite_query_* labelled with the sql.
+  string PrometheusText() const;
+
+ private:
+  static int Trace(unsigned type, void* context, void* p, void* x);
+
+  // State of a statement between its first step and finishing.
+  struct Run {
+    Clock::time_point start;
+    int64 rows = 0;
+    int64 wait_us_at_start = 0;
+  };
+
+  QueryStats& StatsFor(const char* sql);
+
+  mutable std::mutex mutex_;
+  // Guarded by mutex_.
+  std::unordered_map<string, QueryStats> stats_;
+  std::unordered_map<sqlite3_stmt*, Run> running_;
+};
+
+}  // namespace sqlite
+
+#endif  // THIRD_PARTY_SQLITE_SQLITE_PROFILE_H_
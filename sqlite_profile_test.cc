@@ -0,0 +1,166 @@
+#include "sqlite_profile.h"
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#undef NDEBUG  // always keep asserts
+
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sqlite_blocking.h"
+#include "sqlite_cpp.h"
+
+namespace {
+
+const sqlite::QueryStats* Find(const std::vector<sqlite::QueryStats>& snapshot,
+                               const std::string& sql) {
+  for (const sqlite::QueryStats& stats : snapshot) {
+    if (stats.sql == sql) return &stats;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  {
+    // Runs, rows and statement counters are attributed to the query text.
+    sqlite3* db;
+    assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+    assert(sqlite::Exec(db, R"sql(
+      CREATE TABLE t (k INTEGER PRIMARY KEY, v INTEGER);
+      INSERT INTO t(k, v) VALUES (1, 30), (2, 20), (3, 10);
+    )sql"));
+    sqlite::QueryProfiler profiler;
+    assert(profiler.Attach(db) == SQLITE_OK);
+    const std::string kScan = "SELECT k FROM t ORDER BY v;";
+    const std::string kLookup = "SELECT v FROM t WHERE k = ?;";
+    {
+      sqlite::Statement scan = profiler.Prepare(db, kScan);
+      assert(scan.ok());
+      for (int i = 0; i < 2; ++i) {
+        int count = 0;
+        for (auto [k] : scan.Rows<int>()) count += k;
+        assert(scan.done() && count == 6);
+      }
+      sqlite::Statement lookup(db, kLookup);
+      assert(lookup.Bind(2));
+      assert(std::get<0>(*lookup.GetRow<int>()) == 20);
+      lookup.Reset();  // Stopping partway still counts as a run.
+    }
+    std::vector<sqlite::QueryStats> snapshot = profiler.Snapshot();
+    const sqlite::QueryStats* scan = Find(snapshot, kScan);
+    assert(scan != nullptr);
+    assert(scan->prepares == 1);
+    assert(scan->prepare_ns > 0);
+    assert(scan->runs == 2);
+    assert(scan->run_wall_ns > 0);
+    assert(scan->rows == 6);
+    assert(scan->fullscan_steps == 4);
+    assert(scan->sorts == 2);
+    assert(scan->vm_steps > 0);
+    const sqlite::QueryStats* lookup = Find(snapshot, kLookup);
+    assert(lookup != nullptr);
+    assert(lookup->prepares == 0);
+    assert(lookup->runs == 1);
+    assert(lookup->rows == 1);
+    assert(lookup->fullscan_steps == 0);
+    assert(lookup->sorts == 0);
+
+    // Triggers don't count as runs of their own.
+    assert(sqlite::Exec(db, R"sql(
+      CREATE TABLE log (k INTEGER);
+      CREATE TRIGGER t_log AFTER UPDATE ON t BEGIN
+        INSERT INTO log(k) VALUES (new.k);
+      END;
+    )sql"));
+    profiler.Clear();
+    assert(sqlite::Exec(db, "UPDATE t SET v = v + 1;"));
+    snapshot = profiler.Snapshot();
+    assert(snapshot.size() == 1);
+    assert(snapshot[0].sql == "UPDATE t SET v = v + 1;");
+    assert(snapshot[0].runs == 1);
+
+    // Queries that start with a comment are not mistaken for triggers.
+    profiler.Clear();
+    const std::string kCommented = "-- c\nSELECT 1 UNION ALL SELECT 2;";
+    assert(sqlite::Exec(db, kCommented));
+    snapshot = profiler.Snapshot();
+    assert(snapshot.size() == 1);
+    assert(snapshot[0].sql == kCommented);
+    assert(snapshot[0].runs == 1);
+    assert(snapshot[0].rows == 2);
+
+    // Metrics are exported with escaped labels.
+    profiler.Clear();
+    assert(sqlite::Exec(db, "SELECT \"k\"\nFROM t;"));
+    std::string text = profiler.PrometheusText();
+    assert(text.find("# TYPE sqlite_query_runs_total counter\n") !=
+           std::string::npos);
+    assert(text.find("sqlite_query_runs_total{sql=\"SELECT \\\"k\\\"\\nFROM "
+                     "t;\"} 1\n") != std::string::npos);
+    assert(text.find("sqlite_query_rows_total{sql=\"SELECT \\\"k\\\"\\nFROM "
+                     "t;\"} 3\n") != std::string::npos);
+    // Large counters keep every digit.
+    profiler.Clear();
+    const std::string kCount = R"sql(WITH RECURSIVE c(x) AS (
+      SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1234567
+    ) SELECT x FROM c;)sql";
+    assert(sqlite::Exec(db, kCount));
+    text = profiler.PrometheusText();
+    size_t rows = text.find("\nsqlite_query_rows_total{");
+    assert(rows != std::string::npos);
+    assert(text.find("\"} 1234567\n", rows) < text.find("\n# HELP", rows));
+    assert(text.find("e+") == std::string::npos);
+
+    // Detached connections are no longer profiled.
+    assert(sqlite::QueryProfiler::Detach(db) == SQLITE_OK);
+    profiler.Clear();
+    assert(sqlite::Exec(db, "SELECT k FROM t;"));
+    assert(profiler.Snapshot().empty());
+    assert(sqlite3_close(db) == SQLITE_OK);
+  }
+
+  {
+    // Time spent waiting for a busy database is charged to the query.
+    const char* path = "sqlite_profile_test.db";
+    std::remove(path);
+    sqlite3* holder;
+    sqlite3* waiter;
+    assert(sqlite3_open(path, &holder) == SQLITE_OK);
+    assert(sqlite3_open(path, &waiter) == SQLITE_OK);
+    sqlite3_blocking_backoff quick = {1000, 10000, 30000};
+    assert(sqlite3_blocking_busy_backoff(waiter, &quick) == SQLITE_OK);
+    assert(sqlite::Exec(holder, "CREATE TABLE t (k INTEGER PRIMARY KEY);"));
+    sqlite::QueryProfiler profiler;
+    assert(profiler.Attach(waiter, false) == SQLITE_OK);
+    assert(sqlite::Exec(holder, "BEGIN IMMEDIATE;"));
+    assert(sqlite::ExecRC(waiter, "INSERT INTO t(k) VALUES (1);") ==
+           SQLITE_BUSY);
+    assert(sqlite::Exec(holder, "COMMIT;"));
+    std::vector<sqlite::QueryStats> snapshot = profiler.Snapshot();
+    const sqlite::QueryStats* insert =
+        Find(snapshot, "INSERT INTO t(k) VALUES (1);");
+    assert(insert != nullptr);
+    assert(insert->runs == 1);
+    assert(insert->lock_wait_us >= 20000);
+    assert(sqlite3_close(holder) == SQLITE_OK);
+    assert(sqlite3_close(waiter) == SQLITE_OK);
+    std::remove(path);
+  }
+
+  std::cout << "Ok!" << std::endl;
+  return 0;
+}
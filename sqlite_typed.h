@@ -0,0 +1,275 @@
+#ifndef THIRD_PARTY_SQLITE_SQLITE_TYPED_H_
+#define THIRD_PARTY_SQLITE_SQLITE_TYPED_H_
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#include <cstddef>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace sqlite {
+
+// Type lists naming the parameter and result column types of a
+// TypedStatement.
+template <typename... Types>
+struct Params {};
+template <typename... Types>
+struct Cols {};
+
+namespace detail {
+
+constexpr bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+constexpr bool IsIdentifierChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || IsDigit(c) ||
+         c == '_' || c == '$' || static_cast<unsigned char>(c) >= 0x80;
+}
+
+constexpr bool SameName(const char* a, size_t a_size, const char* b,
+                        size_t b_size) {
+  if (a_size != b_size) return false;
+  for (size_t i = 0; i < a_size; ++i) {
+    if (a[i] != b[i]) return false;
+  }
+  return true;
+}
+
+// Most distinct named parameters CountParams() can keep track of.
+constexpr int kMaxNamedParams = 64;
+
+// Returns the number of parameters in sql as sqlite3_bind_parameter_count()
+// would: the largest parameter index, where ?NNN has index NNN and each other
+// parameter gets the next index when its name first appears. Literals,
+// quoted identifiers and comments are skipped. Returns -1 if there are more
+// than kMaxNamedParams distinct names.
+constexpr int CountParams(const char* sql) {
+  const char* names[kMaxNamedParams] = {};
+  size_t name_sizes[kMaxNamedParams] = {};
+  int num_names = 0;
+  int count = 0;
+  size_t i = 0;
+  while (sql[i] != 0) {
+    char c = sql[i];
+    if (c == '\'' || c == '"' || c == '`' || c == '[') {
+      // Doubled quotes inside a literal just end and restart it.
+      char close = c == '[' ? ']' : c;
+      ++i;
+      while (sql[i] != 0 && sql[i] != close) ++i;
+      if (sql[i] != 0) ++i;
+    } else if (c == '-' && sql[i + 1] == '-') {
+      while (sql[i] != 0 && sql[i] != '\n') ++i;
+    } else if (c == '/' && sql[i + 1] == '*') {
+      i += 2;
+      while (sql[i] != 0 && !(sql[i] == '*' && sql[i + 1] == '/')) ++i;
+      if (sql[i] != 0) i += 2;
+    } else if (c == '?') {
+      ++i;
+      if (IsDigit(sql[i])) {
+        int index = 0;
+        while (IsDigit(sql[i])) index = index * 10 + (sql[i++] - '0');
+        if (index > count) count = index;
+      } else {
+        ++count;
+      }
+    } else if (c == ':' || c == '@' || c == '$') {
+      size_t start = i++;
+      while (IsIdentifierChar(sql[i])) ++i;
+      size_t size = i - start;
+      if (size == 1) continue;
+      bool seen = false;
+      for (int n = 0; n < num_names && !seen; ++n) {
+        seen = SameName(names[n], name_sizes[n], sql + start, size);
+      }
+      if (seen) continue;
+      if (num_names == kMaxNamedParams) return -1;
+      names[num_names] = sql + start;
+      name_sizes[num_names] = size;
+      ++num_names;
+      ++count;
+    } else if (IsIdentifierChar(c)) {
+      // Skip whole words, which may contain '$'.
+      while (IsIdentifierChar(sql[i])) ++i;
+    } else {
+      ++i;
+    }
+  }
+  return count;
+}
+
+// Column affinity determined from a declared type, following
+// https://www.sqlite.org/datatype3.html#determination_of_column_affinity
+enum class Affinity { kUnknown, kInteger, kText, kBlob, kReal, kNumeric };
+
+inline bool DeclContains(const char* decl, const char* word) {
+  for (; *decl != 0; ++decl) {
+    size_t i = 0;
+    while (word[i] != 0 && decl[i] != 0 &&
+           (decl[i] | 0x20) == (word[i] | 0x20)) {
+      ++i;
+    }
+    if (word[i] == 0) return true;
+  }
+  return false;
+}
+
+inline Affinity DeclaredAffinity(const char* decl) {
+  // Expressions have no declared type.
+  if (decl == nullptr || *decl == 0) return Affinity::kUnknown;
+  if (DeclContains(decl, "int")) return Affinity::kInteger;
+  if (DeclContains(decl, "char") || DeclContains(decl, "clob") ||
+      DeclContains(decl, "text")) {
+    return Affinity::kText;
+  }
+  if (DeclContains(decl, "blob")) return Affinity::kBlob;
+  if (DeclContains(decl, "real") || DeclContains(decl, "floa") ||
+      DeclContains(decl, "doub")) {
+    return Affinity::kReal;
+  }
+  return Affinity::kNumeric;
+}
+
+// Whether a column declared with the given affinity can be read as Col.
+// Strings and blobs can hold anything, so they accept every affinity. Columns
+// without a declared type, such as count(*) or upper(name), may hold anything
+// too, so every type accepts them.
+template <typename Col>
+struct AcceptsAffinity {
+  static bool Accepts(Affinity) { return true; }
+};
+
+template <typename Integer>
+struct IntegerAcceptsAffinity {
+  static bool Accepts(Affinity affinity) {
+    return affinity == Affinity::kUnknown || affinity == Affinity::kInteger ||
+           affinity == Affinity::kNumeric;
+  }
+};
+
+template <>
+struct AcceptsAffinity<int64> : IntegerAcceptsAffinity<int64> {};
+template <>
+struct AcceptsAffinity<long> : IntegerAcceptsAffinity<long> {};
+template <>
+struct AcceptsAffinity<int> : IntegerAcceptsAffinity<int> {};
+
+template <>
+struct AcceptsAffinity<double> {
+  static bool Accepts(Affinity affinity) {
+    return affinity == Affinity::kUnknown || affinity == Affinity::kReal ||
+           affinity == Affinity::kInteger || affinity == Affinity::kNumeric;
+  }
+};
+
+template <>
+struct AcceptsAffinity<Text> {
+  static bool Accepts(Affinity affinity) {
+    return affinity == Affinity::kUnknown || affinity == Affinity::kText ||
+           affinity == Affinity::kNumeric;
+  }
+};
+
+template <>
+struct AcceptsAffinity<TextView> : AcceptsAffinity<Text> {};
+
+template <typename Nullable>
+struct AcceptsAffinity<std::optional<Nullable>> : AcceptsAffinity<Nullable> {};
+
+}  // namespace detail
+
+// A Statement whose parameter and result column types are part of its type.
+// The number of parameters in Sql is checked against ParamList at compile
+// time. When the statement is prepared, its column count and the declared
+// types of its columns are checked against ColList once, so reading rows does
+// no checking at all; if they don't match, rc() is SQLITE_MISMATCH. Parameters
+// are always bound by position, so named parameters are never looked up by
+// name; each name is bound at the position where it first appears.
+//
+// Sql must be a constant with static storage duration.
+//
+// Example:
+//
+// constexpr char kUpsert[] = R"sql(
+//   INSERT INTO users(id, name) VALUES (:id, :name)
+//   ON CONFLICT(id) DO UPDATE SET name = :name;
+// )sql";
+// TypedStatement<kUpsert, Params<int64, TextView>, Cols<>> upsert(db);
+// upsert.Bind(id, name);
+// upsert.Run();
+template <const char* Sql, typename... ParamTypes, typename... ColTypes>
+class TypedStatement<Sql, Params<ParamTypes...>, Cols<ColTypes...>> {
+ private:
+  static constexpr int kParamCount = detail::CountParams(Sql);
+  static_assert(kParamCount >= 0, "too many named parameters to count");
+  static_assert(kParamCount == sizeof...(ParamTypes),
+                "parameter types don't match the parameters in the sql");
+
+ public:
+  explicit TypedStatement(sqlite3* db, bool must_compile_all = true)
+      : stmt_(db, Sql, must_compile_all) {
+    if (stmt_.stmt_ == nullptr) return;
+    if (sqlite3_bind_parameter_count(stmt_.stmt_) != kParamCount) {
+      // Only possible if CountParams() misread the sql.
+      stmt_.rc_ = SQLITE_RANGE;
+    } else if (sqlite3_column_count(stmt_.stmt_) != sizeof...(ColTypes) ||
+               !CheckColumns(std::index_sequence_for<ColTypes...>())) {
+      stmt_.rc_ = SQLITE_MISMATCH;
+    }
+  }
+
+  inline void Reset() { stmt_.Reset(); }
+
+  // Binds every parameter, returning false if an error occurs.
+  bool Bind(const ParamTypes&... params) { return stmt_.Bind(params...); }
+
+  // Binds every parameter, copying strings. Returns false if an error occurs.
+  bool BindCopy(const ParamTypes&... params) {
+    return stmt_.BindCopy(params...);
+  }
+
+  // Advances the statement to read a row if present. If there are no more rows
+  // or there is an error, returns nullopt.
+  std::optional<std::tuple<ColTypes...>> GetRow() {
+    return stmt_.template GetRow<ColTypes...>();
+  }
+
+  // Resets and runs a statement expecting no returned rows. Returns false if an
+  // error occurs or a row was returned.
+  bool Run() { return stmt_.Run(); }
+
+  // Returns an iterable that yields all the rows from this query; see
+  // Statement::Rows().
+  auto Rows() { return stmt_.template Rows<ColTypes...>(); }
+
+  // The underlying Statement, for everything else.
+  inline Statement& statement() { return stmt_; }
+
+  inline bool ok() const { return stmt_.ok(); }
+  inline bool done() const { return stmt_.done(); }
+  inline int rc() const { return stmt_.rc(); }
+  inline string_view errstr() const { return stmt_.errstr(); }
+
+ private:
+  template <size_t... Pos>
+  bool CheckColumns(std::index_sequence<Pos...>) const {
+    return (detail::AcceptsAffinity<ColTypes>::Accepts(detail::DeclaredAffinity(
+                sqlite3_column_decltype(stmt_.stmt_, Pos))) &&
+            ...);
+  }
+
+  Statement stmt_;
+};
+
+}  // namespace sqlite
+
+#endif  // THIRD_PARTY_SQLITE_SQLITE_TYPED_H_
@@ -0,0 +1,107 @@
+#include "sqlite_write_queue.h"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+namespace sqlite {
+
+WriteQueue::WriteQueue(sqlite3* db, size_t max_batch,
+                       Clock::duration max_delay)
+    : cache_(db),
+      max_batch_(std::max<size_t>(max_batch, 1)),
+      max_delay_(max_delay),
+      worker_([this] { Work(); }) {}
+
+WriteQueue::~WriteQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  queued_.notify_all();
+  worker_.join();
+}
+
+std::future<int> WriteQueue::SubmitFunction(
+    std::function<int(StatementCache&)> write) {
+  Write entry{std::move(write), std::promise<int>(), Clock::now(), nullptr};
+  std::future<int> done = entry.done.get_future();
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(entry));
+    // The worker only needs waking to start a batch or to close a full one.
+    wake = queue_.size() == 1 || queue_.size() >= max_batch_;
+  }
+  if (wake) queued_.notify_one();
+  return done;
+}
+
+void WriteQueue::Work() {
+  std::deque<Write> batch;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    queued_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+    if (queue_.empty()) return;
+    // Linger for more writes to share the commit, unless shutting down.
+    queued_.wait_until(lock, queue_.front().queued + max_delay_, [this] {
+      return stopping_ || queue_.size() >= max_batch_;
+    });
+    size_t size = std::min(queue_.size(), max_batch_);
+    std::move(queue_.begin(), queue_.begin() + size, std::back_inserter(batch));
+    queue_.erase(queue_.begin(), queue_.begin() + size);
+    lock.unlock();
+    RunBatch(batch);
+    batch.clear();
+    lock.lock();
+  }
+}
+
+void WriteQueue::RunBatch(std::deque<Write>& batch) {
+  batches_.fetch_add(1, std::memory_order_relaxed);
+  std::vector<int> results;
+  results.reserve(batch.size());
+  Transaction txn(cache_, TransactionMode::kImmediate);
+  int rc = txn.rc();
+  for (size_t i = 0; rc == SQLITE_OK && i < batch.size(); ++i) {
+    Savepoint savepoint(cache_);
+    int write_rc = savepoint.rc();
+    if (savepoint.ok()) {
+      try {
+        write_rc = batch[i].run(cache_);
+      } catch (...) {
+        batch[i].thrown = std::current_exception();
+        write_rc = SQLITE_ABORT;
+      }
+    }
+    if (write_rc == SQLITE_OK && !savepoint.Release()) {
+      write_rc = savepoint.rc();
+    }
+    if (write_rc != SQLITE_OK) savepoint.Rollback();
+    results.push_back(write_rc);
+    // Some errors roll back the whole transaction, taking every write before
+    // them with it.
+    if (sqlite3_get_autocommit(cache_.db())) {
+      rc = write_rc == SQLITE_OK ? SQLITE_ABORT : write_rc;
+    }
+  }
+  if (rc == SQLITE_OK && !txn.Commit()) rc = txn.rc();
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (batch[i].thrown) {
+      batch[i].done.set_exception(batch[i].thrown);
+    } else {
+      batch[i].done.set_value(rc == SQLITE_OK ? results[i] : rc);
+    }
+  }
+}
+
+}  // namespace sqlite
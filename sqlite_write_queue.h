@@ -0,0 +1,121 @@
+#ifndef THIRD_PARTY_SQLITE_SQLITE_WRITE_QUEUE_H_
+#define THIRD_PARTY_SQLITE_SQLITE_WRITE_QUEUE_H_
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace sqlite {
+
+// Group commit for a single writer connection. Producers on any thread
+// Submit() writes without waiting for them; a dedicated thread runs whatever
+// has been queued as one transaction per batch, so that many small writes
+// share a commit (and its fsync). Each write gets its own savepoint within the
+// batch, so a write that fails is rolled back alone and the rest still commit.
+// Each submitter's future is completed with the write's result when its batch
+// commits, or with the error if the batch could not commit.
+//
+// A batch closes when it holds max_batch writes or when its first write has
+// been waiting for max_delay, whichever comes first. Writes that arrive while a
+// batch is committing are picked up by the next one.
+//
+// The queue must be the only user of db while it exists, and any writes still
+// queued are committed before the destructor returns. With a ConnectionPool,
+// hold the writer's lease for the lifetime of the queue.
+//
+// Example:
+//
+// auto writer = pool.Writer();
+// WriteQueue queue(writer.db());
+// ...
+// // On any thread:
+// auto done = queue.Submit("INSERT INTO events(kind, at) VALUES (?, ?);",
+//                          kind, now);
+// if (done.get() != SQLITE_OK) cerr << "oh no!" << endl;
+class WriteQueue {
+ public:
+  static constexpr size_t kDefaultMaxBatch = 1024;
+  static constexpr Clock::duration kDefaultMaxDelay =
+      std::chrono::milliseconds(2);
+
+  explicit WriteQueue(sqlite3* db, size_t max_batch = kDefaultMaxBatch,
+                      Clock::duration max_delay = kDefaultMaxDelay);
+  WriteQueue(const WriteQueue&) = delete;
+  WriteQueue& operator=(const WriteQueue&) = delete;
+  ~WriteQueue();
+
+  // Queues a write of sql with params bound to it. Parameters are copied
+  // into a ParamPack (including the strings that views point to), so they
+  // need not outlive the call. The future yields SQLITE_OK once the write is
+  // committed, or the sqlite return code of the failure.
+  template <typename... Params>
+  std::future<int> Submit(string_view sql, const Params&... params) {
+    return SubmitFunction(
+        [sql = string(sql), pack = ParamPack(params...)](
+            StatementCache& cache) {
+          auto stmt = cache.Get(sql);
+          if (!stmt->ok()) return stmt->rc();
+          // The cache clears the bindings when the statement is returned.
+          return stmt->Bind(pack) && stmt->Run() ? SQLITE_OK : stmt->rc();
+        });
+  }
+
+  // Queues a function to be run on the writer connection as part of a batch.
+  // It returns an sqlite return code; anything other than SQLITE_OK rolls back
+  // its changes. If it throws, its changes are rolled back too and the future
+  // rethrows the exception, while the rest of the batch still commits. The
+  // cache prepares statements on the writer connection.
+  std::future<int> SubmitFunction(std::function<int(StatementCache&)> write);
+
+  // Number of batches committed (or attempted) so far.
+  inline int64 batches() const {
+    return batches_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Write {
+    std::function<int(StatementCache&)> run;
+    std::promise<int> done;
+    Clock::time_point queued;
+    // What run threw, if it did.
+    std::exception_ptr thrown;
+  };
+
+  void Work();
+  void RunBatch(std::deque<Write>& batch);
+
+  StatementCache cache_;
+  const size_t max_batch_;
+  const Clock::duration max_delay_;
+  std::atomic<int64> batches_{0};
+
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  // Guarded by mutex_.
+  std::deque<Write> queue_;
+  bool stopping_ = false;
+
+  // Started last, once everything it uses is constructed.
+  std::thread worker_;
+};
+
+}  // namespace sqlite
+
+#endif  // THIRD_PARTY_SQLITE_SQLITE_WRITE_QUEUE_H_
@@ -0,0 +1,130 @@
+#include "sqlite_write_queue.h"
+
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+
+#undef NDEBUG  // always keep asserts
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "sqlite3.h"
+#include "sqlite_cpp.h"
+
+namespace {
+
+const char kPath[] = "sqlite_write_queue_test.db";
+
+void RemoveDatabase() {
+  std::remove(kPath);
+  std::remove((std::string(kPath) + "-wal").c_str());
+  std::remove((std::string(kPath) + "-shm").c_str());
+}
+
+sqlite::int64 Count(sqlite3* db, const char* sql) {
+  sqlite::Statement count(db, sql);
+  return std::get<0>(*count.GetRow<sqlite::int64>());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  RemoveDatabase();
+  sqlite3* db;
+  assert(sqlite3_open(kPath, &db) == SQLITE_OK);
+  assert(sqlite::Exec(db, R"sql(
+    PRAGMA journal_mode=WAL;
+    PRAGMA synchronous=FULL;
+    CREATE TABLE t (k INTEGER PRIMARY KEY, v TEXT NOT NULL);
+  )sql"));
+  {
+    // Writes from many threads share commits.
+    sqlite::WriteQueue queue(db, 64, std::chrono::milliseconds(5));
+    std::vector<std::thread> threads;
+    std::vector<std::vector<std::future<int>>> done(4);
+    for (size_t i = 0; i < done.size(); ++i) {
+      threads.emplace_back([&queue, &done, i] {
+        for (int j = 0; j < 250; ++j) {
+          // The queue copies what the view points to.
+          std::string value = "value " + std::to_string(j);
+          done[i].push_back(
+              queue.Submit("INSERT INTO t(k, v) VALUES (?, ?);",
+                           static_cast<int>(i * 1000 + j),
+                           sqlite::TextView(value.data(), value.size())));
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    for (auto& futures : done) {
+      for (auto& future : futures) assert(future.get() == SQLITE_OK);
+    }
+    assert(Count(db, "SELECT count(*) FROM t;") == 1000);
+    assert(Count(db, "SELECT count(*) FROM t WHERE v = 'value 249';") == 4);
+    assert(queue.batches() < 1000 / 4);
+
+    // A failing write is rolled back alone.
+    auto ok = queue.Submit("INSERT INTO t(k, v) VALUES (?, ?);", -1, "ok");
+    auto duplicate = queue.Submit("INSERT INTO t(k, v) VALUES (?, ?);", 0,
+                                  sqlite::TextView("duplicate"));
+    auto null = queue.Submit("INSERT INTO t(k, v) VALUES (?, ?);", -2,
+                             std::optional<sqlite::TextView>());
+    auto bad_sql = queue.Submit("INSERT INTO nowhere VALUES (1);");
+    auto also_ok = queue.SubmitFunction([](sqlite::StatementCache& cache) {
+      auto stmt = cache.Get("UPDATE t SET v = 'changed' WHERE k = -1;");
+      return stmt->Run() ? SQLITE_OK : stmt->rc();
+    });
+    assert(ok.get() == SQLITE_OK);
+    assert(duplicate.get() == SQLITE_CONSTRAINT);
+    assert(null.get() == SQLITE_CONSTRAINT);
+    assert(bad_sql.get() == SQLITE_ERROR);
+    assert(also_ok.get() == SQLITE_OK);
+    assert(Count(db, "SELECT count(*) FROM t;") == 1001);
+    assert(Count(db, "SELECT count(*) FROM t WHERE v = 'changed';") == 1);
+
+    // A write that throws is rolled back alone, and its future rethrows.
+    auto before = queue.Submit("INSERT INTO t(k, v) VALUES (?, 'before');", -3);
+    auto throws = queue.SubmitFunction([](sqlite::StatementCache& cache) {
+      auto stmt = cache.Get("INSERT INTO t(k, v) VALUES (-4, 'thrown');");
+      assert(stmt->Run());
+      throw std::runtime_error("oops");
+      return SQLITE_OK;
+    });
+    auto after = queue.Submit("INSERT INTO t(k, v) VALUES (?, 'after');", -5);
+    assert(before.get() == SQLITE_OK);
+    bool thrown = false;
+    try {
+      throws.get();
+    } catch (const std::runtime_error& e) {
+      thrown = std::string(e.what()) == "oops";
+    }
+    assert(thrown);
+    assert(after.get() == SQLITE_OK);
+    assert(Count(db, "SELECT count(*) FROM t WHERE k IN (-3, -4, -5);") == 2);
+    assert(Count(db, "SELECT count(*) FROM t;") == 1003);
+
+    // Writes still queued at destruction are committed.
+    for (int i = 0; i < 10; ++i) {
+      queue.Submit("INSERT INTO t(k, v) VALUES (?, 'late');", 5000 + i);
+    }
+  }
+  assert(Count(db, "SELECT count(*) FROM t WHERE v = 'late';") == 10);
+  assert(sqlite3_close(db) == SQLITE_OK);
+  RemoveDatabase();
+
+  std::cout << "Ok!" << std::endl;
+  return 0;
+}